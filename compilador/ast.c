@@ -28,6 +28,8 @@
 static void __ast_recursive(GNode * root, GList ** token_list, TokenType end_with);
 static void inline ast_recursive(GNode * root, GList ** token_list);
 static void inline ast_recursive_stmt(GNode * root, GList ** token_list);
+static void ast_arguments(GNode * call, GList ** tokens);
+static void ast_if(GNode * root, GList ** tokens);
 static SymbolSubType tc_node_subtype(GNode * node);
 static SymbolSubType tc_node_subtype_unary(GNode * op, GNode * sub);
 static SymbolSubType tc_node_subtype_binary(GNode * op, GNode * left, GNode * right);
@@ -35,37 +37,29 @@ static SymbolSubType tc_node_subtype_binary(GNode * op, GNode * left, GNode * ri
 static SymbolSubType tc_result_subtype_binary(GNode * op, SymbolSubType left, SymbolSubType right);
 static SymbolSubType tc_result_subtype_unary(GNode * op, SymbolSubType sub_type);
 
-/* static global variables */
-SymbolTable *symbol_table;
-static Stack *funcproc_names;
 
 /**
- * Aborta o programa com uma mensagem de erro, mostrando o token, a linha e a coluna.
- * Aceita formatação no estilo printf().
+ * Interrompe a compilação com uma mensagem de erro, mostrando o token, a linha
+ * e a coluna (veja compiler_error()). Aceita formatação no estilo printf().
  *
  * @param token		A estrutura token mais próxima do erro
  * @param message	A string de formatação estilo printf()
  */
 static void ast_error_token(Token * token, gchar * message, ...)
 {
-    gchar *buffer;
+    gchar buffer[256];
     va_list args;
 
     va_start(args, message);
-    buffer = g_strdup_vprintf(message, args);
+    g_vsnprintf(buffer, sizeof(buffer), message, args);
     va_end(args);
 
-    printf
-	("Erro: ln <b>%d</b>, col <b>%d</b>, próximo a <b>%s </b>\342\206\222 %s\n",
-	 token->line, token->column, token->id, buffer);
-
-    g_free(buffer);
-
-    exit(1);
+    compiler_error(token->line, token->column, token->id, "%s", buffer);
 }
 
 /**
- * Cria um novo nó para a AST.
+ * Cria um novo nó para a AST. O nó é do contexto atual, e é liberado
+ * junto com ele.
  *
  * @param token	Tipo do nó
  * @param data  Dado armazenado no nó
@@ -74,13 +68,48 @@ ASTNode *ast_node_new(TokenType token, gpointer data)
 {
     ASTNode *node;
 
-    node = g_new0(ASTNode, 1);
+    node = compiler_alloc(sizeof(ASTNode));
     node->token = token;
     node->data = data;
 
     return node;
 }
 
+static gpointer ast_node_copy(gconstpointer src, gpointer data)
+{
+    const ASTNode *node = (const ASTNode *) src;
+
+    return ast_node_new(node->token, node->data);
+}
+
+/**
+ * Cria uma cópia de uma subárvore da AST. Os dados dos nós (nomes e
+ * literais) são compartilhados com a árvore original.
+ *
+ * @param node	Raiz da subárvore
+ * @returns	Raiz da cópia
+ */
+GNode *ast_copy(GNode * node)
+{
+    return g_node_copy_deep(node, ast_node_copy, NULL);
+}
+
+/**
+ * Cria um nó da árvore sendo construída por ast(). Até que ela esteja
+ * completa, o nó é guardado no contexto, para que seja liberado mesmo que
+ * a análise pare num erro, antes de ele ser ligado à árvore.
+ *
+ * @param ast_node	Dado do nó
+ */
+static GNode *ast_tree_node(ASTNode * ast_node)
+{
+    GNode *node = g_node_new(ast_node);
+
+    g_ptr_array_add(compiler_context->parsing, node);
+
+    return node;
+}
+
 /*
  * Processa uma lista de tokens de declaração de variáveis. Insere os símbolos na tabela de
  * símbolos e verifica a duplicidade.
@@ -95,7 +124,7 @@ static void ast_var(GNode * root, GList ** tokens)
     Token *token;
     SymbolSubType subtype;
 
-    var_root = g_node_new(ast_node_new(T_VAR, NULL));
+    var_root = ast_tree_node(ast_node_new(T_VAR, NULL));
     g_node_append(root, var_root);
 
     for (*tokens = (*tokens)->next; *tokens; *tokens = (*tokens)->next) {
@@ -108,7 +137,7 @@ static void ast_var(GNode * root, GList ** tokens)
 	case T_INTEGER:
 	case T_BOOLEAN:
 	    subtype = (token->type == T_INTEGER) ? SST_INTEGER : SST_BOOLEAN;
-	    var_type_root = g_node_new(ast_node_new(token->type, NULL));
+	    var_type_root = ast_tree_node(ast_node_new(token->type, NULL));
 
 	    g_node_append(var_root, var_type_root);
 
@@ -121,7 +150,7 @@ static void ast_var(GNode * root, GList ** tokens)
 
 		ASTNode *ast_node = ast_node_new(token->type, token->id);
 
-		g_node_append(var_type_root, g_node_new(ast_node));
+		g_node_append(var_type_root, ast_tree_node(ast_node));
 		symbol_table_install(symbol_table, token->id, ST_VARIABLE, subtype);
 	    }
 
@@ -168,6 +197,55 @@ static GList *ast_find_funproc_end(GList * tokens)
     return tokens;
 }
 
+/**
+ * Processa a lista de parâmetros de uma função ou procedimento, se houver.
+ * Os parâmetros são instalados como variáveis no contexto da subrotina e
+ * guardados, em ordem, no seu símbolo.
+ *
+ * @param symbol	Símbolo da função ou procedimento
+ * @param tokens	Entrada dos tokens, apontando para o token após o nome; é avançado até o token após a lista
+ */
+static void ast_parameters(Symbol * symbol, GList ** tokens)
+{
+    GList *names = NULL, *p;
+    Token *token;
+
+    if (((Token *) (*tokens)->data)->type != T_OPENPAREN)
+	return;
+
+    for (*tokens = (*tokens)->next;; *tokens = (*tokens)->next) {
+	token = (Token *) (*tokens)->data;
+
+	switch (token->type) {
+	case T_IDENTIFIER:
+	    names = g_list_append(names, token);
+	    break;
+	case T_INTEGER:
+	case T_BOOLEAN:
+	    for (p = names; p; p = p->next) {
+		Token *param = (Token *) p->data;
+
+		if (symbol_table_is_defined(symbol_table, param->id, 1)
+		    || g_str_equal(param->id, symbol->name)) {
+		    ast_error_token(param, "símbolo duplicado");
+		}
+
+		symbol->parameters = g_slist_append(symbol->parameters,
+						    symbol_table_install(symbol_table, param->id, ST_VARIABLE,
+									 token->type == T_INTEGER ? SST_INTEGER : SST_BOOLEAN));
+	    }
+
+	    g_list_free(names);
+	    names = NULL;
+	    break;
+	default:
+	    /* T_CLOSEPAREN */
+	    *tokens = (*tokens)->next;
+	    return;
+	}
+    }
+}
+
 /**
  * Cria um nó de função.
  * @param root		Raiz (raiz da AST se global, nó de função ou procedimento caso contrário)
@@ -178,6 +256,7 @@ static void ast_function(GNode * root, GList ** tokens)
     GNode *func_node;
     Token *token;
     GList *t;
+    Symbol *symbol;
     char *function_name;
 
     *tokens = (*tokens)->next;
@@ -186,20 +265,28 @@ static void ast_function(GNode * root, GList ** tokens)
     function_name = token->id;
 
     if (symbol_table_is_defined(symbol_table, function_name, 1)
-	|| (stack_peek(funcproc_names)
-	    && g_str_equal(stack_peek(funcproc_names), function_name))) {
+	|| (stack_peek(compiler_context->funcproc_names)
+	    && g_str_equal(stack_peek(compiler_context->funcproc_names), function_name))) {
 	ast_error_token(token, "símbolo duplicado");
     }
 
-    func_node = g_node_new(ast_node_new(T_FUNCTION, token->id));
-    stack_push(funcproc_names, function_name);
+    func_node = ast_tree_node(ast_node_new(T_FUNCTION, token->id));
+    stack_push(compiler_context->funcproc_names, function_name);
     g_node_append(root, func_node);
 
-    symbol_table_install(symbol_table, function_name, ST_FUNCTION,
-			 ((Token *) (*tokens)->next->data)->type == T_INTEGER ? SST_INTEGER : SST_BOOLEAN);
+    /* o tipo de retorno vem depois dos parâmetros */
+    for (t = (*tokens)->next; ((Token *) t->data)->type == T_OPENPAREN;) {
+	while (((Token *) t->data)->type != T_CLOSEPAREN)
+	    t = t->next;
+	t = t->next;
+    }
+
+    symbol = symbol_table_install(symbol_table, function_name, ST_FUNCTION,
+				  ((Token *) t->data)->type == T_INTEGER ? SST_INTEGER : SST_BOOLEAN);
     symbol_table_context_enter(symbol_table, function_name);
 
     *tokens = (*tokens)->next;
+    ast_parameters(symbol, tokens);
     *tokens = (*tokens)->next;
     switch (((Token *) (*tokens)->data)->type) {
     case T_BEGIN:
@@ -227,7 +314,7 @@ static void ast_function(GNode * root, GList ** tokens)
 
     ast_recursive(func_node, tokens);
 
-    stack_pop(funcproc_names);
+    stack_pop(compiler_context->funcproc_names);
     symbol_table_context_leave(symbol_table);
 }
 
@@ -241,6 +328,7 @@ static void ast_procedure(GNode * root, GList ** tokens)
     GNode *proc_node;
     Token *token;
     GList *t;
+    Symbol *symbol;
     char *proc_name;
 
     *tokens = (*tokens)->next;
@@ -249,19 +337,20 @@ static void ast_procedure(GNode * root, GList ** tokens)
     proc_name = token->id;
 
     if (symbol_table_is_defined(symbol_table, proc_name, 1)
-	|| (stack_peek(funcproc_names)
-	    && g_str_equal(stack_peek(funcproc_names), proc_name))) {
+	|| (stack_peek(compiler_context->funcproc_names)
+	    && g_str_equal(stack_peek(compiler_context->funcproc_names), proc_name))) {
 	ast_error_token(token, "símbolo duplicado");
     }
 
-    proc_node = g_node_new(ast_node_new(T_PROCEDURE, token->id));
-    stack_push(funcproc_names, token->id);
+    proc_node = ast_tree_node(ast_node_new(T_PROCEDURE, token->id));
+    stack_push(compiler_context->funcproc_names, token->id);
     g_node_append(root, proc_node);
 
-    symbol_table_install(symbol_table, proc_name, ST_PROCEDURE, SST_NONE);
+    symbol = symbol_table_install(symbol_table, proc_name, ST_PROCEDURE, SST_NONE);
     symbol_table_context_enter(symbol_table, proc_name);
 
     *tokens = (*tokens)->next;
+    ast_parameters(symbol, tokens);
 
     switch (((Token *) (*tokens)->data)->type) {
     default:
@@ -288,7 +377,7 @@ static void ast_procedure(GNode * root, GList ** tokens)
     }
 
     ast_recursive(proc_node, tokens);
-    stack_pop(funcproc_names);
+    stack_pop(compiler_context->funcproc_names);
 
     symbol_table_context_leave(symbol_table);
 }
@@ -391,7 +480,12 @@ static SymbolSubType tc_node_subtype_binary(GNode * op, GNode * left, GNode * ri
     SymbolSubType left_subtype, right_subtype;
 
     left_subtype = tc_node_subtype(left);
-    right_subtype = tc_node_subtype(right);
+    if (((ASTNode *) right->data)->token == T_DUP) {
+	/* DUP repete o operando esquerdo (ver optimization.c) */
+	right_subtype = left_subtype;
+    } else {
+	right_subtype = tc_node_subtype(right);
+    }
 
     return tc_result_subtype_binary(op, left_subtype, right_subtype);
 }
@@ -400,6 +494,16 @@ static SymbolSubType tc_node_subtype(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
 
+    if (ast_node->token == T_FUNCTION_CALL) {
+	/* os filhos são os argumentos, verificados em ast_arguments() */
+	return symbol_table_get_attribute_int(symbol_table, (char *) ast_node->data, STF_SUBTYPE);
+    }
+
+    if (ast_node->token == T_SELECT) {
+	/* both values have the type of the variable they're assigned to */
+	return tc_node_subtype(node->children->next);
+    }
+
     if (G_NODE_IS_LEAF(node)) {
 	switch (ast_node->token) {
 	case T_NUMBER:
@@ -408,7 +512,6 @@ static SymbolSubType tc_node_subtype(GNode * node)
 	case T_FALSE:
 	    return SST_BOOLEAN;
 	case T_IDENTIFIER:
-	case T_FUNCTION_CALL:
 	    return symbol_table_get_attribute_int(symbol_table, (char *) ast_node->data, STF_SUBTYPE);
 	default:
 	    /* WTF? */
@@ -423,6 +526,16 @@ static SymbolSubType tc_node_subtype(GNode * node)
     }
 }
 
+/**
+ * Retorna o subtipo de uma expressão já verificada, no contexto atual da
+ * tabela de símbolos. Usado pelo otimizador ao criar variáveis temporárias.
+ * @param node		Raiz da expressão
+ * @returns		Subtipo da expressão ou SST_NONE caso exista discrepância de tipos
+ */
+SymbolSubType ast_node_subtype(GNode * node)
+{
+    return tc_node_subtype(node);
+}
 
 static int inline __op_priority(TokenType op)
 {
@@ -520,18 +633,30 @@ static void pop_connect_push(Stack * op_stack, Stack * node_stack)
     stack_push(node_stack, temp);
 }
 
+/**
+ * Cria a árvore de uma expressão.
+ * @param root		Nó ao qual a expressão é anexada
+ * @param tokens	Entrada dos tokens; é avançado até o token //stop//
+ * @param stop		Token que termina a expressão; T_COMMA termina também no ")"
+ *			que fecha a lista de argumentos de uma chamada
+ */
 static void ast_expression(GNode * root, GList ** tokens, TokenType stop)
 {
     Token *token;
     Stack *op_stack, *node_stack;
+    GNode *node;
+    gint depth = 0;
 
     op_stack = stack_new();
     node_stack = stack_new();
+    stack_push(compiler_context->expressions, op_stack);
+    stack_push(compiler_context->expressions, node_stack);
 
     for (*tokens = (*tokens)->next; *tokens; *tokens = (*tokens)->next) {
 	token = (Token *) (*tokens)->data;
 
-	if (token->type == stop) {
+	if (token->type == stop
+	    || (stop == T_COMMA && token->type == T_CLOSEPAREN && !depth)) {
 	    break;
 	}
 
@@ -541,7 +666,7 @@ static void ast_expression(GNode * root, GList ** tokens, TokenType stop)
 	case T_NUMBER:
 	case T_FALSE:
 	case T_TRUE:
-	    stack_push(node_stack, g_node_new(ast_node_new(token->type, token->id)));
+	    stack_push(node_stack, ast_tree_node(ast_node_new(token->type, token->id)));
 	    break;
 	case T_IDENTIFIER:
 	    switch (symbol_table_get_attribute_int(symbol_table, token->id, STF_TYPE)) {
@@ -557,7 +682,14 @@ static void ast_expression(GNode * root, GList ** tokens, TokenType stop)
 		ast_error_token(token, "não é variável ou função");
 	    }
 
-	    stack_push(node_stack, g_node_new(ast_node_new(token->type, token->id)));
+	    node = ast_tree_node(ast_node_new(token->type, token->id));
+	    if (token->type == T_FUNCTION_CALL) {
+		ast_arguments(node, tokens);
+	    } else if ((*tokens)->next && ((Token *) (*tokens)->next->data)->type == T_OPENPAREN) {
+		ast_error_token(token, "não é função");
+	    }
+
+	    stack_push(node_stack, node);
 	    break;
 	case T_NOT:
 	case T_UNARY_MINUS:
@@ -575,12 +707,12 @@ static void ast_expression(GNode * root, GList ** tokens, TokenType stop)
 	case T_OR:
 	case T_AND:
 	    if (stack_is_empty(op_stack)) {
-		stack_push(op_stack, g_node_new(ast_node_new(token->type, token->id)));
+		stack_push(op_stack, ast_tree_node(ast_node_new(token->type, token->id)));
 	    } else if (ast_node_token(stack_peek(op_stack)) == T_OPENPAREN) {
-		stack_push(op_stack, g_node_new(ast_node_new(token->type, token->id)));
+		stack_push(op_stack, ast_tree_node(ast_node_new(token->type, token->id)));
 	    } else if (__op_priority(ast_node_token(stack_peek(op_stack)))
 		       < __op_priority(token->type)) {
-		stack_push(op_stack, g_node_new(ast_node_new(token->type, token->id)));
+		stack_push(op_stack, ast_tree_node(ast_node_new(token->type, token->id)));
 	    } else {
 		do {
 		    pop_connect_push(op_stack, node_stack);
@@ -589,13 +721,15 @@ static void ast_expression(GNode * root, GList ** tokens, TokenType stop)
 			   T_OPENPAREN
 			   || __op_priority(ast_node_token(stack_peek(op_stack))) < __op_priority(token->type)));
 
-		stack_push(op_stack, g_node_new(ast_node_new(token->type, token->id)));
+		stack_push(op_stack, ast_tree_node(ast_node_new(token->type, token->id)));
 	    }
 	    break;
 	case T_OPENPAREN:
-	    stack_push(op_stack, g_node_new(ast_node_new(token->type, token->id)));
+	    depth++;
+	    stack_push(op_stack, ast_tree_node(ast_node_new(token->type, token->id)));
 	    break;
 	case T_CLOSEPAREN:
+	    depth--;
 	    while (ast_node_token(stack_peek(op_stack)) != T_OPENPAREN) {
 		pop_connect_push(op_stack, node_stack);
 	    }
@@ -610,10 +744,52 @@ static void ast_expression(GNode * root, GList ** tokens, TokenType stop)
 
     g_node_append(root, stack_pop(node_stack));
 
+    stack_pop(compiler_context->expressions);
+    stack_pop(compiler_context->expressions);
     stack_free(op_stack);
     stack_free(node_stack);
 }
 
+/**
+ * Cria os nós dos argumentos de uma chamada de função ou procedimento, como
+ * filhos do nó da chamada, e verifica sua quantidade e seus tipos.
+ *
+ * @param call		Nó da chamada
+ * @param tokens	Entrada dos tokens, apontando para o nome; é avançado até o último token da chamada
+ */
+static void ast_arguments(GNode * call, GList ** tokens)
+{
+    Token *name, *token;
+    Symbol *symbol;
+    GSList *param;
+    GNode *arg;
+    gint n;
+
+    name = (Token *) (*tokens)->data;
+    symbol = symbol_table_lookup_symbol(symbol_table, name->id);
+
+    if ((*tokens)->next && ((Token *) (*tokens)->next->data)->type == T_OPENPAREN) {
+	*tokens = (*tokens)->next;
+
+	do {
+	    ast_expression(call, tokens, T_COMMA);
+	    token = (Token *) (*tokens)->data;
+	} while (token->type == T_COMMA);
+    }
+
+    for (n = 1, param = symbol->parameters, arg = call->children;
+	 param || arg; n++, param = param->next, arg = arg->next) {
+	if (!param || !arg) {
+	    ast_error_token(name, "número incorreto de argumentos para <b>%s</b>", name->id);
+	}
+
+	if (tc_node_subtype(arg) != ((Symbol *) param->data)->subtype) {
+	    ast_error_token(name, "argumento %d de <b>%s</b> deve ser do tipo <b>%s</b>",
+			    n, name->id, symbol_subtypes[((Symbol *) param->data)->subtype]);
+	}
+    }
+}
+
 static void ast_attrib(GNode * root, GList ** tokens)
 {
     Token *token;
@@ -631,17 +807,17 @@ static void ast_attrib(GNode * root, GList ** tokens)
 	case ST_FUNCTION:
 	    ast_node = ast_node_new(T_FUNCTION_RETURN, token->id);
 
-	    if (!g_str_equal(stack_peek(funcproc_names), token->id)) {
+	    if (!g_str_equal(stack_peek(compiler_context->funcproc_names), token->id)) {
 		ast_error_token(token,
 				"retorno de <b>%s</b> não permitido em <b>%s</b>",
-				token->id, stack_peek(funcproc_names));
+				token->id, stack_peek(compiler_context->funcproc_names));
 	    }
 	    break;
 	default:
 	    ast_error_token(token, "não é variável ou função");
 	}
 
-	attrib_node = g_node_new(ast_node);
+	attrib_node = ast_tree_node(ast_node);
 	g_node_append(root, attrib_node);
 
 	ast_expression(attrib_node, tokens, T_SEMICOLON);
@@ -661,7 +837,7 @@ static void ast_else(GNode * root, GList ** tokens)
     Token *token;
     GNode *else_node;
 
-    else_node = g_node_new(ast_node_new(T_ELSE, NULL));
+    else_node = ast_tree_node(ast_node_new(T_ELSE, NULL));
     g_node_append(root, else_node);
 
     *tokens = (*tokens)->next;
@@ -671,7 +847,7 @@ static void ast_else(GNode * root, GList ** tokens)
 	*tokens = (*tokens)->next;
 	ast_recursive(else_node, tokens);
     } else if (token->type == T_IF) {
-	ast_recursive(else_node, tokens);
+	ast_if(else_node, tokens);
     } else {
 	ast_recursive_stmt(else_node, tokens);
     }
@@ -682,7 +858,7 @@ static void ast_if(GNode * root, GList ** tokens)
     Token *token = (Token *) (*tokens)->data;
     GNode *if_node;
 
-    if_node = g_node_new(ast_node_new(T_IF, NULL));
+    if_node = ast_tree_node(ast_node_new(T_IF, NULL));
     g_node_append(root, if_node);
 
     ast_expression(if_node, tokens, T_THEN);
@@ -712,7 +888,7 @@ static void ast_while(GNode * root, GList ** tokens)
     Token *token = (Token *) (*tokens)->data;
     GNode *while_node;
 
-    while_node = g_node_new(ast_node_new(T_WHILE, NULL));
+    while_node = ast_tree_node(ast_node_new(T_WHILE, NULL));
     g_node_append(root, while_node);
 
     ast_expression(while_node, tokens, T_DO);
@@ -729,7 +905,7 @@ static void ast_for(GNode * root, GList ** tokens)
     Token *token;
 
     /* for */
-    for_node = g_node_new(ast_node_new(T_FOR, NULL));
+    for_node = ast_tree_node(ast_node_new(T_FOR, NULL));
     g_node_append(root, for_node);
 
     /* variable */
@@ -737,7 +913,7 @@ static void ast_for(GNode * root, GList ** tokens)
     token = (Token *) (*tokens)->data;
     if (symbol_table_get_attribute_int(symbol_table, token->id, STF_TYPE)
 	== ST_VARIABLE) {
-	var_node = g_node_new(ast_node_new(T_ATTRIB, token->id));
+	var_node = ast_tree_node(ast_node_new(T_ATTRIB, token->id));
     } else {
 	ast_error_token(token, "símbolo não definido ou não variável");
     }
@@ -771,7 +947,7 @@ static void ast_for(GNode * root, GList ** tokens)
 	/* consume T_DO */
 	*tokens = (*tokens)->next;
     } else {
-	g_node_append(for_node, g_node_new(ast_node_new(T_NUMBER, "1")));
+	g_node_append(for_node, ast_tree_node(ast_node_new(T_NUMBER, "1")));
     }
 
     /* statement */
@@ -802,7 +978,7 @@ static void ast_read(GNode * root, GList ** tokens)
 	ast_error_token(token, "variável não é do tipo inteiro");
     }
 
-    g_node_append(root, g_node_new(ast_node_new(T_READ, token->id)));
+    g_node_append(root, ast_tree_node(ast_node_new(T_READ, token->id)));
 
     *tokens = (*tokens)->next;	/* skip T_IDENTIFIER */
 }
@@ -831,7 +1007,7 @@ static void ast_write(GNode * root, GList ** tokens)
 	ast_error_token(token, "variável não é do tipo inteiro");
     }
 
-    g_node_append(root, g_node_new(ast_node_new(T_WRITE, token->id)));
+    g_node_append(root, ast_tree_node(ast_node_new(T_WRITE, token->id)));
 
     *tokens = (*tokens)->next;	/* skip T_IDENTIFIER */
 }
@@ -839,6 +1015,7 @@ static void ast_write(GNode * root, GList ** tokens)
 static void ast_identifier(GNode * root, GList ** tokens)
 {
     Token *token, *prev_token;
+    GNode *call_node;
     gchar *symbol;
 
     prev_token = token = (Token *) (*tokens)->data;
@@ -846,13 +1023,16 @@ static void ast_identifier(GNode * root, GList ** tokens)
 
     switch (symbol_table_get_attribute_int(symbol_table, token->id, STF_TYPE)) {
     case ST_PROCEDURE:
+	call_node = ast_tree_node(ast_node_new(T_PROCEDURE_CALL, symbol));
+	ast_arguments(call_node, tokens);
+
 	*tokens = (*tokens)->next;
 	token = (Token *) (*tokens)->data;
 
 	if (token->type == T_ATTRIB)
 	    ast_error_token(prev_token, "impossível atribuir a um procedimento");
 
-	g_node_append(root, g_node_new(ast_node_new(T_PROCEDURE_CALL, symbol)));
+	g_node_append(root, call_node);
 	break;
     case ST_FUNCTION:
 	*tokens = (*tokens)->next;
@@ -864,6 +1044,10 @@ static void ast_identifier(GNode * root, GList ** tokens)
 	break;
     case ST_VARIABLE:
 	*tokens = (*tokens)->next;
+	token = (Token *) (*tokens)->data;
+
+	if (token->type != T_ATTRIB)
+	    ast_error_token(prev_token, "não é procedimento");
 	break;
     default:
 	ast_error_token(token, "símbolo indefinido");
@@ -881,7 +1065,7 @@ static void ast_main_begin(GNode * root, GList ** tokens)
 {
     GNode *main_begin_node;
 
-    main_begin_node = g_node_new(ast_node_new(T_MAIN_BEGIN, NULL));
+    main_begin_node = ast_tree_node(ast_node_new(T_MAIN_BEGIN, NULL));
     g_node_append(root, main_begin_node);
 
     *tokens = (*tokens)->next;
@@ -961,25 +1145,35 @@ GNode *ast(TokenList * token_list)
 	return NULL;
 
     symbol_table = symbol_table_new();
-    funcproc_names = stack_new();
+    compiler_context->funcproc_names = stack_new();
+    compiler_context->expressions = stack_new();
+    compiler_context->parsing = g_ptr_array_new();
 
     token = (Token *) (token_list->tokens)->next->data;
-    ast = g_node_new(ast_node_new(T_PROGRAM, token->id));
+    ast = ast_tree_node(ast_node_new(T_PROGRAM, token->id));
     symbol_table_install(symbol_table, token->id, ST_PROGRAM, SST_NONE);
     symbol_table_context_enter(symbol_table, token->id);
 
     tokens = token_list->tokens->next->next;
     ast_recursive(ast, &tokens);
 
-    stack_free(funcproc_names);
+    stack_free(compiler_context->funcproc_names);
+    compiler_context->funcproc_names = NULL;
+    stack_free(compiler_context->expressions);
+    compiler_context->expressions = NULL;
+
+    /* a árvore está completa: os nós agora são dela, e ela do contexto */
+    g_ptr_array_free(compiler_context->parsing, TRUE);
+    compiler_context->parsing = NULL;
+    compiler_context->ast = ast;
 
     return ast;
 }
 
 static gboolean traverse_func(GNode * node, gpointer data)
 {
-    static GHashTable *t = NULL;
-    static gint count = 0, last_printed = -1;
+    static PER_THREAD GHashTable *t = NULL;
+    static PER_THREAD gint count = 0, last_printed = -1;
 
     if (!t) {
 	t = g_hash_table_new(NULL, g_int_equal);
@@ -1016,16 +1210,16 @@ static gboolean traverse_func(GNode * node, gpointer data)
 	data2 = g_str_equal(data2, literals[ast_node->token]) ? "" : data2;
 
 	if (last_printed < lbl1) {
-	    printf("\tnode%d [label=\"%s %s\"];\n", lbl1, literals[ast_parent->token], data1);
+	    compiler_write("\tnode%d [label=\"%s %s\"];\n", lbl1, literals[ast_parent->token], data1);
 	    last_printed = lbl1;
 	}
 
 	if (last_printed < lbl2) {
-	    printf("\tnode%d [label=\"%s %s\"];\n", lbl2, literals[ast_node->token], data2);
+	    compiler_write("\tnode%d [label=\"%s %s\"];\n", lbl2, literals[ast_node->token], data2);
 	    last_printed = lbl2;
 	}
 
-	printf("\tnode%d -> node%d;\n", lbl1, lbl2);
+	compiler_write("\tnode%d -> node%d;\n", lbl1, lbl2);
     }
     return FALSE;
 }
@@ -1043,9 +1237,9 @@ int ast_test_main(int argc, char **argv)
        ate mesmo o endereco da variavel. parece que a ast() ta corrompendo memoria em algum
        canto. preciso descobrir onde. */
 
-    puts("digraph ast {");
+    compiler_write("digraph ast {\n");
     g_node_traverse(root, G_PRE_ORDER, G_TRAVERSE_ALL, -1, traverse_func, NULL);
-    puts("}");
+    compiler_write("}\n");
 
     traverse_func(NULL, NULL);
 
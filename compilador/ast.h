@@ -12,8 +12,6 @@
 #include "symbol-table.h"
 #include "lex.h"
 
-extern SymbolTable *symbol_table;
-
 typedef struct	_ASTNode	ASTNode;
 
 struct _ASTNode {
@@ -24,6 +22,8 @@ struct _ASTNode {
 GNode          *ast(TokenList * token_list);
 int		ast_test_main(int argc, char **argv);
 ASTNode        *ast_node_new(TokenType token, gpointer data);
+GNode          *ast_copy(GNode * node);
+SymbolSubType	ast_node_subtype(GNode * node);
 
 #endif	/* __AST_H__ */
 
@@ -0,0 +1,503 @@
+/*
+ * Simple Pascal Compiler
+ * Autotuner
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ * Which passes pay off depends on the program, so csd --autotune compiles
+ * it under many configurations, runs each object on the virtual machine
+ * with the same data, and keeps the one that executes the fewest
+ * instructions while writing what the program compiled at -O0 does.
+ *
+ * Every pass in passes[] is a knob, switched on and off with -f<name> and
+ * -fno-<name>: the search starts from the best of -O0 to -O3 and of the
+ * options given, then flips one knob at a time while that helps. Each
+ * variant is compiled in a context of its own, right into the virtual
+ * machine, so nothing a compilation leaves behind leaks into the next.
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vm.h"
+
+#include "compiler_context.h"
+#include "passes.h"
+#include "autotune.h"
+
+#define AUTOTUNE_MAX_STEPS	100000000	/* for the program at -O0 */
+#define AUTOTUNE_MAX_ROUNDS	4		/* of flipping every knob */
+
+typedef struct _Variant	Variant;
+typedef struct _Autotune	Autotune;
+
+struct _Variant {
+  gchar		*config;	/* '1' or '0' for each pass, in passes[] order */
+  gchar		*messages;	/* what the compiler said, if it didn't compile */
+  gchar		*output;	/* NULL if it didn't stop in time */
+  guint		 steps;		/* instructions executed */
+  gboolean	 correct;	/* wrote what the reference did */
+};
+
+/* what a call to autotune() works with; many may run at once */
+struct _Autotune {
+  VM		*vm;
+  GHashTable	*variants;	/* config -> Variant * */
+  Variant	*reference;	/* all passes disabled */
+  Variant	*best;
+  const gchar	*data_file;
+  gchar		*profile_file;
+  gint		 n_passes, profile_layout;
+  gint		 n_compiled, n_failed, n_wrong;
+
+  FILE		*data;		/* what the running variant reads */
+  gchar		 line[128];	/* ...and the line it read last */
+};
+
+static gchar *
+autotune_read(gpointer data)
+{
+  Autotune *tune = (Autotune *)data;
+
+  if (!fgets(tune->line, sizeof(tune->line), tune->data))
+    tune->line[0] = '\0';
+
+  return tune->line;
+}
+
+static void
+autotune_write(gpointer data, char *string)
+{
+  g_string_append_printf((GString *)data, "%s\n", string);
+}
+
+static void
+object_write(gpointer data, const gchar *string)
+{
+  g_string_append((GString *)data, string);
+}
+
+static gchar *
+temp_file_new(void)
+{
+  gchar *name;
+  gint fd;
+
+  if ((fd = g_file_open_tmp("csdXXXXXX", &name, NULL)) == -1)
+    return NULL;
+
+  close(fd);
+  return name;
+}
+
+static void
+variant_free(Variant *variant)
+{
+  g_free(variant->config);
+  g_free(variant->messages);
+  g_free(variant->output);
+  g_free(variant);
+}
+
+/*
+ * Returns the configuration of the passes enabled by ``level'' and
+ * ``toggles'', as passes_setup() does.
+ */
+static gchar *
+config_new(Autotune *tune, gint level, GSList *toggles)
+{
+  gchar *config;
+  gint i;
+
+  passes_setup(level, toggles);
+
+  config = g_strnfill(tune->n_passes, '0');
+  for (i = 0; i < tune->n_passes; i++) {
+    if (passes[i].enabled)
+      config[i] = '1';
+  }
+
+  return config;
+}
+
+static Variant *variant_get(Autotune *tune, const gchar *config);
+static void variant_execute(Autotune *tune, Variant *variant, guint limit,
+                            const gchar *profile_path);
+
+/*
+ * The variant that ``variant'' takes the profile from, if it lays the code
+ * out by one: the same passes, without profile-layout.
+ */
+static Variant *
+variant_plain(Autotune *tune, Variant *variant)
+{
+  Variant *plain;
+  gchar *plain_config;
+
+  if (variant->config[tune->profile_layout] != '1')
+    return NULL;
+
+  plain_config = g_strdup(variant->config);
+  plain_config[tune->profile_layout] = '0';
+  plain = variant_get(tune, plain_config);
+  g_free(plain_config);
+
+  return plain;
+}
+
+/*
+ * Compiles the program with the passes of ``variant'' and nothing else, in
+ * a context of its own: into the VM, or to ``object'' if given. Returns
+ * FALSE, with what the compiler said in variant->messages, if it doesn't
+ * compile.
+ */
+static gboolean
+variant_compile(Autotune *tune, Variant *variant, GString *object)
+{
+  CompilerParams p = params;
+  CompilerContext *ctx;
+  Variant *plain;
+  GSList *toggles = NULL, *l;
+  GString *messages;
+  FILE *input;
+  gboolean compiled;
+  gint i;
+
+  /* the profile must come from the same code, laid out as usual */
+  if ((plain = variant_plain(tune, variant)))
+    variant_execute(tune, plain, plain->steps, tune->profile_file);
+
+  for (i = tune->n_passes - 1; i >= 0; i--) {
+    toggles = g_slist_prepend(toggles, g_strdup_printf(variant->config[i] == '1' ? "%s" : "no-%s",
+                                                       passes[i].name));
+  }
+
+  p.optimization_level = 0;
+  p.pass_toggles = toggles;
+  p.profile_use = plain ? tune->profile_file : NULL;
+  p.output_format = NULL;
+  p.dump_callgraph = p.dump_modref = p.show_time = p.run = FALSE;
+  p.autotune = NULL;
+
+  g_free(variant->messages);
+  variant->messages = NULL;
+
+  if (!(input = fopen(p.input_file, "r"))) {
+    variant->messages = g_strdup_printf("can't open input file ``%s''\n", p.input_file);
+    compiled = FALSE;
+  } else {
+    ctx = compiler_context_new(&p, input, object ? object_write : NULL, object);
+    ctx->vm = object ? NULL : tune->vm;
+
+    if (!(compiled = compiler_context_compile(ctx))) {
+      messages = g_string_new(NULL);
+
+      for (l = ctx->diagnostics; l; l = l->next) {
+        gchar *message = compiler_diagnostic_message((CompilerDiagnostic *)l->data);
+
+        g_string_append_printf(messages, "%s\n", message);
+        g_free(message);
+      }
+
+      variant->messages = g_string_free(messages, FALSE);
+    }
+
+    compiler_context_free(ctx);
+    fclose(input);
+  }
+
+  for (l = toggles; l; l = l->next)
+    g_free(l->data);
+  g_slist_free(toggles);
+
+  return compiled;
+}
+
+/*
+ * Compiles the object of ``variant'' into the VM and runs it on the data,
+ * for at most ``limit'' instructions; writes its profile to ``profile_path''
+ * if given.
+ */
+static void
+variant_execute(Autotune *tune, Variant *variant, guint limit, const gchar *profile_path)
+{
+  VM *vm = tune->vm;
+  GString *output;
+
+  g_free(variant->output);
+  variant->output = NULL;
+
+  if (!variant_compile(tune, variant, NULL) || !(tune->data = fopen(tune->data_file, "r")))
+    return;
+
+  output = g_string_new(NULL);
+  vm->write_function_data = output;
+  vm->profiling = profile_path != NULL;
+  vm->running = TRUE;
+
+  for (variant->steps = 0; vm->running && vm->instruction_pointer; variant->steps++) {
+    if (variant->steps == limit)
+      break;
+
+    vm_step(vm);
+  }
+
+  fclose(tune->data);
+  tune->data = NULL;
+
+  if (vm->running && vm->instruction_pointer) {
+    g_string_free(output, TRUE);
+    return;
+  }
+
+  variant->output = g_string_free(output, FALSE);
+
+  if (profile_path)
+    vm_profile_save(vm, profile_path);
+}
+
+/*
+ * Compiles and runs the program under ``config'', unless it already was.
+ */
+static Variant *
+variant_get(Autotune *tune, const gchar *config)
+{
+  Variant *variant, *plain, *reference = tune->reference;
+
+  if ((variant = g_hash_table_lookup(tune->variants, config)))
+    return variant;
+
+  variant = g_new0(Variant, 1);
+  variant->config = g_strdup(config);
+  g_hash_table_insert(tune->variants, variant->config, variant);
+
+  if ((plain = variant_plain(tune, variant)) && !plain->correct)
+    return variant;
+
+  /* what's twice as slow as no optimization at all is wrong anyway */
+  variant_execute(tune, variant, reference ? reference->steps * 2 : AUTOTUNE_MAX_STEPS, NULL);
+
+  if (variant->messages) {
+    tune->n_failed++;
+    return variant;
+  }
+
+  tune->n_compiled++;
+
+  if (reference) {
+    variant->correct = variant->output && g_str_equal(variant->output, reference->output);
+
+    if (!variant->correct)
+      tune->n_wrong++;
+  } else {
+    variant->correct = variant->output != NULL;
+  }
+
+  return variant;
+}
+
+static gboolean
+autotune_try(Autotune *tune, const gchar *config)
+{
+  Variant *variant = variant_get(tune, config);
+
+  if (variant->correct && variant->steps < tune->best->steps) {
+    tune->best = variant;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/*
+ * Describes ``config'' as the optimization level it's closest to, and the
+ * passes that differ from it.
+ */
+static gchar *
+config_describe(Autotune *tune, const gchar *config)
+{
+  GString *description;
+  gchar *level_config;
+  gint level, closest = 0, distance, closest_distance = tune->n_passes + 1, i;
+
+  for (level = 0; level <= 3; level++) {
+    level_config = config_new(tune, level, NULL);
+
+    for (i = distance = 0; i < tune->n_passes; i++) {
+      if (config[i] != level_config[i])
+        distance++;
+    }
+
+    if (distance <= closest_distance) {
+      closest = level;
+      closest_distance = distance;
+    }
+
+    g_free(level_config);
+  }
+
+  description = g_string_new(NULL);
+  g_string_printf(description, "-O%d", closest);
+
+  level_config = config_new(tune, closest, NULL);
+  for (i = 0; i < tune->n_passes; i++) {
+    if (config[i] != level_config[i]) {
+      g_string_append_printf(description, config[i] == '1' ? " -f%s" : " -fno-%s",
+                             passes[i].name);
+    }
+  }
+  g_free(level_config);
+
+  return g_string_free(description, FALSE);
+}
+
+/* appends to ``report'' how the configurations fared, for csd to show */
+static void
+autotune_report(Autotune *tune, const gchar *requested, GString *report)
+{
+  Variant *variant, *best = tune->best, *reference = tune->reference;
+  gchar *config, *description;
+  gint level;
+
+  g_string_append_printf(report, "Autoajuste com os dados de %s: %d configurações, %d com saída diferente, %d com erro\n",
+                         tune->data_file, tune->n_compiled, tune->n_wrong, tune->n_failed);
+
+  for (level = 0; level <= 3; level++) {
+    config = config_new(tune, level, NULL);
+    variant = variant_get(tune, config);
+    g_free(config);
+
+    if (variant->correct)
+      g_string_append_printf(report, "    -O%d: %u instruções\n", level, variant->steps);
+    else
+      g_string_append_printf(report, "    -O%d: saída diferente\n", level);
+  }
+
+  variant = variant_get(tune, requested);
+  description = config_describe(tune, best->config);
+
+  g_string_append_printf(report, "Melhor configuração: %s\n    %u instruções, %.1f%% menos que -O0, %.1f%% menos que a pedida\n",
+                         description, best->steps,
+                         ((reference->steps - best->steps) * 100.0f) / reference->steps,
+                         variant->correct ?
+                         ((variant->steps - best->steps) * 100.0f) / variant->steps : 0.0f);
+
+  if (best->config[tune->profile_layout] == '1')
+    g_string_append(report, "    (com o perfil da mesma configuração, sem profile-layout)\n");
+
+  g_free(description);
+}
+
+static void
+autotune_finish(Autotune *tune)
+{
+  if (tune->profile_file)
+    unlink(tune->profile_file);
+  g_free(tune->profile_file);
+
+  vm_object_unload(tune->vm);
+  vm_destroy(tune->vm);
+  g_hash_table_destroy(tune->variants);
+}
+
+/*
+ * Writes to the sink of the context the object that executes the fewest
+ * instructions reading ``data'', and appends to ``report'' how it was
+ * compiled. Returns the exit status for csd; if it can't tune, it stops
+ * with a diagnostic instead (see compiler_error()).
+ */
+int
+autotune(const gchar *data, GString *report)
+{
+  Autotune tune = { NULL };
+  GSList *levels = NULL, *l;
+  const gchar *unknown;
+  gchar *config, *requested, message[1024];
+  GString *object;
+  FILE *file;
+  gint level, round, i;
+  gboolean improved;
+
+  if (g_str_equal(params.input_file, "-"))
+    compiler_error(0, 0, NULL, "can't autotune a program read from the standard input");
+
+  if (!(file = fopen(data, "r")))
+    compiler_error(0, 0, NULL, "can't open input data ``%s''", data);
+  fclose(file);
+
+  if ((unknown = passes_setup(params.optimization_level, params.pass_toggles)))
+    compiler_error(0, 0, NULL, "unknown optimization pass ``%s''", unknown);
+
+  for (tune.n_passes = 0; passes[tune.n_passes].name; tune.n_passes++) {
+    if (g_str_equal(passes[tune.n_passes].name, "profile-layout"))
+      tune.profile_layout = tune.n_passes;
+  }
+
+  tune.data_file = data;
+  tune.profile_file = temp_file_new();
+  tune.variants = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        NULL, (GDestroyNotify)variant_free);
+  tune.vm = vm_new(autotune_read, &tune, autotune_write, NULL);
+
+  if (!tune.profile_file) {
+    autotune_finish(&tune);
+    compiler_error(0, 0, NULL, "can't create temporary files");
+  }
+
+  config = g_strnfill(tune.n_passes, '0');
+  tune.best = tune.reference = variant_get(&tune, config);
+  g_free(config);
+
+  /* what the compiler said is the diagnostic, as if it were compiling */
+  if (tune.reference->messages) {
+    g_strlcpy(message, g_strchomp(tune.reference->messages), sizeof(message));
+    autotune_finish(&tune);
+    compiler_error(0, 0, NULL, "%s", message);
+  }
+
+  if (!tune.reference->correct) {
+    autotune_finish(&tune);
+    compiler_error(0, 0, NULL, "program doesn't stop within %d instructions", AUTOTUNE_MAX_STEPS);
+  }
+
+  for (level = 1; level <= 3; level++)
+    levels = g_slist_append(levels, config_new(&tune, level, NULL));
+  levels = g_slist_append(levels, config_new(&tune, params.optimization_level,
+                                             params.pass_toggles));
+
+  for (l = levels; l; l = l->next)
+    autotune_try(&tune, (gchar *)l->data);
+  requested = (gchar *)g_slist_last(levels)->data;
+
+  for (round = 0; round < AUTOTUNE_MAX_ROUNDS; round++) {
+    improved = FALSE;
+
+    for (i = 0; i < tune.n_passes; i++) {
+      config = g_strdup(tune.best->config);
+      config[i] = config[i] == '1' ? '0' : '1';
+
+      improved |= autotune_try(&tune, config);
+      g_free(config);
+    }
+
+    if (!improved)
+      break;
+  }
+
+  /* the object is only written out for the one that's kept */
+  object = g_string_new(NULL);
+  variant_compile(&tune, tune.best, object);
+  compiler_write("%s", object->str);
+  g_string_free(object, TRUE);
+
+  autotune_report(&tune, requested, report);
+
+  for (l = levels; l; l = l->next)
+    g_free(l->data);
+  g_slist_free(levels);
+
+  autotune_finish(&tune);
+
+  return 0;
+}
@@ -0,0 +1,15 @@
+/*
+ * Simple Pascal Compiler
+ * Autotuner
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ */
+#ifndef __AUTOTUNE_H__
+#define __AUTOTUNE_H__
+
+#include <glib.h>
+
+int	autotune(const gchar *data_file, GString *report);
+
+#endif	/* __AUTOTUNE_H__ */
@@ -0,0 +1,457 @@
+/*
+ * Simple Pascal Compiler
+ * Call Graph
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ * Procedures that are part of a cycle in the call graph (found as its
+ * strongly connected components, with Tarjan's algorithm) may have more
+ * than one activation at a time; all the others may not.
+ *
+ * Each node also summarizes the side effects of a call: the variables
+ * declared outside of the procedure (globals or locals of the procedures
+ * it's nested in) that it, or anything it calls, may write (mod) or read
+ * (ref).
+ */
+#include <glib.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "callgraph.h"
+#include "compiler_context.h"
+
+static CallGraphNode *
+callgraph_node_new(CallGraph *cg, Symbol *symbol, GNode *node)
+{
+  CallGraphNode *cg_node;
+
+  cg_node = g_new0(CallGraphNode, 1);
+  cg_node->symbol = symbol;
+  cg_node->node = node;
+  cg_node->index = -1;
+
+  cg->nodes = g_slist_append(cg->nodes, cg_node);
+  g_hash_table_insert(cg->symbols, symbol, cg_node);
+
+  return cg_node;
+}
+
+/* whether ``symbol'' is declared in ``cg_node'' (a local or parameter) */
+static gboolean
+callgraph_is_local(CallGraphNode *cg_node, Symbol *symbol)
+{
+  GNode *decl;
+
+  decl = g_node_find(symbol_table->root, G_PRE_ORDER, G_TRAVERSE_ALL, symbol);
+
+  return decl && decl->parent && decl->parent->data == cg_node->symbol;
+}
+
+/* adds ``symbol'' to the mod or ref ``set'' of ``cg_node'', if non-local */
+static gboolean
+callgraph_access(CallGraphNode *cg_node, GSList **set, Symbol *symbol)
+{
+  if (!symbol || symbol->type != ST_VARIABLE || g_slist_find(*set, symbol) ||
+      callgraph_is_local(cg_node, symbol)) {
+    return FALSE;
+  }
+
+  *set = g_slist_append(*set, symbol);
+  return TRUE;
+}
+
+static gboolean
+callgraph_summarize(CallGraphNode *cg_node, GSList **set, GSList *symbols)
+{
+  gboolean changed = FALSE;
+
+  for (; symbols; symbols = symbols->next) {
+    changed |= callgraph_access(cg_node, set, (Symbol *)symbols->data);
+  }
+
+  return changed;
+}
+
+static void
+callgraph_build(CallGraph *cg, CallGraphNode *current, GNode *node)
+{
+  GNode *child;
+  ASTNode *ast_node;
+  CallGraphNode *callee;
+  Symbol *symbol;
+
+  for (child = node->children; child; child = child->next) {
+    ast_node = (ASTNode *)child->data;
+
+    switch (ast_node->token) {
+    case T_PROCEDURE:
+    case T_FUNCTION:
+      symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+      callee = callgraph_node_new(cg, symbol, child);
+
+      symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+      callgraph_build(cg, callee, child);
+      symbol_table_context_leave(symbol_table);
+      continue;
+    case T_PROCEDURE_CALL:
+    case T_FUNCTION_CALL:
+      /* T_TAIL_CALL is a jump, not a new activation */
+      symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+      callee = g_hash_table_lookup(cg->symbols, symbol);
+
+      if (callee && !g_slist_find(current->callees, callee)) {
+        current->callees = g_slist_append(current->callees, callee);
+      }
+      break;
+    case T_ATTRIB:
+    case T_READ:
+      symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+      callgraph_access(current, &current->mod, symbol);
+      break;
+    case T_IDENTIFIER:
+    case T_WRITE:
+      symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+      callgraph_access(current, &current->ref, symbol);
+      break;
+    default:
+      ;
+    }
+
+    callgraph_build(cg, current, child);
+  }
+}
+
+static void
+callgraph_strongconnect(CallGraph *cg, CallGraphNode *v, gint *index, GSList **stack)
+{
+  CallGraphNode *w;
+  GSList *l;
+
+  v->index = v->lowlink = (*index)++;
+  v->on_stack = TRUE;
+  *stack = g_slist_prepend(*stack, v);
+
+  for (l = v->callees; l; l = l->next) {
+    w = (CallGraphNode *)l->data;
+
+    if (w == v) {
+      v->recursive = TRUE;
+    }
+
+    if (w->index < 0) {
+      callgraph_strongconnect(cg, w, index, stack);
+      v->lowlink = MIN(v->lowlink, w->lowlink);
+    } else if (w->on_stack) {
+      v->lowlink = MIN(v->lowlink, w->index);
+    }
+  }
+
+  if (v->lowlink == v->index) {
+    GSList *members = NULL;
+
+    do {
+      w = (CallGraphNode *)(*stack)->data;
+      *stack = g_slist_delete_link(*stack, *stack);
+
+      w->on_stack = FALSE;
+      w->scc = cg->n_sccs;
+      members = g_slist_prepend(members, w);
+    } while (w != v);
+
+    if (members->next) {
+      for (l = members; l; l = l->next) {
+        ((CallGraphNode *)l->data)->recursive = TRUE;
+      }
+    }
+
+    g_slist_free(members);
+    cg->n_sccs++;
+  }
+}
+
+static void
+callgraph_mark_reachable(CallGraphNode *cg_node)
+{
+  GSList *l;
+
+  cg_node->reachable = TRUE;
+
+  for (l = cg_node->callees; l; l = l->next) {
+    CallGraphNode *callee = (CallGraphNode *)l->data;
+
+    if (!callee->reachable) {
+      callgraph_mark_reachable(callee);
+    }
+  }
+}
+
+/*
+ * A call writes (reads) what the callee writes (reads) itself, plus what
+ * the procedures it calls do, except for its own locals. Repeats until
+ * nothing changes, as the call graph may have cycles.
+ */
+static void
+callgraph_propagate_modref(CallGraph *cg)
+{
+  GSList *l, *c;
+  gboolean changed;
+
+  do {
+    changed = FALSE;
+
+    for (l = cg->nodes; l; l = l->next) {
+      CallGraphNode *cg_node = (CallGraphNode *)l->data;
+
+      for (c = cg_node->callees; c; c = c->next) {
+        CallGraphNode *callee = (CallGraphNode *)c->data;
+
+        changed |= callgraph_summarize(cg_node, &cg_node->mod, callee->mod);
+        changed |= callgraph_summarize(cg_node, &cg_node->ref, callee->ref);
+      }
+    }
+  } while (changed);
+}
+
+CallGraph *
+callgraph_new(GNode *ast)
+{
+  CallGraph *cg;
+  GSList *l, *stack = NULL;
+  gint index = 0;
+
+  cg = g_new0(CallGraph, 1);
+  cg->symbols = g_hash_table_new(g_direct_hash, g_direct_equal);
+  cg->static_size = -1;
+
+  symbol_table_context_reset(symbol_table);
+  cg->root = callgraph_node_new(cg, (Symbol *)symbol_table->root->data, ast);
+  callgraph_build(cg, cg->root, ast);
+
+  for (l = cg->nodes; l; l = l->next) {
+    CallGraphNode *cg_node = (CallGraphNode *)l->data;
+
+    /* unreachable nodes start their own search */
+    if (cg_node->index < 0) {
+      callgraph_strongconnect(cg, cg_node, &index, &stack);
+    }
+  }
+
+  callgraph_mark_reachable(cg->root);
+  callgraph_propagate_modref(cg);
+
+  return cg;
+}
+
+void
+callgraph_free(CallGraph *cg)
+{
+  GSList *l;
+
+  for (l = cg->nodes; l; l = l->next) {
+    CallGraphNode *cg_node = (CallGraphNode *)l->data;
+
+    g_slist_free(cg_node->callees);
+    g_slist_free(cg_node->mod);
+    g_slist_free(cg_node->ref);
+    g_free(cg_node);
+  }
+
+  g_slist_free(cg->nodes);
+  g_hash_table_destroy(cg->symbols);
+  g_free(cg);
+}
+
+CallGraphNode *
+callgraph_lookup(CallGraph *cg, Symbol *symbol)
+{
+  return (CallGraphNode *)g_hash_table_lookup(cg->symbols, symbol);
+}
+
+/*
+ * Whether calling ``callee'' may change ``variable''. Anything not in the
+ * call graph may.
+ */
+gboolean
+callgraph_may_write(CallGraph *cg, Symbol *callee, Symbol *variable)
+{
+  CallGraphNode *cg_node = callgraph_lookup(cg, callee);
+
+  return !cg_node || g_slist_find(cg_node->mod, variable) != NULL;
+}
+
+/* Whether calling ``callee'' may read ``variable''. */
+gboolean
+callgraph_may_read(CallGraph *cg, Symbol *callee, Symbol *variable)
+{
+  CallGraphNode *cg_node = callgraph_lookup(cg, callee);
+
+  return !cg_node || g_slist_find(cg_node->ref, variable) != NULL;
+}
+
+static gint
+callgraph_frame_size(CallGraphNode *cg_node)
+{
+  GNode *n, *type, *node = cg_node->node;
+  gint size;
+
+  /* functions keep their return value in the first cell, then parameters */
+  size = ((ASTNode *)node->data)->token == T_FUNCTION ? 1 : 0;
+  size += g_slist_length(cg_node->symbol->parameters);
+
+  for (n = node->children; n; n = n->next) {
+    if (((ASTNode *)n->data)->token != T_VAR) {
+      continue;
+    }
+
+    for (type = n->children; type; type = type->next) {
+      size += g_node_n_children(type);
+    }
+  }
+
+  return size;
+}
+
+/*
+ * Procedures and functions outside of any cycle can't be re-entered, so
+ * their locals don't need to be saved and restored on every call: they get
+ * static frames, in an area at the bottom of the memory. Returns the size
+ * of this area.
+ *
+ * Two frames may share cells unless one procedure can be active while the
+ * other one is, that is, unless one reaches the other in the call graph.
+ * Components are visited in topological order (Tarjan's algorithm numbers
+ * them in reverse) and every frame is placed right after the highest frame
+ * of all its callers, so frames only grow along a chain of calls and
+ * unrelated procedures overlay each other. Procedures that can't be reached
+ * from the main program aren't generated, so they get no frames.
+ */
+gint
+callgraph_layout_frames(CallGraph *cg)
+{
+  GSList *l, *c;
+  gint scc, *base, end;
+
+  base = g_new0(gint, cg->n_sccs);
+  cg->static_size = 0;
+
+  for (scc = cg->n_sccs - 1; scc >= 0; scc--) {
+    for (l = cg->nodes; l; l = l->next) {
+      CallGraphNode *cg_node = (CallGraphNode *)l->data;
+
+      if (cg_node->scc != scc || !cg_node->reachable) {
+        continue;
+      }
+
+      end = base[scc];
+
+      if (cg_node != cg->root && !cg_node->recursive) {
+        cg_node->frame_base = base[scc];
+        cg_node->frame_size = callgraph_frame_size(cg_node);
+
+        end += cg_node->frame_size;
+        cg->static_size = MAX(cg->static_size, end);
+      }
+
+      for (c = cg_node->callees; c; c = c->next) {
+        CallGraphNode *callee = (CallGraphNode *)c->data;
+
+        if (callee->scc != scc) {
+          base[callee->scc] = MAX(base[callee->scc], end);
+        }
+      }
+    }
+  }
+
+  g_free(base);
+
+  return cg->static_size;
+}
+
+/*
+ * Outputs a DOT file with the call graph. Recursive procedures are drawn
+ * with a double border and labeled with their strongly connected component;
+ * the others are the ones whose frames may be allocated statically, and
+ * are labeled with their addresses if callgraph_layout_frames() was called.
+ * Procedures unreachable from the main program are dashed.
+ */
+void
+callgraph_dump(CallGraph *cg)
+{
+  GSList *l, *c;
+  gint n = 0;
+
+  compiler_write("digraph callgraph {\n");
+
+  for (l = cg->nodes; l; l = l->next, n++) {
+    CallGraphNode *cg_node = (CallGraphNode *)l->data;
+
+    cg_node->index = n;
+
+    if (cg_node == cg->root) {
+      compiler_write("\tnode%d [label=\"%s\", shape=box];\n", n, cg_node->symbol->name);
+    } else if (!cg_node->reachable) {
+      compiler_write("\tnode%d [label=\"%s\\nnão alcançável\", style=dashed];\n", n,
+                     cg_node->symbol->name);
+    } else if (cg_node->recursive) {
+      compiler_write("\tnode%d [label=\"%s\\nrecursivo (CFC %d)\", peripheries=2];\n",
+                     n, cg_node->symbol->name, cg_node->scc);
+    } else if (cg->static_size >= 0 && cg_node->frame_size) {
+      compiler_write("\tnode%d [label=\"%s\\nquadro estático %d-%d\"];\n", n,
+                     cg_node->symbol->name, cg_node->frame_base,
+                     cg_node->frame_base + cg_node->frame_size - 1);
+    } else {
+      compiler_write("\tnode%d [label=\"%s\\nnão recursivo\"];\n", n, cg_node->symbol->name);
+    }
+  }
+
+  for (l = cg->nodes; l; l = l->next) {
+    CallGraphNode *cg_node = (CallGraphNode *)l->data;
+
+    for (c = cg_node->callees; c; c = c->next) {
+      compiler_write("\tnode%d -> node%d;\n", cg_node->index,
+                     ((CallGraphNode *)c->data)->index);
+    }
+  }
+
+  compiler_write("}\n");
+}
+
+static void
+callgraph_dump_set(const gchar *label, GSList *set)
+{
+  GSList *l;
+
+  compiler_write("  %s:", label);
+
+  if (!set) {
+    compiler_write(" nada");
+  }
+
+  for (l = set; l; l = l->next) {
+    compiler_write(l == set ? " %s" : ", %s", ((Symbol *)l->data)->name);
+  }
+
+  compiler_write("\n");
+}
+
+/*
+ * Lists, for each procedure and function, the variables declared outside
+ * of it that a call may modify or reference.
+ */
+void
+callgraph_dump_modref(CallGraph *cg)
+{
+  GSList *l;
+
+  for (l = cg->nodes; l; l = l->next) {
+    CallGraphNode *cg_node = (CallGraphNode *)l->data;
+
+    if (cg_node == cg->root) {
+      continue;
+    }
+
+    compiler_write("%s\n", cg_node->symbol->name);
+    callgraph_dump_set("modifica", cg_node->mod);
+    callgraph_dump_set("referencia", cg_node->ref);
+  }
+}
@@ -0,0 +1,57 @@
+/*
+ * Simple Pascal Compiler
+ * Call Graph
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ */
+#ifndef __CALLGRAPH_H__
+#define __CALLGRAPH_H__
+
+#include <glib.h>
+
+#include "symbol-table.h"
+
+typedef struct _CallGraph	CallGraph;
+typedef struct _CallGraphNode	CallGraphNode;
+
+struct _CallGraphNode {
+  Symbol	*symbol;
+  GNode		*node;		/* T_PROGRAM, T_PROCEDURE or T_FUNCTION */
+  GSList	*callees;	/* CallGraphNode * */
+
+  /* non-local variables (Symbol *) it or its callees may write or read */
+  GSList	*mod, *ref;
+
+  gint		 scc;		/* strongly connected component */
+  gboolean	 recursive;
+  gboolean	 reachable;	/* from the main program */
+
+  gint		 frame_base, frame_size;
+
+  /* used by Tarjan's algorithm */
+  gint		 index, lowlink;
+  gboolean	 on_stack;
+};
+
+struct _CallGraph {
+  CallGraphNode	*root;
+  GSList	*nodes;		/* in declaration order */
+  GHashTable	*symbols;	/* Symbol * -> CallGraphNode * */
+  gint		 n_sccs;
+  gint		 static_size;	/* -1 if frames weren't laid out */
+};
+
+CallGraph	*callgraph_new(GNode *ast);
+void		 callgraph_free(CallGraph *cg);
+
+CallGraphNode	*callgraph_lookup(CallGraph *cg, Symbol *symbol);
+gint		 callgraph_layout_frames(CallGraph *cg);
+
+gboolean	 callgraph_may_write(CallGraph *cg, Symbol *callee, Symbol *variable);
+gboolean	 callgraph_may_read(CallGraph *cg, Symbol *callee, Symbol *variable);
+
+void		 callgraph_dump(CallGraph *cg);
+void		 callgraph_dump_modref(CallGraph *cg);
+
+#endif /* __CALLGRAPH_H__ */
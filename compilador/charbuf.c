@@ -9,20 +9,13 @@
 #include <ctype.h>
 
 #include "charbuf.h"
-
-static FILE	*char_buf_input = NULL;
-static GSList	*char_buf = NULL;
-
-void
-char_buf_set_file(FILE *f)
-{
-	char_buf_input = f;
-}
+#include "compiler_context.h"
 
 void
 char_buf_put_char(char ch)
 {
-	char_buf = g_slist_prepend(char_buf, GINT_TO_POINTER((gint)ch));
+	compiler_context->char_buf = g_slist_prepend(compiler_context->char_buf,
+						     GINT_TO_POINTER((gint)ch));
 }
 
 void
@@ -34,7 +27,7 @@ char_buf_put_string(gchar *string)
 		temp = g_slist_append(temp, GINT_TO_POINTER((gint)*string++));
 	}
 
-	char_buf = g_slist_concat(temp, char_buf);	
+	compiler_context->char_buf = g_slist_concat(temp, compiler_context->char_buf);	
 }
 
 int
@@ -42,17 +35,17 @@ char_buf_get(void)
 {
 	int ch;
 
-	if (G_LIKELY(char_buf == NULL)) {
-		ch = tolower(fgetc(char_buf_input ? char_buf_input : stdin));
+	if (G_LIKELY(compiler_context->char_buf == NULL)) {
+		ch = tolower(fgetc(compiler_context->input ? compiler_context->input : stdin));
 	} else {
 		GSList *next;
 
-		ch = GPOINTER_TO_INT(char_buf->data);
+		ch = GPOINTER_TO_INT(compiler_context->char_buf->data);
 
-		next = char_buf->next;
-		g_slist_free_1(char_buf);
+		next = compiler_context->char_buf->next;
+		g_slist_free_1(compiler_context->char_buf);
 
-		char_buf = next;
+		compiler_context->char_buf = next;
 		
 	}
 	
@@ -17,27 +17,177 @@
 #include "codegen.h"
 #include "symbol-table.h"
 #include "stack.h"
+#include "callgraph.h"
+#include "passes.h"
+#include "profile.h"
+#include "vm.h"
+#include "compiler_context.h"
 
 /***/
 
-static guint __label_value = 0;
-static Stack *context = NULL, *n_vars = NULL, *ret_var = NULL;
-static gboolean has_procedure_or_function = FALSE;
+/*
+ * How the locals and parameters of a procedure or function are addressed:
+ *
+ * FRAME_STATIC	fixed addresses, for procedures that are never active more
+ *		than once (see callgraph_layout_frames()). The caller stores
+ *		the arguments straight into the parameters.
+ * FRAME_STACK	offsets from the frame pointer, set up by ENTER. The caller
+ *		pushes room for the result of a function, then the
+ *		arguments; locals are above the saved frame pointer.
+ * FRAME_SAVED	fixed addresses, saved on the stack by ALLOC on entry and
+ *		restored by DALLOC on exit. Needed when nested procedures
+ *		may access the variables, as they can't follow the frame
+ *		pointer of their parents, and used when there's nothing to
+ *		save at all. Arguments are pushed by the caller and copied to
+ *		the parameters on entry.
+ */
+typedef enum {
+    FRAME_STATIC,
+    FRAME_STACK,
+    FRAME_SAVED
+} FrameKind;
+
+static PER_THREAD Stack *context = NULL, *ret_var = NULL, *tail_label = NULL;
+static PER_THREAD gboolean short_circuit = FALSE;
+static PER_THREAD gboolean rotate_loops = FALSE;
+static PER_THREAD gboolean reorder_operands = FALSE;
+static PER_THREAD CallGraph *callgraph = NULL;
+static PER_THREAD GHashTable *frame_kinds = NULL;	/* Symbol * -> FrameKind */
+static PER_THREAD gboolean discard = FALSE;
+static PER_THREAD StackDepth *stack_depth = NULL;	/* of the procedure being generated */
+static PER_THREAD GPtrArray *output = NULL;	/* CodeLine *, generated out of place */
+static PER_THREAD GPtrArray *cold_code = NULL;	/* goes past HLT, see generate_if_cold() */
+static PER_THREAD VM *vm = NULL;			/* gets the code instead, see codegen_vm() */
+static PER_THREAD GSList *hot_procedures = NULL;	/* ProcedureCode *, see emit_procedures() */
 /***/
 
 static void generate(GNode * node);
+static gboolean has_tail_call(GNode * node);
 
 /***/
 
+typedef struct _CodeLine CodeLine;
+struct _CodeLine {
+    gchar *label, *instruction, *p1, *p2;
+};
+
+/*
+ * Where the code ends up: written as the object, or appended right to the
+ * program of a VM, without going through text.
+ */
+static void emit_line(char *label, char *instruction, char *p1, char *p2)
+{
+    if (vm)
+	vm_program_append(vm, label, instruction, p1, p2);
+    else
+	compiler_write("%-3s %-7s %-3s %-3s\n", label ? label : "", instruction,
+		       p1 ? p1 : "", p2 ? p2 : "");
+}
+
 static void emit(char *label, char *instruction, char *p1, char *p2)
 {
-    printf("%-3s %-7s %-3s %-3s\n",
-	   label ? label : "", instruction, p1 ? p1 : "", p2 ? p2 : "");
+    gint size = snprintf(NULL, 0, "%-3s %-7s %-3s %-3s\n",
+			 label ? label : "", instruction,
+			 p1 ? p1 : "", p2 ? p2 : "");
+
+    if (discard) {
+	/* code of an unreachable procedure: only measured */
+	codegen_stats.removed_size += size;
+	return;
+    }
+
+    codegen_stats.object_size += size;
+
+    if (output) {
+	CodeLine *line = g_new(CodeLine, 1);
+
+	line->label = g_strdup(label);
+	line->instruction = g_strdup(instruction);
+	line->p1 = g_strdup(p1);
+	line->p2 = g_strdup(p2);
+
+	g_ptr_array_add(output, line);
+	return;
+    }
+
+    emit_line(label, instruction, p1, p2);
+}
+
+/*
+ * Code can be generated out of place, to be put somewhere else later: what
+ * is emitted between code_begin() and code_end() is returned by the latter,
+ * and code_emit() puts it where code is being generated then.
+ */
+static GPtrArray *code_begin(void)
+{
+    GPtrArray *outer = output;
+
+    output = g_ptr_array_new();
+    return outer;
+}
+
+static GPtrArray *code_end(GPtrArray * outer)
+{
+    GPtrArray *code = output;
+
+    output = outer;
+    return code;
+}
+
+/* moves the lines of ``code'' to the end of ``to'' */
+static void code_append(GPtrArray * to, GPtrArray * code)
+{
+    guint i;
+
+    for (i = 0; i < code->len; i++)
+	g_ptr_array_add(to, g_ptr_array_index(code, i));
+
+    g_ptr_array_free(code, TRUE);
+}
+
+static void code_emit(GPtrArray * code)
+{
+    guint i;
+
+    if (output) {
+	code_append(output, code);
+	return;
+    }
+
+    for (i = 0; i < code->len; i++) {
+	CodeLine *line = (CodeLine *) g_ptr_array_index(code, i);
+
+	emit_line(line->label, line->instruction, line->p1, line->p2);
+
+	g_free(line->label);
+	g_free(line->instruction);
+	g_free(line->p1);
+	g_free(line->p2);
+	g_free(line);
+    }
+
+    g_ptr_array_free(code, TRUE);
 }
 
 static guint label_new(void)
 {
-    return ++__label_value;
+    return ++compiler_context->label_value;
+}
+
+static void emit_label(guint label)
+{
+    gchar arg1[16];
+
+    sprintf(arg1, "L%X", label);
+    emit(arg1, "NULL", NULL, NULL);
+}
+
+static void emit_jump(char *instruction, guint label)
+{
+    gchar arg1[16];
+
+    sprintf(arg1, "L%X", label);
+    emit(NULL, instruction, arg1, NULL);
 }
 
 static guint generate_children(GNode * nodes)
@@ -51,7 +201,6 @@ static guint generate_children(GNode * nodes)
     return 0;
 }
 
-static int available_address = 0;
 
 static int generate_var(GNode * types)
 {
@@ -60,7 +209,7 @@ static int generate_var(GNode * types)
     guint n_elements = 0;
     gchar arg1[8], arg2[8];
 
-    sprintf(arg1, "%d", available_address);
+    sprintf(arg1, "%d", compiler_context->available_address);
 
     for (type = types->children; type; type = type->next) {
 	ASTNode *ast_node = (ASTNode *) type->data;
@@ -71,8 +220,12 @@ static int generate_var(GNode * types)
 	    symbol_table_set_attribute_int(symbol_table,
 					   (gchar *) ast_node->data,
 					   STF_MEMORY_ADDRESS,
-					   available_address);
-	    available_address += size;
+					   compiler_context->available_address);
+	    symbol_table_set_attribute_int(symbol_table,
+					   (gchar *) ast_node->data,
+					   STF_FRAME_RELATIVE,
+					   FALSE);
+	    compiler_context->available_address += size;
 	}
 
 	n_elements += n_vars;
@@ -84,19 +237,460 @@ static int generate_var(GNode * types)
     return n_elements;
 }
 
+/*
+ * Assigns consecutive addresses to the variables of a procedure or function
+ * whose frame is static or on the stack (then ``address'' is an offset from
+ * the frame pointer). No code is needed to allocate them.
+ */
+static int generate_var_frame(GNode * types, int *address, gboolean frame_relative)
+{
+    GNode *type, *var;
+    guint n_elements = 0;
+
+    for (type = types->children; type; type = type->next) {
+	for (var = type->children; var; var = var->next, n_elements++) {
+	    ASTNode *ast_node = (ASTNode *) var->data;
+
+	    symbol_table_set_attribute_int(symbol_table,
+					   (gchar *) ast_node->data,
+					   STF_MEMORY_ADDRESS,
+					   (*address)++);
+	    symbol_table_set_attribute_int(symbol_table,
+					   (gchar *) ast_node->data,
+					   STF_FRAME_RELATIVE,
+					   frame_relative);
+	}
+    }
+
+    return n_elements;
+}
+
+static int count_vars(GNode * node)
+{
+    GNode *n, *type;
+    gint count = 0;
+
+    for (n = node->children; n; n = n->next) {
+	if (((ASTNode *) n->data)->token != T_VAR)
+	    continue;
+
+	for (type = n->children; type; type = type->next)
+	    count += g_node_n_children(type);
+    }
+
+    return count;
+}
+
+static void emit_load(Symbol * symbol)
+{
+    gchar arg1[8];
+
+    sprintf(arg1, "%d", symbol->memory_address);
+    emit(NULL, symbol->frame_relative ? "LDL" : "LDV", arg1, NULL);
+}
+
+static void emit_store(Symbol * symbol)
+{
+    gchar arg1[8];
+
+    sprintf(arg1, "%d", symbol->memory_address);
+    emit(NULL, symbol->frame_relative ? "STL" : "STR", arg1, NULL);
+}
+
+/* pops the arguments on the stack into the parameters, last one first */
+static void emit_store_arguments(GSList * param)
+{
+    if (param) {
+	emit_store_arguments(param->next);
+	emit_store((Symbol *) param->data);
+    }
+}
+
+static CallGraphNode *static_frame(gchar * name)
+{
+    CallGraphNode *cg_node;
+
+    if (!callgraph || !pass_enabled("static-frames"))
+	return NULL;
+
+    cg_node = callgraph_lookup(callgraph,
+			       symbol_table_lookup_symbol(symbol_table, name));
+
+    return (cg_node && !cg_node->recursive) ? cg_node : NULL;
+}
+
+static FrameKind frame_kind(GNode * node, Symbol * symbol)
+{
+    GNode *n;
+
+    if (static_frame((gchar *) ((ASTNode *) node->data)->data))
+	return FRAME_STATIC;
+
+    /* nothing to save: ENTER/LEAVE would only add to the cost of the call */
+    if (!symbol->parameters && !count_vars(node))
+	return FRAME_SAVED;
+
+    for (n = node->children; n; n = n->next) {
+	switch (((ASTNode *) n->data)->token) {
+	case T_PROCEDURE:
+	case T_FUNCTION:
+	    return FRAME_SAVED;
+	default:
+	    ;
+	}
+    }
+
+    return FRAME_STACK;
+}
+
+static FrameKind symbol_frame_kind(Symbol * symbol)
+{
+    return (FrameKind) GPOINTER_TO_INT(g_hash_table_lookup(frame_kinds, symbol));
+}
+
+/*
+ * Returns TRUE if evaluating the expression may have side effects, i.e.,
+ * it contains a function call.
+ */
+static gboolean has_side_effects(GNode * node)
+{
+    GNode *n;
+
+    if (((ASTNode *) node->data)->token == T_FUNCTION_CALL)
+	return TRUE;
+
+    for (n = node->children; n; n = n->next) {
+	if (has_side_effects(n))
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Returns TRUE if the expression may be left unevaluated without changing
+ * what the program does: it calls no function, and divides only by nonzero
+ * constants or by values known to be nonzero (DIVU). A zero divisor stops
+ * the program, so skipping such a division would let it go on. Also used
+ * by the other backends.
+ */
+gboolean codegen_can_skip(GNode * node)
+{
+    ASTNode *divisor;
+    GNode *n;
+
+    switch (((ASTNode *) node->data)->token) {
+    case T_FUNCTION_CALL:
+	return FALSE;
+    case T_DIVIDE:
+	divisor = (ASTNode *) node->children->next->data;
+	if (divisor->token != T_NUMBER || !atoi((gchar *) divisor->data))
+	    return FALSE;
+	break;
+    default:
+	break;
+    }
+
+    for (n = node->children; n; n = n->next) {
+	if (!codegen_can_skip(n))
+	    return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Operands of a binary operator may be evaluated right to left if neither
+ * has side effects. DUP must come right after its left operand.
+ */
+static gboolean can_reorder(GNode * node)
+{
+    return ((ASTNode *) node->children->next->data)->token != T_DUP &&
+	!has_side_effects(node);
+}
+
+/*
+ * Ershov number of an expression: how many cells of the operand stack its
+ * evaluation takes. With ``reorder'', binary operators evaluate the operand
+ * that takes more cells first, as generate_binop() does at -O1, so the other
+ * one is evaluated with a single cell below it instead of the other way
+ * around. Arguments of a call stay on the stack until it's made.
+ */
+static gint ershov_number(GNode * node, gboolean reorder)
+{
+    ASTNode *ast_node = (ASTNode *) node->data;
+    Symbol *symbol;
+    GNode *n;
+    gint left, right, depth = 0, i = 0;
+
+    switch (ast_node->token) {
+    case T_FUNCTION_CALL:
+    case T_PROCEDURE_CALL:
+	symbol = symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data);
+
+	/* room for the result (see generate_procedure_call()) */
+	if (symbol->type == ST_FUNCTION && symbol_frame_kind(symbol) == FRAME_STACK)
+	    i = 1;
+	/* fall through */
+    case T_TAIL_CALL:
+	for (n = node->children; n; n = n->next, i++)
+	    depth = MAX(depth, i + ershov_number(n, reorder));
+
+	return MAX(depth, 1);
+    case T_SELECT:
+	/* both values and the condition, in that order */
+	for (n = node->children->next; n; n = n->next, i++)
+	    depth = MAX(depth, i + ershov_number(n, reorder));
+
+	return MAX(depth, i + ershov_number(node->children, reorder));
+    default:
+	if (G_NODE_IS_LEAF(node))
+	    return 1;
+
+	if (!node->children->next)
+	    return ershov_number(node->children, reorder);
+
+	left = ershov_number(node->children, reorder);
+	right = ershov_number(node->children->next, reorder);
+
+	if (reorder && right > left && can_reorder(node))
+	    return right;
+
+	return MAX(left, right + 1);
+    }
+}
+
+/*
+ * Keeps the peak operand stack depth of the expressions of the procedure
+ * being generated, to be reported with -t.
+ */
+static void note_stack_depth(GNode * expr)
+{
+    if (!stack_depth)
+	return;
+
+    stack_depth->depth = MAX(stack_depth->depth, ershov_number(expr, reorder_operands));
+    stack_depth->left_to_right = MAX(stack_depth->left_to_right, ershov_number(expr, FALSE));
+}
+
+/*
+ * Generates code that jumps to ``label'' if the condition evaluates to
+ * ``jump_if'', falling through otherwise. When short-circuiting is enabled,
+ * "e", "ou" and "nao" are compiled into jump chains instead of being
+ * evaluated on the stack; the right operand of "e"/"ou" is only skipped
+ * if it has no side effects, unless --short-circuit was given. A function
+ * call or a division by what may be zero counts as one (see
+ * codegen_can_skip()): "(y <> 0) e (10 div y > 1)" still stops the
+ * program when y is 0, as it does without optimizations.
+ */
+static void generate_branch(GNode * node, guint label, gboolean jump_if)
+{
+    ASTNode *ast_node = (ASTNode *) node->data;
+    guint skip;
+
+    if (short_circuit) {
+	switch (ast_node->token) {
+	case T_NOT:
+	    generate_branch(node->children, label, !jump_if);
+	    return;
+	case T_TRUE:
+	case T_FALSE:
+	    if ((ast_node->token == T_TRUE) == jump_if)
+		emit_jump("JMP", label);
+	    return;
+	case T_NUMBER:
+	    /* folded relational expression */
+	    if ((atoi((gchar *) ast_node->data) != 0) == jump_if)
+		emit_jump("JMP", label);
+	    return;
+	case T_AND:
+	case T_OR:
+	    if (!params.short_circuit && !codegen_can_skip(node->children->next))
+		break;
+
+	    if (pass_enabled("short-circuit"))
+		pass_note("short-circuit", 1);
+
+	    /* taken either way, so labels are numbered the same for both senses */
+	    skip = label_new();
+
+	    if ((ast_node->token == T_AND) != jump_if) {
+		/* both operands leave through the same label */
+		generate_branch(node->children, label, jump_if);
+		generate_branch(node->children->next, label, jump_if);
+	    } else {
+		/* left operand decides the result only if it fails */
+		generate_branch(node->children, skip, !jump_if);
+		generate_branch(node->children->next, label, jump_if);
+		emit_label(skip);
+	    }
+	    return;
+	default:
+	    break;
+	}
+    }
+
+    note_stack_depth(node);
+    generate(node);
+    emit_jump(jump_if ? "JMPV" : "JMPF", label);
+}
+
+/*
+ * Profile-guided layout (--profile-use, see profile.c)
+ *
+ * Code is generated in the same order as in the object that was profiled,
+ * so labels get the same numbers, but the arms of "se" and the procedures
+ * that rarely run are moved past HLT: the code that does run falls through
+ * and stays near the start of the object, where the machine finds jump and
+ * call targets sooner.
+ */
+#define PGO_HOT_RATIO	2	/* an arm of "se ... senao" runs this more often */
+#define PGO_COLD_RATIO	16	/* the arm of a "se" alone runs this less often */
+
+typedef enum {
+    IF_IN_LINE,
+    IF_COLD_THEN,		/* the condition jumps to the "entao" arm */
+    IF_COLD_ELSE		/* ...or to the "senao" arm, moved instead */
+} IfLayout;
+
+typedef struct _ProcedureCode ProcedureCode;
+struct _ProcedureCode {
+    gchar label[16];		/* entry */
+    guint calls;
+    GPtrArray *code;
+};
+
+static gboolean profile_counts(guint label, guint * hits, guint * arrivals)
+{
+    ProfileLabel *pl;
+    gchar name[16];
+
+    if (!profile || discard || !pass_enabled("profile-layout"))
+	return FALSE;
+
+    sprintf(name, "L%X", label);
+    if (!(pl = profile_label(profile, name)))
+	return FALSE;
+
+    *hits = pl->hits;
+    *arrivals = pl->arrivals;
+
+    return TRUE;
+}
+
+/*
+ * How often each arm of a "se" ran comes from where the object profiled
+ * jumped: the condition jumps to ``l1'' when false, and the "entao" arm
+ * ends jumping to ``l2'' if there's a "senao", or falling through to
+ * ``l1'' otherwise. An arm with a tail call may not reach its end, so then
+ * it's not known how often it ran.
+ */
+static IfLayout if_layout(GNode * nodes, GNode * else_node, guint l1, guint l2)
+{
+    guint hits, arrivals, then_count, else_count;
+    gboolean has_else = else_node != NULL;
+    GNode *n;
+
+    for (n = nodes->children->next; n != else_node; n = n->next) {
+	if (((ASTNode *) n->data)->token == T_TAIL_CALL || has_tail_call(n))
+	    return IF_IN_LINE;
+    }
+
+    if (!profile_counts(l1, &hits, &arrivals))
+	return IF_IN_LINE;
+
+    if (has_else) {
+	else_count = hits;
+	if (!profile_counts(l2, &hits, &then_count))
+	    return IF_IN_LINE;
+
+	if (then_count && then_count >= PGO_HOT_RATIO * else_count)
+	    return IF_COLD_ELSE;
+	if (else_count && else_count >= PGO_HOT_RATIO * then_count)
+	    return IF_COLD_THEN;
+    } else {
+	else_count = arrivals;
+	then_count = hits - arrivals;
+
+	if (else_count && else_count >= PGO_COLD_RATIO * then_count)
+	    return IF_COLD_THEN;
+    }
+
+    return IF_IN_LINE;
+}
+
+/*
+ * Puts ``code'', labeled ``label'', past HLT, jumping back to ``back''.
+ */
+static void emit_cold(guint label, GPtrArray * code, guint back)
+{
+    GPtrArray *outer;
+
+    outer = code_begin();
+    emit_label(label);
+    code_emit(code);
+    emit_jump("JMP", back);
+    code_append(cold_code, code_end(outer));
+
+    pass_note("profile-layout", 1);
+}
+
+static void generate_if_cold(GNode * nodes, guint l1, guint l2, GNode * else_node,
+			     IfLayout layout)
+{
+    GPtrArray *outer, *then_code, *else_code = NULL;
+    GNode *n;
+
+    if (layout == IF_COLD_ELSE)
+	generate_branch(nodes->children, l1, FALSE);
+    else
+	generate_branch(nodes->children, else_node ? l1 : l2, TRUE);
+
+    outer = code_begin();
+    for (n = nodes->children->next; n != else_node; n = n->next)
+	generate(n);
+    then_code = code_end(outer);
+
+    if (else_node) {
+	outer = code_begin();
+	generate_children(else_node);
+	else_code = code_end(outer);
+    }
+
+    if (layout == IF_COLD_ELSE) {
+	code_emit(then_code);
+	emit_label(l2);
+	emit_cold(l1, else_code, l2);
+    } else if (else_node) {
+	code_emit(else_code);
+	emit_label(l2);
+	emit_cold(l1, then_code, l2);
+    } else {
+	emit_label(l1);
+	emit_cold(l2, then_code, l1);
+    }
+}
+
 static void generate_if(GNode * nodes)
 {
     GNode *n;
-    gchar arg1[8];
     guint l1, l2;
     gboolean has_else = FALSE;
+    IfLayout layout;
 
     l1 = label_new();
     l2 = label_new();
 
-    generate(nodes->children);
-    sprintf(arg1, "L%X", l1);
-    emit(NULL, "JMPF", arg1, NULL);
+    n = g_node_last_child(nodes);
+    if (((ASTNode *) n->data)->token != T_ELSE)
+	n = NULL;
+
+    if ((layout = if_layout(nodes, n, l1, l2)) != IF_IN_LINE) {
+	generate_if_cold(nodes, l1, l2, n, layout);
+	return;
+    }
+
+    generate_branch(nodes->children, l1, FALSE);
 
     for (n = nodes->children->next; n; n = n->next) {
 	ASTNode *ast_node = (ASTNode *) n->data;
@@ -104,56 +698,189 @@ static void generate_if(GNode * nodes)
 	if (ast_node->token != T_ELSE) {
 	    generate(n);
 	} else {
-	    sprintf(arg1, "L%X", l2);
-	    emit(NULL, "JMP", arg1, NULL);
-
-	    sprintf(arg1, "L%X", l1);
-	    emit(arg1, "NULL", NULL, NULL);
+	    emit_jump("JMP", l2);
+	    emit_label(l1);
 	    generate_children(n);
 
 	    has_else = TRUE;
 	}
     }
 
-    if (has_else) {
-	sprintf(arg1, "L%X", l2);
-	emit(arg1, "NULL", NULL, NULL);
+    emit_label(has_else ? l2 : l1);
+}
+
+/*
+ * Keys of a switch (see lower_switches() in optimization.c) are dense enough
+ * for a jump table if at least half of the values between the smallest and
+ * the largest are keys. Its base and size are operands of JMPT, so they must
+ * fit in three columns of the object file.
+ */
+#define SWITCH_MIN_BASE		-99
+#define SWITCH_MAX_BASE		999
+#define SWITCH_MAX_TABLE	999
+
+static gint case_key(GNode * node)
+{
+    return atoi((gchar *) ((ASTNode *) node->data)->data);
+}
+
+static gint case_compare(gconstpointer a, gconstpointer b)
+{
+    return case_key(*(GNode **) a) - case_key(*(GNode **) b);
+}
+
+/*
+ * Binary search on the keys of cases[lo..hi], jumping to the label of the
+ * matching case. If none matches, it either falls through or jumps to
+ * ``none''. The selector is loaded again for every comparison, as it is a
+ * variable.
+ */
+static void generate_switch_search(GNode * selector, GNode ** cases, guint * labels,
+				   gint lo, gint hi, guint none)
+{
+    gchar arg1[16];
+    guint right;
+    gint i, mid;
+
+    if (hi - lo < 3) {
+	for (i = lo; i <= hi; i++) {
+	    generate(selector);
+	    sprintf(arg1, "%d", case_key(cases[i]));
+	    emit(NULL, "LDC", arg1, NULL);
+	    emit(NULL, "CEQ", NULL, NULL);
+	    emit_jump("JMPV", labels[i]);
+	}
+
+	return;
+    }
+
+    mid = (lo + hi) / 2;
+    right = label_new();
+
+    generate(selector);
+    sprintf(arg1, "%d", case_key(cases[mid]));
+    emit(NULL, "LDC", arg1, NULL);
+    emit(NULL, "CMA", NULL, NULL);
+    emit_jump("JMPV", right);
+
+    generate_switch_search(selector, cases, labels, lo, mid, none);
+    emit_jump("JMP", none);
+
+    emit_label(right);
+    generate_switch_search(selector, cases, labels, mid + 1, hi, none);
+}
+
+static void generate_switch(GNode * node)
+{
+    GNode *selector = node->children, *otherwise = NULL, **cases, *n;
+    guint *labels, none, end;
+    gchar arg1[16], arg2[16];
+    gint n_cases = 0, i, base, size;
+
+    cases = g_new(GNode *, g_node_n_children(node));
+
+    for (n = selector->next; n; n = n->next) {
+	if (((ASTNode *) n->data)->token == T_CASE)
+	    cases[n_cases++] = n;
+	else
+	    otherwise = n;
+    }
+
+    qsort(cases, n_cases, sizeof(GNode *), case_compare);
+
+    labels = g_new(guint, n_cases);
+    for (i = 0; i < n_cases; i++)
+	labels[i] = label_new();
+    none = label_new();
+    end = label_new();
+
+    base = case_key(cases[0]);
+    size = case_key(cases[n_cases - 1]) - base + 1;
+
+    if (base >= SWITCH_MIN_BASE && base <= SWITCH_MAX_BASE &&
+	size <= SWITCH_MAX_TABLE && size <= 2 * n_cases) {
+	/* keys out of the table fall through it */
+	note_stack_depth(selector);
+	generate(selector);
+
+	sprintf(arg1, "%d", base);
+	sprintf(arg2, "%d", size);
+	emit(NULL, "JMPT", arg1, arg2);
+
+	for (i = 0; i < n_cases; base++) {
+	    if (base == case_key(cases[i]))
+		emit_jump("JMP", labels[i++]);
+	    else
+		emit_jump("JMP", none);
+	}
     } else {
-	sprintf(arg1, "L%X", l1);
-	emit(arg1, "NULL", NULL, NULL);
+	/* each comparison takes the selector and a key */
+	if (stack_depth) {
+	    stack_depth->depth = MAX(stack_depth->depth, 2);
+	    stack_depth->left_to_right = MAX(stack_depth->left_to_right, 2);
+	}
+
+	generate_switch_search(selector, cases, labels, 0, n_cases - 1, none);
+    }
+
+    emit_label(none);
+    if (otherwise)
+	generate_children(otherwise);
+
+    for (i = 0; i < n_cases; i++) {
+	emit_jump("JMP", end);
+	emit_label(labels[i]);
+	generate_children(cases[i]);
     }
+
+    emit_label(end);
+
+    g_free(cases);
+    g_free(labels);
 }
 
 static void generate_while(GNode * nodes)
 {
     GNode *n;
-    gchar arg1[8];
     guint l1, l2;
 
     l1 = label_new();
     l2 = label_new();
 
-    sprintf(arg1, "L%X", l1);
-    emit(arg1, "NULL", NULL, NULL);
-    generate(nodes->children);
+    if (rotate_loops) {
+	/*
+	 * Rotated form: the condition is tested once on entry and then at
+	 * the bottom of the body, so each iteration takes a single branch.
+	 */
+	pass_note("rotate-loops", 1);
+	generate_branch(nodes->children, l2, FALSE);
+	emit_label(l1);
+
+	for (n = nodes->children->next; n; n = n->next) {
+	    generate(n);
+	}
+
+	generate_branch(nodes->children, l1, TRUE);
+	emit_label(l2);
+
+	return;
+    }
 
-    sprintf(arg1, "L%X", l2);
-    emit(NULL, "JMPF", arg1, NULL);
+    emit_label(l1);
+    generate_branch(nodes->children, l2, FALSE);
 
     for (n = nodes->children->next; n; n = n->next) {
 	generate(n);
     }
 
-    sprintf(arg1, "L%X", l1);
-    emit(NULL, "JMP", arg1, NULL);
-
-    sprintf(arg1, "L%X", l2);
-    emit(arg1, "NULL", NULL, NULL);
+    emit_jump("JMP", l1);
+    emit_label(l2);
 }
 
 static void generate_binop(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
+    GNode *left = node->children, *right = left->next;
     char *op = "";
 
     if (g_str_equal(literals[ast_node->token], "=")) {
@@ -176,14 +903,38 @@ static void generate_binop(GNode * node)
 	op = "MULT";
     } else if (g_str_equal(literals[ast_node->token], "div")) {
 	op = "DIVI";
+    } else if (ast_node->token == T_DIVIDE_UNCHECKED) {
+	/* the divisor can't be zero (see optimization.c) */
+	op = "DIVU";
     } else if (g_str_equal(literals[ast_node->token], "ou")) {
 	op = "OR";
     } else if (g_str_equal(literals[ast_node->token], "e")) {
 	op = "AND";
     }
 
-    generate(node->children);
-    generate(node->children->next);
+    if (reorder_operands && can_reorder(node) &&
+	ershov_number(right, TRUE) > ershov_number(left, TRUE)) {
+	/* the operand that takes more stack goes first (see ershov_number()) */
+	pass_note("reorder-operands", 1);
+	generate(right);
+	generate(left);
+
+	if (g_str_equal(op, "SUB") || g_str_equal(op, "DIVI") ||
+	    g_str_equal(op, "DIVU")) {
+	    emit(NULL, "SWAP", NULL, NULL);
+	} else if (g_str_equal(op, "CMA")) {
+	    op = "CME";
+	} else if (g_str_equal(op, "CME")) {
+	    op = "CMA";
+	} else if (g_str_equal(op, "CMAQ")) {
+	    op = "CMEQ";
+	} else if (g_str_equal(op, "CMEQ")) {
+	    op = "CMAQ";
+	}
+    } else {
+	generate(left);
+	generate(right);
+    }
 
     emit(NULL, op, NULL, NULL);
 }
@@ -199,189 +950,334 @@ static void generate_attrib(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
     GNode *children = node->children;
-    gchar arg1[8];
-    guint memory;
 
+    note_stack_depth(children);
     generate(children);
 
-    memory =
-	symbol_table_get_attribute_int(symbol_table,
-				       (gchar *) ast_node->data,
-				       STF_MEMORY_ADDRESS);
-
-    sprintf(arg1, "%d", memory);
-    emit(NULL, "STR", arg1, NULL);
+    emit_store(symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data));
 }
 
 static void generate_attrib_from_temp(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
-    char arg1[8];
-    guint memory;
-
-    memory =
-	symbol_table_get_attribute_int(symbol_table,
-				       (gchar *) ast_node->data,
-				       STF_MEMORY_ADDRESS);
 
-    sprintf(arg1, "%d", memory);
-    emit(NULL, "STR", arg1, NULL);
+    emit_store(symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data));
 }
 
 static void generate_identifier(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
-    gchar arg1[8];
-    guint memory;
-
-    memory =
-	symbol_table_get_attribute_int(symbol_table,
-				       (gchar *) ast_node->data,
-				       STF_MEMORY_ADDRESS);
 
-    sprintf(arg1, "%d", memory);
-    emit(NULL, "LDV", arg1, NULL);
+    emit_load(symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data));
 }
 
 static void generate_read(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
-    gchar arg1[8];
-    guint memory;
 
     emit(NULL, "RD", NULL, NULL);
-    memory =
-	symbol_table_get_attribute_int(symbol_table,
-				       (gchar *) ast_node->data,
-				       STF_MEMORY_ADDRESS);
-
-    sprintf(arg1, "%d", memory);
-    emit(NULL, "STR", arg1, NULL);
+    emit_store(symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data));
 }
 
 static void generate_write(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
-    gchar arg1[8];
-    guint memory;
-
-    memory =
-	symbol_table_get_attribute_int(symbol_table,
-				       (gchar *) ast_node->data,
-				       STF_MEMORY_ADDRESS);
 
-    sprintf(arg1, "%d", memory);
-    emit(NULL, "LDV", arg1, NULL);
+    emit_load(symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data));
     emit(NULL, "PRN", NULL, NULL);
 }
 
 static void generate_function_return(GNode * node)
 {
+    ASTNode *ast_node = (ASTNode *) node->data;
+    Symbol *symbol;
     char arg1[8];
 
+    symbol = symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data);
     sprintf(arg1, "%d", GPOINTER_TO_INT(stack_peek(ret_var)));
 
+    note_stack_depth(node->children);
     generate(node->children);
     
     /* saves the return value */
-    emit(NULL, "STR", arg1, NULL);
+    emit(NULL, symbol_frame_kind(symbol) == FRAME_STACK ? "STL" : "STR", arg1, NULL);
+}
+
+/*
+ * Returns TRUE if the body of a procedure or function has tail calls to
+ * itself (see eliminate_tail_calls() in optimization.c).
+ */
+static gboolean has_tail_call(GNode * node)
+{
+    GNode *n;
+
+    for (n = node->children; n; n = n->next) {
+	switch (((ASTNode *) n->data)->token) {
+	case T_TAIL_CALL:
+	    return TRUE;
+	case T_PROCEDURE:
+	case T_FUNCTION:
+	    break;
+	default:
+	    if (has_tail_call(n))
+		return TRUE;
+	}
+    }
+
+    return FALSE;
+}
+
+static StackDepth *stack_depth_new(gchar * name)
+{
+    StackDepth *depth;
+
+    depth = g_new0(StackDepth, 1);
+    depth->name = name;
+    codegen_stats.stack_depths = g_slist_append(codegen_stats.stack_depths, depth);
+
+    return depth;
 }
 
 static guint generate_procedure_or_function(GNode * node, guint procedure)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
-    guint n_var = 0, r, l = 0, context_level;
-    char arg1[8], arg2[8];
+    guint n_var = 0, r, l = 0, t = 0, context_level;
+    char arg1[16], arg2[16];
+    Symbol *symbol;
+    FrameKind kind;
+    GSList *param;
+    gint n_params, ret = 0, address = 0, offset;
     GNode *n;
+    StackDepth *outer_depth = NULL;
+    GPtrArray *outer = NULL;
+    guint hits = 0, arrivals = 0;
+    gboolean cold = FALSE, moved = FALSE;
     
     context_level = symbol_table_get_context_level(symbol_table);
+    symbol = symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data);
+    n_params = g_slist_length(symbol->parameters);
+
+    if (!discard && pass_enabled("dead-procedures") &&
+	!callgraph_lookup(callgraph, symbol)->reachable) {
+	/*
+	 * Nothing calls it, so it's left out of the object; it's still
+	 * generated, with its nested procedures, to know how much was saved.
+	 */
+	gboolean had_procedure_or_function = compiler_context->has_procedure_or_function;
+
+	pass_note("dead-procedures", 1);
+	outer_depth = stack_depth;
+	stack_depth = NULL;
+
+	discard = TRUE;
+	generate_procedure_or_function(node, procedure);
+	discard = FALSE;
+
+	compiler_context->has_procedure_or_function = had_procedure_or_function;
+	stack_depth = outer_depth;
+	return 0;
+    }
+
+    if (discard) {
+	codegen_stats.removed = g_slist_append(codegen_stats.removed, symbol->name);
+    } else {
+	outer_depth = stack_depth;
+	stack_depth = stack_depth_new(symbol->name);
+    }
+
+    kind = frame_kind(node, symbol);
+    g_hash_table_insert(frame_kinds, symbol, GINT_TO_POINTER(kind));
+
     r = label_new();
 
-    if (!has_procedure_or_function) {
-        has_procedure_or_function = TRUE;
+    if (!compiler_context->has_procedure_or_function) {
+        compiler_context->has_procedure_or_function = TRUE;
         
         emit(NULL, "JMP", "PRG", NULL);
     }
+
+    /*
+     * With a profile, procedures never called go past HLT, and the others
+     * are placed after all of them are generated (see emit_procedures()).
+     */
+    if (profile_counts(r, &hits, &arrivals)) {
+	cold = hits == 0;
+	moved = cold || context_level <= 1;
+    }
+
+    if (moved)
+	outer = code_begin();
     
     if (context_level > 1) {
         l = label_new();
         sprintf(arg2, "L%X", l);
-        emit(NULL, "JMP", arg2, NULL);
+
+        if (!cold)
+            emit(NULL, "JMP", arg2, NULL);
     }
 
     sprintf(arg2, "L%X", r);
     emit(arg2, "NULL", NULL, NULL);
 
-    symbol_table_set_attribute_int(symbol_table, (gchar *) ast_node->data,
-				   STF_MEMORY_ADDRESS, r);
+    symbol->memory_address = r;
     symbol_table_context_enter(symbol_table, (gchar *) ast_node->data);
 
-    if (!procedure) {
-	stack_push(n_vars, GUINT_TO_POINTER(n_var));
+    switch (kind) {
+    case FRAME_STATIC:
+	/* functions keep their return value in the first cell */
+	address = static_frame((gchar *) ast_node->data)->frame_base;
+	if (!procedure)
+	    ret = address++;
+
+	for (param = symbol->parameters; param; param = param->next) {
+	    ((Symbol *) param->data)->memory_address = address++;
+	    ((Symbol *) param->data)->frame_relative = FALSE;
+	}
+	break;
+    case FRAME_STACK:
+	/* [result], arguments, return address, saved frame pointer, locals */
+	ret = -(2 + n_params);
+	offset = -(1 + n_params);
+
+	for (param = symbol->parameters; param; param = param->next) {
+	    ((Symbol *) param->data)->memory_address = offset++;
+	    ((Symbol *) param->data)->frame_relative = TRUE;
+	}
+
+	sprintf(arg1, "%d", count_vars(node));
+	emit(NULL, "ENTER", arg1, NULL);
+
+	address = 1;
+	break;
+    case FRAME_SAVED:
+	if (!procedure) {
+	    /* allocate memory for return value */
+	    ret = compiler_context->available_address++;
+
+	    sprintf(arg1, "%d", ret);
+	    emit(NULL, "ALLOC", arg1, "1");
+	}
+
+	if (n_params) {
+	    /* arguments, return address, [saved result], saved frame pointer */
+	    offset = -(1 + n_params + (procedure ? 0 : 1));
+	    emit(NULL, "ENTER", "0", NULL);
 
-	/* allocate memory for return address */
-	stack_push(ret_var, GUINT_TO_POINTER(available_address));
+	    sprintf(arg1, "%d", compiler_context->available_address);
+	    sprintf(arg2, "%d", n_params);
+	    emit(NULL, "ALLOC", arg1, arg2);
 
-	sprintf(arg1, "%d", available_address);
-	sprintf(arg2, "1");
-	
-	emit(NULL, "ALLOC", arg1, arg2);
+	    for (param = symbol->parameters; param; param = param->next) {
+		((Symbol *) param->data)->memory_address = compiler_context->available_address++;
+		((Symbol *) param->data)->frame_relative = FALSE;
 
-	available_address++;
+		sprintf(arg1, "%d", offset++);
+		emit(NULL, "LDL", arg1, NULL);
+		emit_store((Symbol *) param->data);
+	    }
+	}
     }
 
+    if (!procedure)
+	stack_push(ret_var, GINT_TO_POINTER(ret));
+
+    if (has_tail_call(node))
+	t = label_new();
+    stack_push(tail_label, GUINT_TO_POINTER(t));
+
     for (n = node->children; n; n = n->next) {
 	ast_node = (ASTNode *) n->data;
 
 	if (ast_node->token == T_VAR) {
-	    n_var = generate_var(n);
-
-	    if (!procedure && n_var) {
-		/* remove the "zero vars" */
-		stack_pop(n_vars);
-		/* add the number of variables */
-		stack_push(n_vars, GUINT_TO_POINTER(n_var));
-	    }
+	    if (kind == FRAME_SAVED)
+		n_var += generate_var(n);
+	    else
+		generate_var_frame(n, &address, kind == FRAME_STACK);
 	} else {
+	    if (t && ast_node->token != T_PROCEDURE && ast_node->token != T_FUNCTION) {
+		/* tail calls jump here, with the frame already allocated */
+		emit_label(t);
+		t = 0;
+	    }
+
 	    generate(n);
 	}
     }
 
-    if (procedure) {
-        if (n_var) {
-            sprintf(arg1, "%d", available_address - n_var);
-            sprintf(arg2, "%d", n_var);
+    stack_pop(tail_label);
 
-            emit(NULL, "DALLOC", arg1, arg2);
-            available_address -= n_var;
-        }
+    if (!procedure)
+	stack_pop(ret_var);
 
-	emit(NULL, "RETURN", NULL, NULL);
-    } else {
-        if ((n_var = GPOINTER_TO_INT(stack_peek(n_vars)))) {
-            gchar arg1[8], arg2[8];
+    switch (kind) {
+    case FRAME_STATIC:
+	if (procedure) {
+	    emit(NULL, "RETURN", NULL, NULL);
+	} else {
+	    sprintf(arg1, "%d", ret);
+	    emit(NULL, "RETURNV", arg1, NULL);
+	}
+	break;
+    case FRAME_STACK:
+	emit(NULL, "LEAVE", NULL, NULL);
 
-            sprintf(arg1, "%d", available_address - n_var);
+	/* RETURN drops the arguments; the result is left on the stack */
+	sprintf(arg1, "%d", n_params);
+	emit(NULL, "RETURN", n_params ? arg1 : NULL, NULL);
+	break;
+    case FRAME_SAVED:
+        if (n_var) {
+            sprintf(arg1, "%d", compiler_context->available_address - n_var);
             sprintf(arg2, "%d", n_var);
 
             emit(NULL, "DALLOC", arg1, arg2);
+            compiler_context->available_address -= n_var;
         }
 
-        emit(NULL, "RETURNF", arg1, NULL);
+	if (n_params) {
+	    sprintf(arg1, "%d", compiler_context->available_address - n_params);
+	    sprintf(arg2, "%d", n_params);
+
+	    emit(NULL, "DALLOC", arg1, arg2);
+	    emit(NULL, "LEAVE", NULL, NULL);
+	    compiler_context->available_address -= n_params;
+	}
 
-	available_address -= GPOINTER_TO_INT(stack_pop(n_vars));
-	available_address--;
+	sprintf(arg2, "%d", n_params);
 
-	stack_pop(ret_var);
+	if (procedure) {
+	    emit(NULL, "RETURN", n_params ? arg2 : NULL, NULL);
+	} else {
+	    sprintf(arg1, "%d", ret);
+	    emit(NULL, "RETURNF", arg1, n_params ? arg2 : NULL);
+
+	    compiler_context->available_address--;
+	}
     }
 
     symbol_table_context_leave(symbol_table);
 
-    if (context_level > 1) {
+    if (context_level > 1 && !cold) {
         sprintf(arg2, "L%X", l);
         emit(arg2, "NULL", NULL, NULL);
     }
 
+    if (cold) {
+	code_append(cold_code, code_end(outer));
+	pass_note("profile-layout", 1);
+    } else if (moved) {
+	ProcedureCode *pc = g_new0(ProcedureCode, 1);
+
+	sprintf(pc->label, "L%X", r);
+	pc->calls = hits;
+	pc->code = code_end(outer);
+
+	hot_procedures = g_slist_append(hot_procedures, pc);
+    }
+
+    if (!discard)
+	stack_depth = outer_depth;
+
     return 0;
 }
 
@@ -392,9 +1288,8 @@ static guint generate_procedure(GNode * node)
 
 static void generate_for(GNode * nodes)
 {
-    GNode *n, *step, *child, *loop_var;
+    GNode *n, *step, *child, *cond, *loop_var;
     guint l1, l2;
-    char arg1[8];
 
     loop_var = child = nodes->children;
 
@@ -403,14 +1298,18 @@ static void generate_for(GNode * nodes)
 
     /* start value */
     generate_attrib(child);
-    child = child->next;
+    cond = child = child->next;
 
     /* condition */
-    sprintf(arg1, "L%X", l1);
-    emit(arg1, "NULL", NULL, NULL);
-    generate(child);
-    sprintf(arg1, "L%X", l2);
-    emit(NULL, "JMPF", arg1, NULL);
+    if (rotate_loops) {
+	/* entry guard; the test is repeated after the step (see below) */
+	pass_note("rotate-loops", 1);
+	generate_branch(cond, l2, FALSE);
+	emit_label(l1);
+    } else {
+	emit_label(l1);
+	generate_branch(cond, l2, FALSE);
+    }
 
     /* step */
     step = child = child->next;
@@ -427,25 +1326,37 @@ static void generate_for(GNode * nodes)
     emit(NULL, "ADD", NULL, NULL);
     generate_attrib_from_temp(loop_var);
 
-    sprintf(arg1, "L%X", l1);
-    emit(NULL, "JMP", arg1, NULL);
-    sprintf(arg1, "L%X", l2);
-    emit(arg1, "NULL", NULL, NULL);
+    if (rotate_loops) {
+	generate_branch(cond, l1, TRUE);
+	emit_label(l2);
+	return;
+    }
+
+    emit_jump("JMP", l1);
+    emit_label(l2);
 }
 
 static void generate_procedure_call(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
-    char arg1[8];
-    guint label;
+    Symbol *symbol;
 
-    label =
-	symbol_table_get_attribute_int(symbol_table,
-				       (gchar *) ast_node->data,
-				       STF_MEMORY_ADDRESS);
+    symbol = symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data);
 
-    sprintf(arg1, "L%X", label);
-    emit(NULL, "CALL", arg1, NULL);
+    if (ast_node->token == T_PROCEDURE_CALL)
+	note_stack_depth(node);
+
+    if (symbol->type == ST_FUNCTION && symbol_frame_kind(symbol) == FRAME_STACK) {
+	/* room for the result */
+	emit(NULL, "LDC", "0", NULL);
+    }
+
+    generate_children(node);
+
+    if (symbol_frame_kind(symbol) == FRAME_STATIC)
+	emit_store_arguments(symbol->parameters);
+
+    emit_jump("CALL", symbol->memory_address);
 }
 
 static guint generate_function(GNode * node)
@@ -454,18 +1365,22 @@ static guint generate_function(GNode * node)
 }
 
 static void generate_function_call(GNode * node)
+{
+    generate_procedure_call(node);
+}
+
+static void generate_tail_call(GNode * node)
 {
     ASTNode *ast_node = (ASTNode *) node->data;
-    char arg1[8];
-    guint label;
+    Symbol *symbol;
 
-    label =
-	symbol_table_get_attribute_int(symbol_table,
-				       (gchar *) ast_node->data,
-				       STF_MEMORY_ADDRESS);
+    /* the new arguments are only stored after all of them are evaluated */
+    symbol = symbol_table_lookup_symbol(symbol_table, (gchar *) ast_node->data);
+    note_stack_depth(node);
+    generate_children(node);
+    emit_store_arguments(symbol->parameters);
 
-    sprintf(arg1, "L%X", label);
-    emit(NULL, "CALL", arg1, NULL);
+    emit_jump("JMP", GPOINTER_TO_UINT(stack_peek(tail_label)));
 }
 
 static void generate_true(GNode * node)
@@ -478,6 +1393,25 @@ static void generate_false(GNode * node)
     emit(NULL, "LDC", "0", NULL);
 }
 
+static void generate_dup(GNode * node)
+{
+    /* right operand equal to the left one, already on the stack */
+    emit(NULL, "DUP", NULL, NULL);
+}
+
+/*
+ * SEL leaves the first of the two values below the condition if it's true,
+ * or the second one otherwise.
+ */
+static void generate_select(GNode * node)
+{
+    generate(node->children->next);
+    generate(node->children->next->next);
+    generate(node->children);
+
+    emit(NULL, "SEL", NULL, NULL);
+}
+
 static void generate_not(GNode * node)
 {
     generate(node->children);
@@ -495,9 +1429,113 @@ static void generate_uplus(GNode * node)
     generate(node->children);
 }
 
+static gint procedure_code_compare(gconstpointer a, gconstpointer b)
+{
+    const GSList *chain_a = (const GSList *) a, *chain_b = (const GSList *) b;
+    guint calls_a = 0, calls_b = 0;
+
+    for (; chain_a; chain_a = chain_a->next)
+	calls_a += ((ProcedureCode *) chain_a->data)->calls;
+    for (; chain_b; chain_b = chain_b->next)
+	calls_b += ((ProcedureCode *) chain_b->data)->calls;
+
+    return calls_a < calls_b ? 1 : calls_a > calls_b ? -1 : 0;
+}
+
+/*
+ * Emits the procedures declared in the program that the profile says are
+ * called, ordered by call affinity (Pettis and Hansen): the pairs that call
+ * each other most often are joined first into chains, and the chains are
+ * placed from the most called, so the hot procedures come first in the
+ * object.
+ */
+static void emit_procedures(void)
+{
+    ProcedureCode **procs;
+    GSList **chains, *order = NULL, *l;
+    gint n, i, j, best_i, best_j, *chain_of;
+    guint best, weight;
+
+    n = g_slist_length(hot_procedures);
+    procs = g_new(ProcedureCode *, n);
+    chains = g_new0(GSList *, n);
+    chain_of = g_new(gint, n);
+
+    for (i = 0, l = hot_procedures; l; l = l->next, i++) {
+	procs[i] = (ProcedureCode *) l->data;
+	chains[i] = g_slist_append(NULL, procs[i]);
+	chain_of[i] = i;
+    }
+
+    for (;;) {
+	/* the heaviest pair not in the same chain yet */
+	best = 0;
+	best_i = best_j = -1;
+
+	for (i = 0; i < n; i++) {
+	    for (j = i + 1; j < n; j++) {
+		if (chain_of[i] == chain_of[j])
+		    continue;
+
+		weight = profile_calls(profile, procs[i]->label, procs[j]->label) +
+		    profile_calls(profile, procs[j]->label, procs[i]->label);
+		if (weight > best) {
+		    best = weight;
+		    best_i = chain_of[i];
+		    best_j = chain_of[j];
+		}
+	    }
+	}
+
+	if (!best)
+	    break;
+
+	for (i = 0; i < n; i++) {
+	    if (chain_of[i] == best_j)
+		chain_of[i] = best_i;
+	}
+
+	chains[best_i] = g_slist_concat(chains[best_i], chains[best_j]);
+	chains[best_j] = NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+	if (chains[i])
+	    order = g_slist_append(order, chains[i]);
+    }
+    order = g_slist_sort(order, procedure_code_compare);
+
+    for (i = 0, l = order; l; l = l->next) {
+	GSList *c;
+
+	for (c = (GSList *) l->data; c; c = c->next, i++) {
+	    ProcedureCode *pc = (ProcedureCode *) c->data;
+
+	    if (pc != procs[i])
+		pass_note("profile-layout", 1);
+
+	    code_emit(pc->code);
+	    g_free(pc);
+	}
+
+	g_slist_free((GSList *) l->data);
+    }
+
+    g_slist_free(order);
+    g_free(chain_of);
+    g_free(chains);
+    g_free(procs);
+
+    g_slist_free(hot_procedures);
+    hot_procedures = NULL;
+}
+
 static void generate_main_begin(GNode *node)
 {
-    if (has_procedure_or_function) {
+    if (hot_procedures)
+	emit_procedures();
+
+    if (compiler_context->has_procedure_or_function) {
         emit("PRG", "NULL", NULL, NULL);
     }
 }
@@ -510,6 +1548,7 @@ static void generate(GNode * node)
     case T_MINUS:
     case T_PLUS:
     case T_DIVIDE:
+    case T_DIVIDE_UNCHECKED:
     case T_MULTIPLY:
     case T_OP_EQUAL:
     case T_OP_GT:
@@ -584,6 +1623,18 @@ static void generate(GNode * node)
     case T_MAIN_BEGIN:
         generate_main_begin(node);
         break;
+    case T_TAIL_CALL:
+	generate_tail_call(node);
+	break;
+    case T_DUP:
+	generate_dup(node);
+	break;
+    case T_SWITCH:
+	generate_switch(node);
+	break;
+    case T_SELECT:
+	generate_select(node);
+	break;
     default:
 	g_error("Houston, we have a problem! Don't know how to "
 		"generate code for node type ``%s'' (%d).",
@@ -593,29 +1644,99 @@ static void generate(GNode * node)
 
 void codegen(GNode * root)
 {
-    __label_value = 0;
+    GSList *l;
+
+    compiler_context->label_value = 0;
+    short_circuit = pass_enabled("short-circuit") || params.short_circuit;
+    rotate_loops = pass_enabled("rotate-loops");
+    reorder_operands = pass_enabled("reorder-operands");
 
     context = stack_new();
-    n_vars = stack_new();
     ret_var = stack_new();
+    tail_label = stack_new();
+    frame_kinds = g_hash_table_new(g_direct_hash, g_direct_equal);
 
     symbol_table_context_reset(symbol_table);
 
+    compiler_context->available_address = 0;
+    callgraph = NULL;
+    cold_code = g_ptr_array_new();
+
+    g_slist_free(codegen_stats.removed);
+    codegen_stats.removed = NULL;
+    codegen_stats.object_size = codegen_stats.removed_size = 0;
+
+    for (l = codegen_stats.stack_depths; l; l = l->next)
+	g_free(l->data);
+    g_slist_free(codegen_stats.stack_depths);
+    codegen_stats.stack_depths = NULL;
+    stack_depth = stack_depth_new((gchar *) ((ASTNode *) root->data)->data);
+
+    if (pass_enabled("dead-procedures") || pass_enabled("static-frames")) {
+	callgraph = callgraph_new(root);
+	symbol_table_context_reset(symbol_table);
+    }
+
+    if (pass_enabled("static-frames")) {
+	/* static frames go below the globals, see callgraph_layout_frames() */
+	compiler_context->available_address = callgraph_layout_frames(callgraph);
+
+	for (l = callgraph->nodes; l; l = l->next) {
+	    CallGraphNode *cg_node = (CallGraphNode *) l->data;
+
+	    if (cg_node->frame_size)
+		pass_note("static-frames", 1);
+	}
+    }
+
     emit(NULL, "START", NULL, NULL);
+
+    if (compiler_context->available_address) {
+	char imed[16];
+
+	snprintf(imed, 16, "%d", compiler_context->available_address);
+	emit(NULL, "ALLOC", "0", imed);
+    }
+
     generate(root);
 
-    if (available_address) {
+    if (compiler_context->available_address) {
 	char imed[16];
 
-	snprintf(imed, 16, "%d", available_address);
+	snprintf(imed, 16, "%d", compiler_context->available_address);
 	emit(NULL, "DALLOC", "0", imed);
     }
 
     emit(NULL, "HLT", NULL, NULL);
+    stack_depth = NULL;
+
+    code_emit(cold_code);
+    cold_code = NULL;
 
     stack_free(context);
-    stack_free(n_vars);
     stack_free(ret_var);
+    stack_free(tail_label);
+    g_hash_table_destroy(frame_kinds);
+
+    if (callgraph) {
+	callgraph_free(callgraph);
+	callgraph = NULL;
+    }
+}
+
+/*
+ * Generates the code straight into the program of ``target'', linked and
+ * ready to run, instead of writing the object.
+ */
+void codegen_vm(GNode * root, VM * target)
+{
+    vm_object_unload(target);
+
+    vm = target;
+    codegen(root);
+    vm = NULL;
+
+    vm_program_link(target);
 }
 
 int codegen_test_main(int argc, char **argv)
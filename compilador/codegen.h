@@ -10,8 +10,32 @@
 #include <glib.h>
 
 #include "lex.h"
+#include "vm.h"
+#include "compiler_context.h"
+
+typedef struct _CodegenStats	CodegenStats;
+typedef struct _StackDepth	StackDepth;
+
+struct _StackDepth {
+    gchar	*name;			/* procedure, function or program */
+    gint	 depth;			/* peak operand stack depth of its expressions */
+    gint	 left_to_right;		/* the same, evaluating operands in order */
+};
+
+struct _CodegenStats {
+    GSList	*removed;		/* names of unreachable procedures */
+    GSList	*stack_depths;		/* StackDepth *, in the order generated */
+    gint	 object_size;		/* bytes */
+    gint	 removed_size;		/* bytes the removed procedures would take */
+};
 
 void	 codegen(GNode *node);
+void	 codegen_vm(GNode *node, VM *vm);
+void	 codegen_c(GNode *node);
+void	 codegen_x86_64(GNode *node);
+void	 codegen_llvm(GNode *node);
 int	 codegen_test_main(int argc, char **argv);
 
+gboolean codegen_can_skip(GNode *node);
+
 #endif	 /* __CODEGEN_H__ */
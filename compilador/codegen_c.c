@@ -0,0 +1,814 @@
+/*
+ * Simple Pascal Compiler
+ * C Code Generator
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ * Translates the AST into a C program (--target=c), to be built with a C
+ * compiler instead of being run by the virtual machine.
+ *
+ * Each variable, parameter and function result has a fixed address in the
+ * object, so here each becomes a static variable, and nested procedures
+ * reach the ones of their parents directly. Procedures and functions that
+ * may be active more than once (see callgraph.c) save theirs on a stack of
+ * frames on entry and restore them on exit, as ALLOC and DALLOC do. Operands
+ * are evaluated left to right and arithmetic wraps around, as on the
+ * machine; a variable read before being written is the only thing that may
+ * not have the value it would have there.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include <glib.h>
+
+#include "lex.h"
+#include "ast.h"
+#include "codegen.h"
+#include "symbol-table.h"
+#include "callgraph.h"
+#include "passes.h"
+
+typedef struct _CFunction CFunction;
+
+struct _CFunction {
+    Symbol *symbol;		/* NULL for the main program */
+    GString *body;
+    GSList *frame;		/* Symbol *, saved on entry if recursive */
+    gboolean recursive;
+    gboolean tail;		/* has tail calls to itself */
+    gint indent;
+    gint temps;
+};
+
+static PER_THREAD CallGraph *callgraph = NULL;
+static PER_THREAD GHashTable *names = NULL;	/* Symbol * -> C identifier */
+static PER_THREAD GHashTable *results = NULL;	/* function Symbol * -> C identifier */
+static PER_THREAD GHashTable *used_names = NULL;
+static PER_THREAD GString *declarations = NULL, *definitions = NULL;
+static PER_THREAD CFunction *function = NULL;	/* being generated */
+static PER_THREAD gboolean has_frames = FALSE;
+
+static const gchar runtime[] =
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "\n"
+    "#define ADD(a, b)\t((int)((unsigned)(a) + (unsigned)(b)))\n"
+    "#define SUB(a, b)\t((int)((unsigned)(a) - (unsigned)(b)))\n"
+    "#define MULT(a, b)\t((int)((unsigned)(a) * (unsigned)(b)))\n"
+    "#define INV(a)\t\t((int)(0u - (unsigned)(a)))\n"
+    "\n"
+    "static inline int csd_div(int a, int b)\n"
+    "{\n"
+    "    if (!b) {\n"
+    "        printf(\"Divisão por zero\\n\");\n"
+    "        exit(1);\n"
+    "    }\n"
+    "\n"
+    "    return a / b;\n"
+    "}\n"
+    "\n"
+    "static inline int csd_read(void)\n"
+    "{\n"
+    "    char buffer[128];\n"
+    "\n"
+    "    return fgets(buffer, sizeof(buffer), stdin) ? atoi(buffer) : 0;\n"
+    "}\n"
+    "\n"
+    "static inline void csd_write(int value)\n"
+    "{\n"
+    "    printf(\"%d\\n\", value);\n"
+    "}\n";
+
+/* only for programs with procedures or functions that may be recursive */
+static const gchar runtime_frames[] =
+    "\n"
+    "#define FRAMES\t\t1048576\n"
+    "#define SAVE(v)\t\t(frame < frames + FRAMES ? (void)(*frame++ = (v)) : csd_overflow())\n"
+    "#define RESTORE(v)\t((v) = *--frame)\n"
+    "\n"
+    "static int frames[FRAMES], *frame = frames;\n"
+    "\n"
+    "static void csd_overflow(void)\n"
+    "{\n"
+    "    printf(\"Estouro da pilha\\n\");\n"
+    "    exit(1);\n"
+    "}\n";
+
+static void c_statements(GNode * nodes);
+static gchar *c_expression(GNode * node);
+
+/***/
+
+static TokenType token(GNode * node)
+{
+    return ((ASTNode *) node->data)->token;
+}
+
+static gchar *name(GNode * node)
+{
+    return (gchar *) ((ASTNode *) node->data)->data;
+}
+
+static void c_line(const gchar * format, ...)
+{
+    va_list args;
+    gint i;
+
+    for (i = 0; i < function->indent; i++)
+	g_string_append(function->body, "    ");
+
+    va_start(args, format);
+    g_string_append_vprintf(function->body, format, args);
+    va_end(args);
+
+    g_string_append_c(function->body, '\n');
+}
+
+/*
+ * Names are prefixed by what they are, so they never clash with C keywords
+ * or with the runtime, and numbered when a name is declared more than once.
+ */
+static gchar *c_name_new(GHashTable * table, Symbol * symbol, const gchar * prefix)
+{
+    gchar *c_name;
+    gint n = 1;
+
+    c_name = g_strdup_printf("%s%s", prefix, symbol->name);
+    while (g_hash_table_lookup(used_names, c_name)) {
+	g_free(c_name);
+	c_name = g_strdup_printf("%s%s_%d", prefix, symbol->name, ++n);
+    }
+
+    g_hash_table_insert(used_names, c_name, c_name);
+    g_hash_table_insert(table, symbol, c_name);
+
+    return c_name;
+}
+
+static void c_declare(Symbol * symbol)
+{
+    g_string_append_printf(declarations, "static int %s;\n",
+			    c_name_new(names, symbol, "v_"));
+
+    if (function->recursive)
+	function->frame = g_slist_append(function->frame, symbol);
+}
+
+static gchar *c_variable(gchar * lpd_name)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, lpd_name);
+
+    if (!g_hash_table_lookup(names, symbol))
+	c_declare(symbol);
+
+    return (gchar *) g_hash_table_lookup(names, symbol);
+}
+
+static gchar *c_temp_new(void)
+{
+    return g_strdup_printf("t%d", ++function->temps);
+}
+
+/*
+ * Returns TRUE if evaluating the expression may have side effects, i.e.,
+ * it contains a function call; then its operands must be evaluated into
+ * temporaries, as C doesn't say in which order it evaluates them.
+ */
+static gboolean c_has_call(GNode * node)
+{
+    GNode *n;
+
+    if (token(node) == T_FUNCTION_CALL)
+	return TRUE;
+
+    for (n = node->children; n; n = n->next) {
+	if (c_has_call(n))
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gchar *c_number(GNode * node)
+{
+    gint value = atoi(name(node));
+
+    if (value == G_MININT)
+	return g_strdup("(-2147483647 - 1)");
+
+    return g_strdup_printf(value < 0 ? "(%d)" : "%d", value);
+}
+
+static gchar *c_operation(TokenType op, const gchar * a, const gchar * b)
+{
+    switch (op) {
+    case T_PLUS:
+	return g_strdup_printf("ADD(%s, %s)", a, b);
+    case T_MINUS:
+	return g_strdup_printf("SUB(%s, %s)", a, b);
+    case T_MULTIPLY:
+	return g_strdup_printf("MULT(%s, %s)", a, b);
+    case T_DIVIDE:
+	return g_strdup_printf("csd_div(%s, %s)", a, b);
+    case T_DIVIDE_UNCHECKED:
+	return g_strdup_printf("(%s / %s)", a, b);
+    case T_OP_EQUAL:
+	return g_strdup_printf("(%s == %s)", a, b);
+    case T_OP_DIFFERENT:
+	return g_strdup_printf("(%s != %s)", a, b);
+    case T_OP_GT:
+	return g_strdup_printf("(%s > %s)", a, b);
+    case T_OP_GEQ:
+	return g_strdup_printf("(%s >= %s)", a, b);
+    case T_OP_LT:
+	return g_strdup_printf("(%s < %s)", a, b);
+    case T_OP_LEQ:
+	return g_strdup_printf("(%s <= %s)", a, b);
+    case T_AND:
+	/* both operands are evaluated, as AND does */
+	return g_strdup_printf("(%s & %s)", a, b);
+    case T_OR:
+	return g_strdup_printf("(%s | %s)", a, b);
+    default:
+	g_error("Don't know how to generate C for operator ``%s'' (%d).",
+		literals[op], op);
+    }
+
+    return NULL;
+}
+
+/*
+ * The operand that comes first is evaluated into a temporary when the
+ * order matters; the right operand may also be the left one again (see
+ * T_DUP in optimization.c).
+ */
+static gchar *c_binop(GNode * node)
+{
+    GNode *left = node->children, *right = left->next;
+    gchar *a, *b, *temp, *op, *code;
+
+    a = c_expression(left);
+
+    if (token(right) == T_DUP || c_has_call(left) || c_has_call(right)) {
+	temp = c_temp_new();
+	b = token(right) == T_DUP ? g_strdup(temp) : c_expression(right);
+	op = c_operation(token(node), temp, b);
+	code = g_strdup_printf("(%s = %s, %s)", temp, a, op);
+
+	g_free(temp);
+	g_free(op);
+    } else {
+	b = c_expression(right);
+	code = c_operation(token(node), a, b);
+    }
+
+    g_free(a);
+    g_free(b);
+
+    return code;
+}
+
+static gchar *c_call(GNode * node)
+{
+    Symbol *symbol;
+    GString *code, *args;
+    GNode *n;
+    gchar *arg, *temp;
+    gboolean sequence = FALSE;
+
+    symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+
+    if (node->children && node->children->next) {
+	for (n = node->children; n; n = n->next)
+	    sequence |= c_has_call(n);
+    }
+
+    code = g_string_new(sequence ? "(" : NULL);
+    args = g_string_new(NULL);
+
+    for (n = node->children; n; n = n->next) {
+	arg = c_expression(n);
+
+	if (sequence) {
+	    temp = c_temp_new();
+	    g_string_append_printf(code, "%s = %s, ", temp, arg);
+	    g_free(arg);
+	    arg = temp;
+	}
+
+	g_string_append_printf(args, n == node->children ? "%s" : ", %s", arg);
+	g_free(arg);
+    }
+
+    g_string_append_printf(code, "%s(%s)%s",
+			   (gchar *) g_hash_table_lookup(names, symbol),
+			   args->str, sequence ? ")" : "");
+    g_string_free(args, TRUE);
+
+    return g_string_free(code, FALSE);
+}
+
+/* SEL evaluates both values, then the condition */
+static gchar *c_select(GNode * node)
+{
+    GNode *cond = node->children, *a = cond->next, *b = a->next;
+    gchar *c_cond, *c_a, *c_b, *t_a, *t_b, *code;
+
+    c_a = c_expression(a);
+    c_b = c_expression(b);
+    c_cond = c_expression(cond);
+
+    if (c_has_call(node)) {
+	t_a = c_temp_new();
+	t_b = c_temp_new();
+	code = g_strdup_printf("(%s = %s, %s = %s, %s ? %s : %s)",
+			       t_a, c_a, t_b, c_b, c_cond, t_a, t_b);
+	g_free(t_a);
+	g_free(t_b);
+    } else {
+	code = g_strdup_printf("(%s ? %s : %s)", c_cond, c_a, c_b);
+    }
+
+    g_free(c_cond);
+    g_free(c_a);
+    g_free(c_b);
+
+    return code;
+}
+
+static gchar *c_unary(const gchar * format, GNode * node)
+{
+    gchar *operand = c_expression(node->children), *code;
+
+    code = g_strdup_printf(format, operand);
+    g_free(operand);
+
+    return code;
+}
+
+static gchar *c_expression(GNode * node)
+{
+    switch (token(node)) {
+    case T_NUMBER:
+	return c_number(node);
+    case T_TRUE:
+	return g_strdup("1");
+    case T_FALSE:
+	return g_strdup("0");
+    case T_IDENTIFIER:
+	return g_strdup(c_variable(name(node)));
+    case T_FUNCTION_CALL:
+	return c_call(node);
+    case T_NOT:
+	return c_unary("(!%s)", node);
+    case T_UNARY_MINUS:
+	return c_unary("INV(%s)", node);
+    case T_UNARY_PLUS:
+	return c_expression(node->children);
+    case T_SELECT:
+	return c_select(node);
+    default:
+	return c_binop(node);
+    }
+}
+
+/* ``code'' within parentheses, unless it already is */
+static gchar *c_parenthesized(gchar * code)
+{
+    gchar *c, *parenthesized;
+    gint depth = 0;
+
+    if (*code == '(') {
+	/* enclosed if the first parenthesis is only closed at the end */
+	for (c = code; *c; c++) {
+	    if (*c == '(')
+		depth++;
+	    else if (*c == ')' && !--depth)
+		break;
+	}
+
+	if (*c && !c[1])
+	    return code;
+    }
+
+    parenthesized = g_strdup_printf("(%s)", code);
+    g_free(code);
+
+    return parenthesized;
+}
+
+/*
+ * With --short-circuit, the right operand of "e" and "ou" in a condition
+ * isn't evaluated when the left one decides (see generate_branch()).
+ */
+static gchar *c_condition_operand(GNode * node);
+
+static gchar *c_condition(GNode * node)
+{
+    return c_parenthesized(c_condition_operand(node));
+}
+
+static gchar *c_condition_operand(GNode * node)
+{
+    gchar *a, *b, *code;
+
+    if (!params.short_circuit)
+	return c_expression(node);
+
+    switch (token(node)) {
+    case T_NOT:
+	a = c_condition_operand(node->children);
+	code = g_strdup_printf("(!%s)", a);
+	g_free(a);
+	return code;
+    case T_AND:
+    case T_OR:
+	a = c_condition_operand(node->children);
+	b = c_condition_operand(node->children->next);
+	code = g_strdup_printf(token(node) == T_AND ? "(%s && %s)" : "(%s || %s)", a, b);
+	g_free(a);
+	g_free(b);
+	return code;
+    default:
+	return c_expression(node);
+    }
+}
+
+/***/
+
+static void c_variables(GNode * types)
+{
+    GNode *type, *var;
+
+    for (type = types->children; type; type = type->next) {
+	for (var = type->children; var; var = var->next)
+	    c_declare(symbol_table_lookup_symbol(symbol_table, name(var)));
+    }
+}
+
+static void c_assign(gchar * variable, GNode * expr)
+{
+    gchar *code = c_expression(expr);
+
+    c_line("%s = %s;", variable, code);
+    g_free(code);
+}
+
+/* the statements from ``nodes'' on, up to a "senao" */
+static void c_block(GNode * nodes)
+{
+    function->indent++;
+    c_statements(nodes);
+    function->indent--;
+}
+
+static void c_if(GNode * node)
+{
+    GNode *last = g_node_last_child(node);
+    gchar *cond = c_condition(node->children);
+
+    c_line("if %s {", cond);
+    c_block(node->children->next);
+
+    if (token(last) == T_ELSE) {
+	c_line("} else {");
+	c_block(last->children);
+    }
+
+    c_line("}");
+    g_free(cond);
+}
+
+static void c_while(GNode * node)
+{
+    gchar *cond = c_condition(node->children);
+
+    c_line("while %s {", cond);
+    c_block(node->children->next);
+    c_line("}");
+
+    g_free(cond);
+}
+
+/* the loop variable, its start value, the condition, the step, and the body */
+static void c_for(GNode * node)
+{
+    GNode *loop_var = node->children, *cond = loop_var->next, *step = cond->next;
+    gchar *variable, *c_cond, *c_step, *temp, *add, *code;
+
+    variable = c_variable(name(loop_var));
+    c_assign(variable, loop_var->children);
+
+    c_cond = c_condition(cond);
+    c_line("while %s {", c_cond);
+    c_block(step->next);
+
+    /* the step is evaluated before the variable is loaded */
+    c_step = c_expression(step);
+    if (c_has_call(step)) {
+	temp = c_temp_new();
+	add = c_operation(T_PLUS, temp, variable);
+	code = g_strdup_printf("(%s = %s, %s)", temp, c_step, add);
+	g_free(temp);
+	g_free(add);
+    } else {
+	code = c_operation(T_PLUS, c_step, variable);
+    }
+
+    function->indent++;
+    c_line("%s = %s;", variable, code);
+    function->indent--;
+    c_line("}");
+
+    g_free(c_cond);
+    g_free(c_step);
+    g_free(code);
+}
+
+static void c_switch(GNode * node)
+{
+    GNode *n;
+    gchar *selector = c_parenthesized(c_expression(node->children));
+
+    c_line("switch %s {", selector);
+
+    for (n = node->children->next; n; n = n->next) {
+	if (token(n) == T_CASE)
+	    c_line("case %d:", atoi(name(n)));
+	else
+	    c_line("default:");
+
+	c_block(n->children);
+
+	function->indent++;
+	c_line("break;");
+	function->indent--;
+    }
+
+    c_line("}");
+    g_free(selector);
+}
+
+/*
+ * A tail call stores the new arguments into the parameters, after all of
+ * them are evaluated, and jumps back to the start of the body (see
+ * eliminate_tail_calls() in optimization.c).
+ */
+static void c_tail_call(GNode * node)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    GSList *param;
+    GNode *n;
+    gchar *code;
+    gint i;
+
+    function->tail = TRUE;
+
+    if (!node->children) {
+	c_line("goto tail;");
+	return;
+    }
+
+    c_line("{");
+    function->indent++;
+
+    for (n = node->children, i = 0; n; n = n->next, i++) {
+	code = c_expression(n);
+	c_line("int a%d = %s;", i, code);
+	g_free(code);
+    }
+
+    for (param = symbol->parameters, i = 0; param; param = param->next, i++)
+	c_line("%s = a%d;", (gchar *) g_hash_table_lookup(names, param->data), i);
+
+    c_line("goto tail;");
+    function->indent--;
+    c_line("}");
+}
+
+static CFunction *c_function_new(Symbol * symbol, gboolean recursive)
+{
+    CFunction *f = g_new0(CFunction, 1);
+
+    f->symbol = symbol;
+    f->body = g_string_new(NULL);
+    f->recursive = recursive;
+    f->indent = 1;
+
+    return f;
+}
+
+static void c_function_free(CFunction * f)
+{
+    g_string_free(f->body, TRUE);
+    g_slist_free(f->frame);
+    g_free(f);
+}
+
+static void c_temps(CFunction * f, GString * code)
+{
+    gint i;
+
+    if (!f->temps)
+	return;
+
+    g_string_append(code, "    int");
+    for (i = 1; i <= f->temps; i++)
+	g_string_append_printf(code, i == 1 ? " t%d" : ", t%d", i);
+    g_string_append(code, ";\n");
+}
+
+static void c_subprogram(GNode * node, gboolean procedure)
+{
+    CFunction *outer = function;
+    CallGraphNode *cg_node;
+    Symbol *symbol;
+    GString *signature;
+    GSList *l;
+    gchar *c_name, *result = NULL;
+    gint i;
+
+    symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    cg_node = callgraph_lookup(callgraph, symbol);
+
+    /* as in the object, procedures nothing calls are left out */
+    if (cg_node && !cg_node->reachable && pass_enabled("dead-procedures"))
+	return;
+
+    c_name = c_name_new(names, symbol, procedure ? "p_" : "f_");
+    function = c_function_new(symbol, !cg_node || cg_node->recursive);
+
+    symbol_table_context_enter(symbol_table, name(node));
+
+    for (l = symbol->parameters; l; l = l->next)
+	c_declare((Symbol *) l->data);
+
+    if (!procedure) {
+	result = c_name_new(results, symbol, "r_");
+	g_string_append_printf(declarations, "static int %s;\n", result);
+    }
+
+    c_statements(node->children);
+
+    symbol_table_context_leave(symbol_table);
+
+    signature = g_string_new(NULL);
+    g_string_printf(signature, "static %s %s(", procedure ? "void" : "int", c_name);
+    for (l = symbol->parameters, i = 0; l; l = l->next, i++)
+	g_string_append_printf(signature, i ? ", int arg%d" : "int arg%d", i);
+    g_string_append(signature, symbol->parameters ? ")" : "void)");
+
+    g_string_append_printf(declarations, "%s;\n", signature->str);
+    g_string_append_printf(definitions, "\n%s\n{\n", signature->str);
+    g_string_free(signature, TRUE);
+
+    c_temps(function, definitions);
+    if (function->recursive && !procedure)
+	g_string_append(definitions, "    int result;\n");
+    if (function->temps || (function->recursive && !procedure))
+	g_string_append_c(definitions, '\n');
+
+    has_frames |= function->recursive && (function->frame || !procedure);
+
+    if (function->recursive && !procedure)
+	g_string_append_printf(definitions, "    SAVE(%s);\n", result);
+    for (l = function->frame; l; l = l->next)
+	g_string_append_printf(definitions, "    SAVE(%s);\n",
+			       (gchar *) g_hash_table_lookup(names, l->data));
+
+    for (l = symbol->parameters, i = 0; l; l = l->next, i++)
+	g_string_append_printf(definitions, "    %s = arg%d;\n",
+			       (gchar *) g_hash_table_lookup(names, l->data), i);
+
+    if (function->tail)
+	g_string_append(definitions, "tail:\n");
+    g_string_append(definitions, function->body->str);
+
+    if (function->recursive) {
+	if (!procedure)
+	    g_string_append_printf(definitions, "    result = %s;\n", result);
+
+	function->frame = g_slist_reverse(function->frame);
+	for (l = function->frame; l; l = l->next)
+	    g_string_append_printf(definitions, "    RESTORE(%s);\n",
+				   (gchar *) g_hash_table_lookup(names, l->data));
+	if (!procedure)
+	    g_string_append_printf(definitions, "    RESTORE(%s);\n", result);
+    }
+
+    if (!procedure)
+	g_string_append_printf(definitions, "    return %s;\n",
+			       function->recursive ? "result" : result);
+
+    g_string_append(definitions, "}\n");
+
+    c_function_free(function);
+    function = outer;
+}
+
+static void c_statement(GNode * node)
+{
+    gchar *code;
+
+    switch (token(node)) {
+    case T_VAR:
+	c_variables(node);
+	break;
+    case T_PROCEDURE:
+	c_subprogram(node, TRUE);
+	break;
+    case T_FUNCTION:
+	c_subprogram(node, FALSE);
+	break;
+    case T_MAIN_BEGIN:
+	break;
+    case T_ATTRIB:
+	c_assign(c_variable(name(node)), node->children);
+	break;
+    case T_FUNCTION_RETURN:
+	c_assign((gchar *) g_hash_table_lookup(results,
+				symbol_table_lookup_symbol(symbol_table, name(node))),
+		 node->children);
+	break;
+    case T_READ:
+	c_line("%s = csd_read();", c_variable(name(node)));
+	break;
+    case T_WRITE:
+	c_line("csd_write(%s);", c_variable(name(node)));
+	break;
+    case T_PROCEDURE_CALL:
+	code = c_call(node);
+	c_line("%s;", code);
+	g_free(code);
+	break;
+    case T_TAIL_CALL:
+	c_tail_call(node);
+	break;
+    case T_IF:
+	c_if(node);
+	break;
+    case T_WHILE:
+	c_while(node);
+	break;
+    case T_FOR:
+	c_for(node);
+	break;
+    case T_SWITCH:
+	c_switch(node);
+	break;
+    default:
+	g_error("Houston, we have a problem! Don't know how to "
+		"generate C for node type ``%s'' (%d).",
+		literals[token(node)], token(node));
+    }
+}
+
+static void c_statements(GNode * nodes)
+{
+    GNode *n;
+
+    for (n = nodes; n && token(n) != T_ELSE; n = n->next)
+	c_statement(n);
+}
+
+void codegen_c(GNode * root)
+{
+    callgraph = callgraph_new(root);
+    symbol_table_context_reset(symbol_table);
+
+    names = g_hash_table_new(g_direct_hash, g_direct_equal);
+    results = g_hash_table_new(g_direct_hash, g_direct_equal);
+    used_names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    declarations = g_string_new(NULL);
+    definitions = g_string_new(NULL);
+    has_frames = FALSE;
+
+    /* globals belong to no procedure, so they are never saved */
+    function = c_function_new(NULL, FALSE);
+    c_statements(root->children);
+
+    g_string_append(definitions, "\nint main(void)\n{\n");
+    c_temps(function, definitions);
+    if (function->temps)
+	g_string_append_c(definitions, '\n');
+    g_string_append_printf(definitions, "%s    return 0;\n}\n", function->body->str);
+
+    compiler_write("/* %s, compiled by csd */\n\n%s%s\n%s%s",
+		   params.input_file, runtime, has_frames ? runtime_frames : "",
+		   declarations->str, definitions->str);
+
+    c_function_free(function);
+    function = NULL;
+
+    g_string_free(declarations, TRUE);
+    g_string_free(definitions, TRUE);
+    g_hash_table_destroy(names);
+    g_hash_table_destroy(results);
+    g_hash_table_destroy(used_names);
+
+    callgraph_free(callgraph);
+    callgraph = NULL;
+}
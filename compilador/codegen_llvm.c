@@ -0,0 +1,825 @@
+/*
+ * Simple Pascal Compiler
+ * LLVM Code Generator
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ * Translates the AST into LLVM IR text (--target=llvm), to be optimized
+ * by "opt" and built by "llc" or "clang"; "leia", "escreva" and "div"
+ * call a small runtime on top of the C library.
+ *
+ * Procedures and functions become functions, their parameters and locals
+ * allocas, which mem2reg turns into registers. Nested procedures reach the
+ * variables of their parents through fixed addresses, as in the object, so
+ * a procedure with nested ones keeps its variables in globals instead, and
+ * if it may be active more than once (see callgraph.c) saves them on entry
+ * and restores them on exit, as ALLOC and DALLOC do. Locals start at zero;
+ * other than that, programs behave as they do on the machine.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include <glib.h>
+
+#include "lex.h"
+#include "ast.h"
+#include "codegen.h"
+#include "symbol-table.h"
+#include "callgraph.h"
+#include "passes.h"
+
+typedef struct _LFunction LFunction;
+
+struct _LFunction {
+    GString *entry;		/* allocas, before the body */
+    GString *body;
+    GSList *saved;		/* globals saved on entry, if recursive */
+    gboolean globals;		/* keeps its variables in globals */
+    gboolean terminated;	/* the current block has ended */
+    gint tail;			/* label of the start of the body, if it has tail calls */
+};
+
+static PER_THREAD CallGraph *callgraph = NULL;
+static PER_THREAD GHashTable *names = NULL;	/* Symbol * -> LLVM identifier */
+static PER_THREAD GHashTable *results = NULL;	/* function Symbol * -> LLVM identifier */
+static PER_THREAD GHashTable *used_names = NULL;
+static PER_THREAD GString *globals = NULL, *definitions = NULL;
+static PER_THREAD LFunction *function = NULL;	/* being generated */
+static PER_THREAD gint values = 0, labels = 0;
+static PER_THREAD gboolean short_circuit = FALSE;
+
+static const gchar runtime[] =
+    "@.csd_format = private unnamed_addr constant [4 x i8] c\"%d\\0A\\00\"\n"
+    "@.csd_div_zero = private unnamed_addr constant [19 x i8] c\"Divis\\C3\\A3o por zero\\0A\\00\"\n"
+    "@stdin = external global i8*\n"
+    "\n"
+    "declare i32 @printf(i8*, ...)\n"
+    "declare i8* @fgets(i8*, i32, i8*)\n"
+    "declare i32 @atoi(i8*)\n"
+    "declare void @exit(i32) noreturn\n"
+    "\n"
+    "define internal i32 @csd_div(i32 %a, i32 %b) {\n"
+    "entry:\n"
+    "  %zero = icmp eq i32 %b, 0\n"
+    "  br i1 %zero, label %fail, label %divide\n"
+    "fail:\n"
+    "  call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([19 x i8], [19 x i8]* @.csd_div_zero, i64 0, i64 0))\n"
+    "  call void @exit(i32 1)\n"
+    "  unreachable\n"
+    "divide:\n"
+    "  %quotient = sdiv i32 %a, %b\n"
+    "  ret i32 %quotient\n"
+    "}\n"
+    "\n"
+    "define internal i32 @csd_read() {\n"
+    "entry:\n"
+    "  %buffer = alloca [128 x i8]\n"
+    "  %line = getelementptr inbounds [128 x i8], [128 x i8]* %buffer, i64 0, i64 0\n"
+    "  %file = load i8*, i8** @stdin\n"
+    "  %read = call i8* @fgets(i8* %line, i32 128, i8* %file)\n"
+    "  %end = icmp eq i8* %read, null\n"
+    "  br i1 %end, label %none, label %number\n"
+    "number:\n"
+    "  %value = call i32 @atoi(i8* %line)\n"
+    "  ret i32 %value\n"
+    "none:\n"
+    "  ret i32 0\n"
+    "}\n"
+    "\n"
+    "define internal void @csd_write(i32 %value) {\n"
+    "entry:\n"
+    "  call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @.csd_format, i64 0, i64 0), i32 %value)\n"
+    "  ret void\n"
+    "}\n";
+
+static void l_statements(GNode * nodes);
+static gchar *l_expression(GNode * node);
+
+/***/
+
+static TokenType token(GNode * node)
+{
+    return ((ASTNode *) node->data)->token;
+}
+
+static gchar *name(GNode * node)
+{
+    return (gchar *) ((ASTNode *) node->data)->data;
+}
+
+static gint l_label_new(void)
+{
+    return ++labels;
+}
+
+/* starts a block, falling through to it from the current one */
+static void l_block(gint label)
+{
+    if (!function->terminated)
+	g_string_append_printf(function->body, "  br label %%L%d\n", label);
+
+    g_string_append_printf(function->body, "L%d:\n", label);
+    function->terminated = FALSE;
+}
+
+/* instructions after a terminator go to a block nothing jumps to */
+static void l_line(const gchar * format, ...)
+{
+    va_list args;
+
+    if (function->terminated)
+	l_block(l_label_new());
+
+    g_string_append(function->body, "  ");
+
+    va_start(args, format);
+    g_string_append_vprintf(function->body, format, args);
+    va_end(args);
+
+    g_string_append_c(function->body, '\n');
+}
+
+static void l_terminator(const gchar * format, ...)
+{
+    va_list args;
+
+    if (function->terminated)
+	l_block(l_label_new());
+
+    g_string_append(function->body, "  ");
+
+    va_start(args, format);
+    g_string_append_vprintf(function->body, format, args);
+    va_end(args);
+
+    g_string_append_c(function->body, '\n');
+    function->terminated = TRUE;
+}
+
+static void l_jump(gint label)
+{
+    l_terminator("br label %%L%d", label);
+}
+
+static gchar *l_value_new(void)
+{
+    return g_strdup_printf("%%t%d", ++values);
+}
+
+/*
+ * Names are prefixed by what they are, so they never clash with the
+ * runtime, and numbered when a name is declared more than once.
+ */
+static gchar *l_name_new(GHashTable * table, Symbol * symbol, const gchar * prefix)
+{
+    gchar *l_name;
+    gint n = 1;
+
+    l_name = g_strdup_printf("%s%s", prefix, symbol->name);
+    while (g_hash_table_lookup(used_names, l_name)) {
+	g_free(l_name);
+	l_name = g_strdup_printf("%s%s_%d", prefix, symbol->name, ++n);
+    }
+
+    g_hash_table_insert(used_names, l_name, l_name);
+    g_hash_table_insert(table, symbol, l_name);
+
+    return l_name;
+}
+
+/* a global outside of procedures, or in ones that keep theirs there */
+static gchar *l_declare(Symbol * symbol)
+{
+    gchar *l_name;
+
+    if (function->globals) {
+	l_name = l_name_new(names, symbol, "@v_");
+	g_string_append_printf(globals, "%s = internal global i32 0\n", l_name);
+
+	function->saved = g_slist_append(function->saved, l_name);
+    } else {
+	l_name = l_name_new(names, symbol, "%v_");
+	g_string_append_printf(function->entry, "  %s = alloca i32\n"
+			       "  store i32 0, i32* %s\n", l_name, l_name);
+    }
+
+    return l_name;
+}
+
+static gchar *l_variable(gchar * lpd_name)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, lpd_name);
+    gchar *l_name = g_hash_table_lookup(names, symbol);
+
+    return l_name ? l_name : l_declare(symbol);
+}
+
+static const gchar *l_predicate(TokenType op)
+{
+    switch (op) {
+    case T_OP_EQUAL:
+	return "eq";
+    case T_OP_DIFFERENT:
+	return "ne";
+    case T_OP_GT:
+	return "sgt";
+    case T_OP_GEQ:
+	return "sge";
+    case T_OP_LT:
+	return "slt";
+    case T_OP_LEQ:
+	return "sle";
+    default:
+	return NULL;
+    }
+}
+
+/* the arguments are evaluated left to right; returns the result, if any */
+static gchar *l_call(GNode * node)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    GString *args = g_string_new(NULL);
+    GNode *n;
+    gchar *arg, *value = NULL;
+
+    for (n = node->children; n; n = n->next) {
+	arg = l_expression(n);
+	g_string_append_printf(args, n == node->children ? "i32 %s" : ", i32 %s", arg);
+	g_free(arg);
+    }
+
+    if (token(node) == T_FUNCTION_CALL) {
+	value = l_value_new();
+	l_line("%s = call i32 %s(%s)", value,
+	       (gchar *) g_hash_table_lookup(names, symbol), args->str);
+    } else {
+	l_line("call void %s(%s)", (gchar *) g_hash_table_lookup(names, symbol), args->str);
+    }
+
+    g_string_free(args, TRUE);
+
+    return value;
+}
+
+/* the condition as an i1 */
+static gchar *l_bool(GNode * node)
+{
+    const gchar *predicate = l_predicate(token(node));
+    gchar *a, *b, *value;
+
+    switch (token(node)) {
+    case T_TRUE:
+	return g_strdup("true");
+    case T_FALSE:
+	return g_strdup("false");
+    default:
+	break;
+    }
+
+    if (predicate) {
+	a = l_expression(node->children);
+	b = token(node->children->next) == T_DUP ? g_strdup(a) :
+	    l_expression(node->children->next);
+	value = l_value_new();
+	l_line("%s = icmp %s i32 %s, %s", value, predicate, a, b);
+	g_free(b);
+    } else {
+	a = l_expression(node);
+	value = l_value_new();
+	l_line("%s = icmp ne i32 %s, 0", value, a);
+    }
+
+    g_free(a);
+
+    return value;
+}
+
+/*
+ * The right operand may be the left one again (see T_DUP in
+ * optimization.c).
+ */
+static gchar *l_binop(GNode * node)
+{
+    GNode *right = node->children->next;
+    const gchar *instruction = NULL;
+    gchar *a, *b, *value, *cond;
+
+    if (l_predicate(token(node))) {
+	cond = l_bool(node);
+	value = l_value_new();
+	l_line("%s = zext i1 %s to i32", value, cond);
+	g_free(cond);
+	return value;
+    }
+
+    a = l_expression(node->children);
+    b = token(right) == T_DUP ? g_strdup(a) : l_expression(right);
+    value = l_value_new();
+
+    switch (token(node)) {
+    case T_PLUS:
+	instruction = "add";
+	break;
+    case T_MINUS:
+	instruction = "sub";
+	break;
+    case T_MULTIPLY:
+	instruction = "mul";
+	break;
+    case T_DIVIDE_UNCHECKED:
+	instruction = "sdiv";
+	break;
+    case T_AND:
+	/* both operands are evaluated, as AND does */
+	instruction = "and";
+	break;
+    case T_OR:
+	instruction = "or";
+	break;
+    case T_DIVIDE:
+	l_line("%s = call i32 @csd_div(i32 %s, i32 %s)", value, a, b);
+	break;
+    default:
+	g_error("Don't know how to generate LLVM IR for operator ``%s'' (%d).",
+		literals[token(node)], token(node));
+    }
+
+    if (instruction)
+	l_line("%s = %s i32 %s, %s", value, instruction, a, b);
+
+    g_free(a);
+    g_free(b);
+
+    return value;
+}
+
+/* SEL evaluates both values, then the condition */
+static gchar *l_select(GNode * node)
+{
+    GNode *cond = node->children, *a = cond->next, *b = a->next;
+    gchar *l_a, *l_b, *l_cond, *value;
+
+    l_a = l_expression(a);
+    l_b = l_expression(b);
+    l_cond = l_bool(cond);
+    value = l_value_new();
+
+    l_line("%s = select i1 %s, i32 %s, i32 %s", value, l_cond, l_a, l_b);
+
+    g_free(l_a);
+    g_free(l_b);
+    g_free(l_cond);
+
+    return value;
+}
+
+static gchar *l_unary(const gchar * format, GNode * node)
+{
+    gchar *operand = l_expression(node->children), *value, *code;
+
+    value = l_value_new();
+    code = g_strdup_printf(format, operand);
+    l_line("%s = %s", value, code);
+
+    g_free(code);
+    g_free(operand);
+
+    return value;
+}
+
+static gchar *l_load(gchar * address)
+{
+    gchar *value = l_value_new();
+
+    l_line("%s = load i32, i32* %s", value, address);
+
+    return value;
+}
+
+static gchar *l_expression(GNode * node)
+{
+    switch (token(node)) {
+    case T_NUMBER:
+	return g_strdup_printf("%d", atoi(name(node)));
+    case T_TRUE:
+	return g_strdup("1");
+    case T_FALSE:
+	return g_strdup("0");
+    case T_IDENTIFIER:
+	return l_load(l_variable(name(node)));
+    case T_FUNCTION_CALL:
+	return l_call(node);
+    case T_NOT:
+	return l_unary("xor i32 %s, 1", node);
+    case T_UNARY_MINUS:
+	return l_unary("sub i32 0, %s", node);
+    case T_UNARY_PLUS:
+	return l_expression(node->children);
+    case T_SELECT:
+	return l_select(node);
+    default:
+	return l_binop(node);
+    }
+}
+
+/*
+ * Branches to ``if_true'' or ``if_false''; with short-circuiting, the
+ * right operand of "e" and "ou" isn't evaluated when the left one
+ * decides, as in generate_branch().
+ */
+static void l_condition(GNode * node, gint if_true, gint if_false)
+{
+    GNode *right;
+    gchar *cond;
+    gint next;
+
+    switch (token(node)) {
+    case T_NOT:
+	l_condition(node->children, if_false, if_true);
+	return;
+    case T_AND:
+    case T_OR:
+	right = node->children->next;
+	if (!short_circuit || (!params.short_circuit && !codegen_can_skip(right)))
+	    break;
+
+	if (pass_enabled("short-circuit"))
+	    pass_note("short-circuit", 1);
+
+	next = l_label_new();
+	if (token(node) == T_AND)
+	    l_condition(node->children, next, if_false);
+	else
+	    l_condition(node->children, if_true, next);
+	l_block(next);
+	l_condition(right, if_true, if_false);
+	return;
+    default:
+	break;
+    }
+
+    cond = l_bool(node);
+    l_terminator("br i1 %s, label %%L%d, label %%L%d", cond, if_true, if_false);
+    g_free(cond);
+}
+
+/***/
+
+static void l_variables(GNode * types)
+{
+    GNode *type, *var;
+
+    for (type = types->children; type; type = type->next) {
+	for (var = type->children; var; var = var->next)
+	    l_declare(symbol_table_lookup_symbol(symbol_table, name(var)));
+    }
+}
+
+static void l_assign(gchar * variable, GNode * expr)
+{
+    gchar *value = l_expression(expr);
+
+    l_line("store i32 %s, i32* %s", value, variable);
+    g_free(value);
+}
+
+static void l_if(GNode * node)
+{
+    GNode *last = g_node_last_child(node);
+    gint then = l_label_new(), otherwise = l_label_new(), end;
+
+    l_condition(node->children, then, otherwise);
+    l_block(then);
+    l_statements(node->children->next);
+
+    if (token(last) == T_ELSE) {
+	end = l_label_new();
+	l_jump(end);
+	l_block(otherwise);
+	l_statements(last->children);
+	l_block(end);
+    } else {
+	l_block(otherwise);
+    }
+}
+
+static void l_while(GNode * node)
+{
+    gint test = l_label_new(), body = l_label_new(), end = l_label_new();
+
+    l_block(test);
+    l_condition(node->children, body, end);
+    l_block(body);
+    l_statements(node->children->next);
+    l_jump(test);
+    l_block(end);
+}
+
+/* the loop variable, its start value, the condition, the step, and the body */
+static void l_for(GNode * node)
+{
+    GNode *loop_var = node->children, *cond = loop_var->next, *step = cond->next;
+    gint test = l_label_new(), body = l_label_new(), end = l_label_new();
+    gchar *variable, *l_step, *current, *value;
+
+    variable = l_variable(name(loop_var));
+    l_assign(variable, loop_var->children);
+
+    l_block(test);
+    l_condition(cond, body, end);
+    l_block(body);
+    l_statements(step->next);
+
+    /* the step is evaluated before the variable is loaded */
+    l_step = l_expression(step);
+    current = l_load(variable);
+    value = l_value_new();
+    l_line("%s = add i32 %s, %s", value, l_step, current);
+    l_line("store i32 %s, i32* %s", value, variable);
+    l_jump(test);
+    l_block(end);
+
+    g_free(l_step);
+    g_free(current);
+    g_free(value);
+}
+
+static void l_switch(GNode * node)
+{
+    GNode *n, *otherwise = NULL;
+    GString *cases = g_string_new(NULL);
+    gchar *selector = l_expression(node->children);
+    gint none = l_label_new(), end = l_label_new(), first = labels + 1;
+
+    for (n = node->children->next; n; n = n->next) {
+	if (token(n) == T_CASE)
+	    g_string_append_printf(cases, " i32 %d, label %%L%d", atoi(name(n)), l_label_new());
+	else
+	    otherwise = n;
+    }
+
+    l_terminator("switch i32 %s, label %%L%d [%s ]", selector, none, cases->str);
+
+    for (n = node->children->next; n; n = n->next) {
+	if (token(n) == T_CASE) {
+	    l_block(first++);
+	    l_statements(n->children);
+	    l_jump(end);
+	}
+    }
+
+    l_block(none);
+    if (otherwise)
+	l_statements(otherwise->children);
+    l_block(end);
+
+    g_string_free(cases, TRUE);
+    g_free(selector);
+}
+
+/*
+ * A tail call stores the new arguments into the parameters, after all of
+ * them are evaluated, and jumps back to the start of the body (see
+ * eliminate_tail_calls() in optimization.c).
+ */
+static void l_tail_call(GNode * node)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    GSList *param, *args = NULL, *arg;
+    GNode *n;
+
+    if (!function->tail)
+	function->tail = l_label_new();
+
+    for (n = node->children; n; n = n->next)
+	args = g_slist_append(args, l_expression(n));
+
+    for (param = symbol->parameters, arg = args; param; param = param->next, arg = arg->next)
+	l_line("store i32 %s, i32* %s", (gchar *) arg->data,
+	       (gchar *) g_hash_table_lookup(names, param->data));
+
+    l_jump(function->tail);
+
+    g_slist_foreach(args, (GFunc) g_free, NULL);
+    g_slist_free(args);
+}
+
+static LFunction *l_function_new(gboolean globals)
+{
+    LFunction *f = g_new0(LFunction, 1);
+
+    f->entry = g_string_new(NULL);
+    f->body = g_string_new(NULL);
+    f->globals = globals;
+
+    return f;
+}
+
+static void l_function_free(LFunction * f)
+{
+    g_string_free(f->entry, TRUE);
+    g_string_free(f->body, TRUE);
+    g_slist_free(f->saved);
+    g_free(f);
+}
+
+static gboolean l_has_subprograms(GNode * node)
+{
+    GNode *n;
+
+    for (n = node->children; n; n = n->next) {
+	if (token(n) == T_PROCEDURE || token(n) == T_FUNCTION)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void l_subprogram(GNode * node, gboolean procedure)
+{
+    LFunction *outer = function;
+    CallGraphNode *cg_node;
+    Symbol *symbol;
+    GString *signature;
+    GSList *l;
+    gchar *l_name, *result = NULL, *value;
+    gboolean recursive;
+    gint i;
+
+    symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    cg_node = callgraph_lookup(callgraph, symbol);
+
+    /* as in the object, procedures nothing calls are left out */
+    if (cg_node && !cg_node->reachable && pass_enabled("dead-procedures"))
+	return;
+
+    l_name = l_name_new(names, symbol, procedure ? "@p_" : "@f_");
+    recursive = !cg_node || cg_node->recursive;
+    function = l_function_new(l_has_subprograms(node));
+
+    symbol_table_context_enter(symbol_table, name(node));
+
+    signature = g_string_new(NULL);
+    g_string_printf(signature, "define internal %s %s(", procedure ? "void" : "i32", l_name);
+
+    for (l = symbol->parameters, i = 0; l; l = l->next, i++) {
+	g_string_append_printf(signature, i ? ", i32 %%arg%d" : "i32 %%arg%d", i);
+	l_declare((Symbol *) l->data);
+    }
+    g_string_append(signature, ") {\n");
+
+    if (!procedure) {
+	result = l_name_new(results, symbol, "%r_");
+	g_string_append_printf(function->entry, "  %s = alloca i32\n"
+			       "  store i32 0, i32* %s\n", result, result);
+    }
+
+    l_statements(node->children);
+
+    symbol_table_context_leave(symbol_table);
+
+    g_string_append_printf(definitions, "\n%sentry:\n", signature->str);
+    g_string_free(signature, TRUE);
+
+    /* the variables of the previous activation are saved before anything */
+    if (recursive) {
+	for (l = function->saved; l; l = l->next)
+	    g_string_append_printf(definitions, "  %%saved.%s = load i32, i32* %s\n",
+				   (gchar *) l->data + 1, (gchar *) l->data);
+    }
+
+    g_string_append(definitions, function->entry->str);
+
+    for (l = symbol->parameters, i = 0; l; l = l->next, i++)
+	g_string_append_printf(definitions, "  store i32 %%arg%d, i32* %s\n", i,
+			       (gchar *) g_hash_table_lookup(names, l->data));
+
+    if (function->tail)
+	g_string_append_printf(definitions, "  br label %%L%d\nL%d:\n",
+			       function->tail, function->tail);
+
+    value = procedure ? NULL : l_load(result);
+
+    if (recursive) {
+	for (l = function->saved; l; l = l->next)
+	    l_line("store i32 %%saved.%s, i32* %s", (gchar *) l->data + 1, (gchar *) l->data);
+    }
+
+    if (procedure)
+	l_terminator("ret void");
+    else
+	l_terminator("ret i32 %s", value);
+
+    g_string_append_printf(definitions, "%s}\n", function->body->str);
+
+    g_free(value);
+    l_function_free(function);
+    function = outer;
+}
+
+static void l_statement(GNode * node)
+{
+    gchar *value;
+
+    switch (token(node)) {
+    case T_VAR:
+	l_variables(node);
+	break;
+    case T_PROCEDURE:
+	l_subprogram(node, TRUE);
+	break;
+    case T_FUNCTION:
+	l_subprogram(node, FALSE);
+	break;
+    case T_MAIN_BEGIN:
+	break;
+    case T_ATTRIB:
+	l_assign(l_variable(name(node)), node->children);
+	break;
+    case T_FUNCTION_RETURN:
+	l_assign((gchar *) g_hash_table_lookup(results,
+				symbol_table_lookup_symbol(symbol_table, name(node))),
+		 node->children);
+	break;
+    case T_READ:
+	value = l_value_new();
+	l_line("%s = call i32 @csd_read()", value);
+	l_line("store i32 %s, i32* %s", value, l_variable(name(node)));
+	g_free(value);
+	break;
+    case T_WRITE:
+	value = l_load(l_variable(name(node)));
+	l_line("call void @csd_write(i32 %s)", value);
+	g_free(value);
+	break;
+    case T_PROCEDURE_CALL:
+	l_call(node);
+	break;
+    case T_TAIL_CALL:
+	l_tail_call(node);
+	break;
+    case T_IF:
+	l_if(node);
+	break;
+    case T_WHILE:
+	l_while(node);
+	break;
+    case T_FOR:
+	l_for(node);
+	break;
+    case T_SWITCH:
+	l_switch(node);
+	break;
+    default:
+	g_error("Houston, we have a problem! Don't know how to "
+		"generate LLVM IR for node type ``%s'' (%d).",
+		literals[token(node)], token(node));
+    }
+}
+
+static void l_statements(GNode * nodes)
+{
+    GNode *n;
+
+    for (n = nodes; n && token(n) != T_ELSE; n = n->next)
+	l_statement(n);
+}
+
+void codegen_llvm(GNode * root)
+{
+    callgraph = callgraph_new(root);
+    symbol_table_context_reset(symbol_table);
+
+    names = g_hash_table_new(g_direct_hash, g_direct_equal);
+    results = g_hash_table_new(g_direct_hash, g_direct_equal);
+    used_names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    globals = g_string_new(NULL);
+    definitions = g_string_new(NULL);
+    values = labels = 0;
+    short_circuit = pass_enabled("short-circuit") || params.short_circuit;
+
+    /* globals belong to no procedure, so they are never saved */
+    function = l_function_new(TRUE);
+    l_statements(root->children);
+    l_terminator("ret i32 0");
+
+    compiler_write("; %s, compiled by csd\n\n%s\n%s%s\n"
+		   "define i32 @main() {\nentry:\n%s}\n",
+		   params.input_file, runtime, globals->str, definitions->str,
+		   function->body->str);
+
+    l_function_free(function);
+    function = NULL;
+
+    g_string_free(globals, TRUE);
+    g_string_free(definitions, TRUE);
+    g_hash_table_destroy(names);
+    g_hash_table_destroy(results);
+    g_hash_table_destroy(used_names);
+
+    callgraph_free(callgraph);
+    callgraph = NULL;
+}
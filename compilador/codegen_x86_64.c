@@ -0,0 +1,1154 @@
+/*
+ * Simple Pascal Compiler
+ * x86-64 Code Generator
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ * Translates the AST into GNU assembler for x86-64 Linux (--target=x86_64),
+ * which builds with "as" and "ld" alone: the program brings a small runtime
+ * of its own, reading and writing through buffers with system calls.
+ *
+ * Globals live in .bss. Each procedure or function gets a frame on the
+ * machine stack, with its locals and result below the frame pointer and the
+ * arguments, pushed by the caller, above it; nested procedures also get a
+ * pointer to the frame of their parent (the static link), through which
+ * they reach its variables. That is the frame of the parent's most recent
+ * activation, the same one the machine restores the variables of, so
+ * programs behave as they do on it.
+ *
+ * Expressions are evaluated into registers: the value at depth d of the
+ * operand stack generate_binop() uses goes to registers[d], and variables
+ * and constants on the right of an operator are used right from where they
+ * are. Only deeper expressions push values on the machine stack, and
+ * calls save the registers in use. Operands are evaluated left to right,
+ * as on the machine, and 32-bit arithmetic wraps around as it does there.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include <glib.h>
+
+#include "lex.h"
+#include "ast.h"
+#include "codegen.h"
+#include "symbol-table.h"
+#include "callgraph.h"
+#include "passes.h"
+
+typedef struct _XVariable XVariable;
+typedef struct _XProcedure XProcedure;
+typedef struct _XFunction XFunction;
+
+struct _XVariable {
+    gint depth;			/* of the procedure it belongs to; 0 if global */
+    gint offset;		/* from the frame pointer */
+    gchar *label;		/* of globals */
+};
+
+struct _XProcedure {
+    gchar *label;
+    gint depth;			/* 1 for the procedures of the main program */
+};
+
+struct _XFunction {
+    GString *code;
+    gint depth;
+    gint slots;			/* locals and result, below the frame pointer */
+    guint tail;			/* label of the start of the body, if it has tail calls */
+};
+
+/* 32-bit and 64-bit names; none of them is used by idiv or the runtime calls */
+static const gchar *registers[][2] = {
+    { "ebx",  "rbx" },
+    { "esi",  "rsi" },
+    { "edi",  "rdi" },
+    { "r8d",  "r8" },
+    { "r9d",  "r9" },
+    { "r12d", "r12" },
+    { "r13d", "r13" },
+    { "r14d", "r14" },
+    { "r15d", "r15" },
+};
+
+#define N_REGISTERS	((gint) G_N_ELEMENTS(registers))
+#define R32(d)		(registers[d][0])
+#define R64(d)		(registers[d][1])
+
+#define SWITCH_MAX_TABLE 1024
+
+static PER_THREAD CallGraph *callgraph = NULL;
+static PER_THREAD GHashTable *variables = NULL;	/* Symbol * -> XVariable * */
+static PER_THREAD GHashTable *results = NULL;	/* function Symbol * -> XVariable * */
+static PER_THREAD GHashTable *procedures = NULL;	/* Symbol * -> XProcedure * */
+static PER_THREAD GHashTable *used_names = NULL;
+static PER_THREAD GString *text = NULL, *rodata = NULL, *bss = NULL;
+static PER_THREAD XFunction *function = NULL;	/* being generated */
+static PER_THREAD guint labels = 0;
+static PER_THREAD gboolean short_circuit = FALSE;
+
+static const gchar runtime[] =
+    "\n"
+    "# status in %edi\n"
+    "csd_exit:\n"
+    "\tpushq %rdi\n"
+    "\tcall csd_flush\n"
+    "\tpopq %rdi\n"
+    "\tmovl $60, %eax\n"
+    "\tsyscall\n"
+    "\n"
+    "csd_flush:\n"
+    "\tleaq csd_output(%rip), %rsi\n"
+    "\tmovl csd_output_length(%rip), %edx\n"
+    ".Lrt_flush:\n"
+    "\ttestl %edx, %edx\n"
+    "\tjz .Lrt_flushed\n"
+    "\tmovl $1, %eax\n"
+    "\tmovl $1, %edi\n"
+    "\tsyscall\n"
+    "\ttestq %rax, %rax\n"
+    "\tjle .Lrt_flushed\n"
+    "\taddq %rax, %rsi\n"
+    "\tsubl %eax, %edx\n"
+    "\tjmp .Lrt_flush\n"
+    ".Lrt_flushed:\n"
+    "\tmovl $0, csd_output_length(%rip)\n"
+    "\tret\n"
+    "\n"
+    "# value in %eax\n"
+    "csd_write:\n"
+    "\tcmpl $4080, csd_output_length(%rip)\n"
+    "\tjb .Lrt_room\n"
+    "\tpushq %rax\n"
+    "\tcall csd_flush\n"
+    "\tpopq %rax\n"
+    ".Lrt_room:\n"
+    "\tleaq csd_digits+16(%rip), %rsi\n"
+    "\tdecq %rsi\n"
+    "\tmovb $10, (%rsi)\n"
+    "\tmovl %eax, %r8d\n"
+    "\ttestl %eax, %eax\n"
+    "\tjns .Lrt_positive\n"
+    "\tnegl %eax\n"
+    ".Lrt_positive:\n"
+    "\tmovl $10, %ecx\n"
+    ".Lrt_digit:\n"
+    "\txorl %edx, %edx\n"
+    "\tdivl %ecx\n"
+    "\taddb $48, %dl\n"
+    "\tdecq %rsi\n"
+    "\tmovb %dl, (%rsi)\n"
+    "\ttestl %eax, %eax\n"
+    "\tjnz .Lrt_digit\n"
+    "\ttestl %r8d, %r8d\n"
+    "\tjns .Lrt_copy\n"
+    "\tdecq %rsi\n"
+    "\tmovb $45, (%rsi)\n"
+    ".Lrt_copy:\n"
+    "\tleaq csd_digits+16(%rip), %rcx\n"
+    "\tsubq %rsi, %rcx\n"
+    "\tmovl csd_output_length(%rip), %edi\n"
+    "\taddl %ecx, csd_output_length(%rip)\n"
+    "\tleaq csd_output(%rip), %rdx\n"
+    "\taddq %rdx, %rdi\n"
+    "\trep movsb\n"
+    "\tret\n"
+    "\n"
+    "# the next character in %eax, or -1 at the end of the input\n"
+    "csd_getc:\n"
+    "\tmovl csd_input_position(%rip), %ecx\n"
+    "\tcmpl csd_input_length(%rip), %ecx\n"
+    "\tjb .Lrt_buffered\n"
+    "\txorl %eax, %eax\n"
+    "\txorl %edi, %edi\n"
+    "\tleaq csd_input(%rip), %rsi\n"
+    "\tmovl $4096, %edx\n"
+    "\tsyscall\n"
+    "\ttestq %rax, %rax\n"
+    "\tjle .Lrt_end\n"
+    "\tmovl %eax, csd_input_length(%rip)\n"
+    "\txorl %ecx, %ecx\n"
+    ".Lrt_buffered:\n"
+    "\tleaq csd_input(%rip), %rsi\n"
+    "\tmovzbl (%rsi,%rcx), %eax\n"
+    "\tincl %ecx\n"
+    "\tmovl %ecx, csd_input_position(%rip)\n"
+    "\tret\n"
+    ".Lrt_end:\n"
+    "\tmovl $0, csd_input_length(%rip)\n"
+    "\tmovl $0, csd_input_position(%rip)\n"
+    "\tmovl $-1, %eax\n"
+    "\tret\n"
+    "\n"
+    "# reads a line, and returns in %eax the number it starts with, as atoi()\n"
+    "csd_read:\n"
+    "\tcmpl $0, csd_output_length(%rip)\n"
+    "\tje .Lrt_read\n"
+    "\tcall csd_flush\n"
+    ".Lrt_read:\n"
+    "\txorl %r8d, %r8d\n"
+    "\txorl %r9d, %r9d\n"
+    ".Lrt_blank:\n"
+    "\tcall csd_getc\n"
+    "\tcmpl $32, %eax\n"
+    "\tje .Lrt_blank\n"
+    "\tleal -9(%rax), %edx\n"
+    "\tcmpl $4, %edx\n"
+    "\tja .Lrt_sign\n"
+    "\tcmpl $10, %eax\n"
+    "\tjne .Lrt_blank\n"
+    ".Lrt_sign:\n"
+    "\tcmpl $45, %eax\n"
+    "\tjne .Lrt_plus\n"
+    "\tincl %r9d\n"
+    "\tcall csd_getc\n"
+    "\tjmp .Lrt_number\n"
+    ".Lrt_plus:\n"
+    "\tcmpl $43, %eax\n"
+    "\tjne .Lrt_number\n"
+    "\tcall csd_getc\n"
+    ".Lrt_number:\n"
+    "\tleal -48(%rax), %edx\n"
+    "\tcmpl $9, %edx\n"
+    "\tja .Lrt_line\n"
+    "\timull $10, %r8d\n"
+    "\taddl %edx, %r8d\n"
+    "\tcall csd_getc\n"
+    "\tjmp .Lrt_number\n"
+    ".Lrt_line:\n"
+    "\tcmpl $10, %eax\n"
+    "\tje .Lrt_read_done\n"
+    "\tcmpl $-1, %eax\n"
+    "\tje .Lrt_read_done\n"
+    "\tcall csd_getc\n"
+    "\tjmp .Lrt_line\n"
+    ".Lrt_read_done:\n"
+    "\tmovl %r8d, %eax\n"
+    "\ttestl %r9d, %r9d\n"
+    "\tjz .Lrt_read_return\n"
+    "\tnegl %eax\n"
+    ".Lrt_read_return:\n"
+    "\tret\n"
+    "\n"
+    "csd_div_zero:\n"
+    "\tcall csd_flush\n"
+    "\tmovl $1, %eax\n"
+    "\tmovl $1, %edi\n"
+    "\tleaq csd_div_zero_message(%rip), %rsi\n"
+    "\tmovl $csd_div_zero_length, %edx\n"
+    "\tsyscall\n"
+    "\tmovl $1, %edi\n"
+    "\tmovl $60, %eax\n"
+    "\tsyscall\n";
+
+static const gchar runtime_rodata[] =
+    "csd_div_zero_message:\n"
+    "\t.ascii \"Divisão por zero\\n\"\n"
+    "\t.set csd_div_zero_length, . - csd_div_zero_message\n";
+
+/* everything in .bss takes a multiple of 4 bytes, so it all stays aligned */
+static const gchar runtime_bss[] =
+    "\t.align 4\n"
+    "csd_input:\n\t.zero 4096\n"
+    "csd_input_position:\n\t.zero 4\n"
+    "csd_input_length:\n\t.zero 4\n"
+    "csd_output:\n\t.zero 4096\n"
+    "csd_output_length:\n\t.zero 4\n"
+    "csd_digits:\n\t.zero 16\n";
+
+static void x_statements(GNode * nodes);
+static void x_expression(GNode * node, gint d);
+
+/***/
+
+static TokenType token(GNode * node)
+{
+    return ((ASTNode *) node->data)->token;
+}
+
+static gchar *name(GNode * node)
+{
+    return (gchar *) ((ASTNode *) node->data)->data;
+}
+
+static void x_line(const gchar * format, ...)
+{
+    va_list args;
+
+    g_string_append_c(function->code, '\t');
+
+    va_start(args, format);
+    g_string_append_vprintf(function->code, format, args);
+    va_end(args);
+
+    g_string_append_c(function->code, '\n');
+}
+
+static guint x_label_new(void)
+{
+    return ++labels;
+}
+
+static void x_label(guint label)
+{
+    g_string_append_printf(function->code, ".L%d:\n", label);
+}
+
+static void x_jump(const gchar * instruction, guint label)
+{
+    x_line("%s .L%d", instruction, label);
+}
+
+/*
+ * Labels are prefixed by what they name, so they never clash with the
+ * runtime, and numbered when a name is declared more than once; the "$"
+ * of the temporaries made by the optimizer isn't allowed in them.
+ */
+static gchar *x_name_new(Symbol * symbol, const gchar * prefix)
+{
+    gchar *label;
+    gint n = 1;
+
+    label = g_strdelimit(g_strdup_printf("%s%s", prefix, symbol->name), "$", '_');
+    while (g_hash_table_lookup(used_names, label)) {
+	g_free(label);
+	label = g_strdelimit(g_strdup_printf("%s%s_%d", prefix, symbol->name, ++n), "$", '_');
+    }
+
+    g_hash_table_insert(used_names, label, label);
+
+    return label;
+}
+
+/* labels are freed with used_names, see x_name_new() */
+static void x_variable_free(XVariable * variable)
+{
+    g_free(variable);
+}
+
+static void x_procedure_free(XProcedure * procedure)
+{
+    g_free(procedure);
+}
+
+/* a local of the procedure being generated, or a global outside of them */
+static XVariable *x_local_new(Symbol * symbol)
+{
+    XVariable *variable = g_new0(XVariable, 1);
+
+    variable->depth = function->depth;
+
+    if (function->depth) {
+	variable->offset = -8 * ++function->slots;
+    } else {
+	variable->label = x_name_new(symbol, "v_");
+	g_string_append_printf(bss, "%s:\n\t.zero 4\n", variable->label);
+    }
+
+    return variable;
+}
+
+static void x_declare(Symbol * symbol)
+{
+    g_hash_table_insert(variables, symbol, x_local_new(symbol));
+}
+
+/*
+ * The operand addressing ``variable'': its label, a slot of the current
+ * frame, or one of the frame of a parent, whose address is loaded into %r11
+ * by following the static links.
+ */
+static gchar *x_address(XVariable * variable)
+{
+    gint hops;
+
+    if (!variable->depth)
+	return g_strdup_printf("%s(%%rip)", variable->label);
+
+    if (variable->depth == function->depth)
+	return g_strdup_printf("%d(%%rbp)", variable->offset);
+
+    x_line("movq 16(%%rbp), %%r11");
+    for (hops = function->depth - variable->depth; hops > 1; hops--)
+	x_line("movq 16(%%r11), %%r11");
+
+    return g_strdup_printf("%d(%%r11)", variable->offset);
+}
+
+static gchar *x_variable(gchar * lpd_name)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, lpd_name);
+
+    if (!g_hash_table_lookup(variables, symbol))
+	x_declare(symbol);
+
+    return x_address((XVariable *) g_hash_table_lookup(variables, symbol));
+}
+
+/* expressions that can be the operand of an instruction */
+static gboolean x_is_leaf(GNode * node)
+{
+    switch (token(node)) {
+    case T_NUMBER:
+    case T_TRUE:
+    case T_FALSE:
+    case T_IDENTIFIER:
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+static gchar *x_operand(GNode * node)
+{
+    switch (token(node)) {
+    case T_NUMBER:
+	return g_strdup_printf("$%d", atoi(name(node)));
+    case T_TRUE:
+	return g_strdup("$1");
+    case T_FALSE:
+	return g_strdup("$0");
+    default:
+	return x_variable(name(node));
+    }
+}
+
+/***/
+
+/*
+ * Calls save the registers below depth ``d'' and push the arguments, left
+ * to right, and the static link of nested procedures; the result of a
+ * function comes back in %eax.
+ */
+static void x_call(GNode * node, gint d)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    XProcedure *procedure = g_hash_table_lookup(procedures, symbol);
+    GNode *n;
+    gint i, pushed = 0, hops;
+
+    for (i = 0; i < d; i++)
+	x_line("pushq %%%s", R64(i));
+
+    for (n = node->children; n; n = n->next, pushed++) {
+	if (token(n) == T_NUMBER) {
+	    x_line("pushq $%d", atoi(name(n)));
+	} else {
+	    x_expression(n, 0);
+	    x_line("pushq %%%s", R64(0));
+	}
+    }
+
+    if (procedure->depth > 1) {
+	hops = function->depth - (procedure->depth - 1);
+
+	if (!hops) {
+	    x_line("pushq %%rbp");
+	} else {
+	    x_line("movq 16(%%rbp), %%r10");
+	    for (; hops > 1; hops--)
+		x_line("movq 16(%%r10), %%r10");
+	    x_line("pushq %%r10");
+	}
+
+	pushed++;
+    }
+
+    x_line("call %s", procedure->label);
+    if (pushed)
+	x_line("addq $%d, %%rsp", 8 * pushed);
+
+    for (i = d - 1; i >= 0; i--)
+	x_line("popq %%%s", R64(i));
+
+    if (token(node) == T_FUNCTION_CALL)
+	x_line("movl %%eax, %%%s", R32(d));
+}
+
+/*
+ * Where the right operand of an operator is, once the left one is in
+ * registers[d]: the same register for T_DUP (see optimization.c), the
+ * operand itself for variables and constants, or the next register. Out
+ * of registers, the left operand waits on the stack.
+ */
+static gchar *x_right_operand(GNode * right, gint d)
+{
+    if (token(right) == T_DUP)
+	return g_strdup_printf("%%%s", R32(d));
+
+    if (x_is_leaf(right))
+	return x_operand(right);
+
+    if (d + 1 < N_REGISTERS) {
+	x_expression(right, d + 1);
+	return g_strdup_printf("%%%s", R32(d + 1));
+    }
+
+    x_line("pushq %%%s", R64(d));
+    x_expression(right, d);
+    x_line("movl %%%s, %%ecx", R32(d));
+    x_line("popq %%%s", R64(d));
+
+    return g_strdup("%ecx");
+}
+
+static const gchar *x_condition_code(TokenType op, gboolean negated)
+{
+    switch (op) {
+    case T_OP_EQUAL:
+	return negated ? "ne" : "e";
+    case T_OP_DIFFERENT:
+	return negated ? "e" : "ne";
+    case T_OP_GT:
+	return negated ? "le" : "g";
+    case T_OP_GEQ:
+	return negated ? "l" : "ge";
+    case T_OP_LT:
+	return negated ? "ge" : "l";
+    case T_OP_LEQ:
+	return negated ? "g" : "le";
+    default:
+	return NULL;
+    }
+}
+
+/* compares the operands of ``node''; the flags are left for a jcc or setcc */
+static void x_compare(GNode * node, gint d)
+{
+    gchar *operand;
+
+    x_expression(node->children, d);
+    operand = x_right_operand(node->children->next, d);
+    x_line("cmpl %s, %%%s", operand, R32(d));
+    g_free(operand);
+}
+
+static void x_divide(gint d, const gchar * operand, gboolean checked)
+{
+    if (*operand == '$') {
+	/* idiv takes no immediate */
+	x_line("movl %s, %%ecx", operand);
+	operand = "%ecx";
+    }
+
+    if (checked) {
+	if (*operand == '%')
+	    x_line("testl %s, %s", operand, operand);
+	else
+	    x_line("cmpl $0, %s", operand);
+	x_line("je csd_div_zero");
+    }
+
+    x_line("movl %%%s, %%eax", R32(d));
+    x_line("cltd");
+    x_line("idivl %s", operand);
+    x_line("movl %%eax, %%%s", R32(d));
+}
+
+static void x_binop(GNode * node, gint d)
+{
+    const gchar *instruction = NULL, *cc;
+    gchar *operand;
+
+    if ((cc = x_condition_code(token(node), FALSE))) {
+	x_compare(node, d);
+	x_line("set%s %%cl", cc);
+	x_line("movzbl %%cl, %%%s", R32(d));
+	return;
+    }
+
+    x_expression(node->children, d);
+    operand = x_right_operand(node->children->next, d);
+
+    switch (token(node)) {
+    case T_PLUS:
+	instruction = "addl";
+	break;
+    case T_MINUS:
+	instruction = "subl";
+	break;
+    case T_MULTIPLY:
+	instruction = "imull";
+	break;
+    case T_AND:
+	/* both operands are evaluated, as AND does */
+	instruction = "andl";
+	break;
+    case T_OR:
+	instruction = "orl";
+	break;
+    case T_DIVIDE:
+    case T_DIVIDE_UNCHECKED:
+	x_divide(d, operand, token(node) == T_DIVIDE);
+	break;
+    default:
+	g_error("Don't know how to generate x86-64 code for operator ``%s'' (%d).",
+		literals[token(node)], token(node));
+    }
+
+    if (instruction)
+	x_line("%s %s, %%%s", instruction, operand, R32(d));
+
+    g_free(operand);
+}
+
+/*
+ * Neither value of a SEL has side effects or may fail (see convert_selects()
+ * in optimization.c), so both are computed and the condition picks one with
+ * a cmov; out of registers, it jumps instead.
+ */
+static void x_select(GNode * node, gint d)
+{
+    GNode *cond = node->children, *a = cond->next, *b = a->next;
+    const gchar *cc;
+    guint otherwise, end;
+
+    if (d + 2 < N_REGISTERS) {
+	x_expression(a, d);
+	x_expression(b, d + 1);
+
+	if ((cc = x_condition_code(token(cond), TRUE))) {
+	    x_compare(cond, d + 2);
+	} else {
+	    x_expression(cond, d + 2);
+	    x_line("testl %%%s, %%%s", R32(d + 2), R32(d + 2));
+	    cc = "e";
+	}
+
+	x_line("cmov%sl %%%s, %%%s", cc, R32(d + 1), R32(d));
+	return;
+    }
+
+    otherwise = x_label_new();
+    end = x_label_new();
+
+    x_expression(cond, d);
+    x_line("testl %%%s, %%%s", R32(d), R32(d));
+    x_jump("je", otherwise);
+    x_expression(a, d);
+    x_jump("jmp", end);
+    x_label(otherwise);
+    x_expression(b, d);
+    x_label(end);
+}
+
+/* evaluates ``node'' into registers[d] */
+static void x_expression(GNode * node, gint d)
+{
+    gchar *operand;
+
+    switch (token(node)) {
+    case T_NUMBER:
+    case T_TRUE:
+    case T_FALSE:
+    case T_IDENTIFIER:
+	operand = x_operand(node);
+	if (g_str_equal(operand, "$0"))
+	    x_line("xorl %%%s, %%%s", R32(d), R32(d));
+	else
+	    x_line("movl %s, %%%s", operand, R32(d));
+	g_free(operand);
+	break;
+    case T_FUNCTION_CALL:
+	x_call(node, d);
+	break;
+    case T_NOT:
+	x_expression(node->children, d);
+	x_line("xorl $1, %%%s", R32(d));
+	break;
+    case T_UNARY_MINUS:
+	x_expression(node->children, d);
+	x_line("negl %%%s", R32(d));
+	break;
+    case T_UNARY_PLUS:
+	x_expression(node->children, d);
+	break;
+    case T_SELECT:
+	x_select(node, d);
+	break;
+    default:
+	x_binop(node, d);
+    }
+}
+
+/*
+ * Generates code that jumps to ``label'' if the condition evaluates to
+ * ``jump_if'', as generate_branch() does: comparisons jump on the flags,
+ * and "e"/"ou" become jump chains when short-circuiting is enabled.
+ */
+static void x_branch(GNode * node, guint label, gboolean jump_if)
+{
+    GNode *right;
+    const gchar *cc;
+    guint skip;
+
+    switch (token(node)) {
+    case T_NOT:
+	x_branch(node->children, label, !jump_if);
+	return;
+    case T_TRUE:
+    case T_FALSE:
+	if ((token(node) == T_TRUE) == jump_if)
+	    x_jump("jmp", label);
+	return;
+    case T_NUMBER:
+	if ((atoi(name(node)) != 0) == jump_if)
+	    x_jump("jmp", label);
+	return;
+    case T_AND:
+    case T_OR:
+	right = node->children->next;
+	if (!short_circuit || (!params.short_circuit && !codegen_can_skip(right)))
+	    break;
+
+	if (pass_enabled("short-circuit"))
+	    pass_note("short-circuit", 1);
+
+	if ((token(node) == T_AND) != jump_if) {
+	    x_branch(node->children, label, jump_if);
+	    x_branch(right, label, jump_if);
+	} else {
+	    skip = x_label_new();
+	    x_branch(node->children, skip, !jump_if);
+	    x_branch(right, label, jump_if);
+	    x_label(skip);
+	}
+	return;
+    default:
+	if ((cc = x_condition_code(token(node), !jump_if))) {
+	    x_compare(node, 0);
+	    x_line("j%s .L%d", cc, label);
+	    return;
+	}
+    }
+
+    x_expression(node, 0);
+    x_line("testl %%%s, %%%s", R32(0), R32(0));
+    x_jump(jump_if ? "jne" : "je", label);
+}
+
+/***/
+
+static void x_variables(GNode * types)
+{
+    GNode *type, *var;
+
+    for (type = types->children; type; type = type->next) {
+	for (var = type->children; var; var = var->next)
+	    x_declare(symbol_table_lookup_symbol(symbol_table, name(var)));
+    }
+}
+
+static void x_assign(XVariable * variable, GNode * expr)
+{
+    gchar *address, *operand = NULL;
+
+    if (token(expr) == T_NUMBER || token(expr) == T_TRUE || token(expr) == T_FALSE) {
+	operand = x_operand(expr);
+    } else {
+	x_expression(expr, 0);
+	operand = g_strdup_printf("%%%s", R32(0));
+    }
+
+    /* after the expression, which may use %r11 */
+    address = x_address(variable);
+    x_line("movl %s, %s", operand, address);
+
+    g_free(operand);
+    g_free(address);
+}
+
+static XVariable *x_lookup(GHashTable * table, gchar * lpd_name)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, lpd_name);
+
+    if (table == variables && !g_hash_table_lookup(variables, symbol))
+	x_declare(symbol);
+
+    return (XVariable *) g_hash_table_lookup(table, symbol);
+}
+
+static void x_if(GNode * node)
+{
+    GNode *last = g_node_last_child(node);
+    guint otherwise = x_label_new(), end;
+
+    x_branch(node->children, otherwise, FALSE);
+    x_statements(node->children->next);
+
+    if (token(last) == T_ELSE) {
+	end = x_label_new();
+	x_jump("jmp", end);
+	x_label(otherwise);
+	x_statements(last->children);
+	x_label(end);
+    } else {
+	x_label(otherwise);
+    }
+}
+
+/* loops test their condition at the bottom, after a jump to it on entry */
+static void x_while(GNode * node)
+{
+    guint body = x_label_new(), test = x_label_new();
+
+    x_jump("jmp", test);
+    x_label(body);
+    x_statements(node->children->next);
+    x_label(test);
+    x_branch(node->children, body, TRUE);
+}
+
+/* the loop variable, its start value, the condition, the step, and the body */
+static void x_for(GNode * node)
+{
+    GNode *loop_var = node->children, *cond = loop_var->next, *step = cond->next;
+    XVariable *variable = x_lookup(variables, name(loop_var));
+    guint body = x_label_new(), test = x_label_new();
+    gchar *address;
+
+    x_assign(variable, loop_var->children);
+    x_jump("jmp", test);
+    x_label(body);
+    x_statements(step->next);
+
+    /* the step is evaluated before the variable is loaded */
+    x_expression(step, 0);
+    address = x_address(variable);
+    x_line("addl %s, %%%s", address, R32(0));
+    x_line("movl %%%s, %s", R32(0), address);
+    g_free(address);
+
+    x_label(test);
+    x_branch(cond, body, TRUE);
+}
+
+static gint x_case_key(GNode * node)
+{
+    return atoi(name(node));
+}
+
+static gint x_case_compare(gconstpointer a, gconstpointer b)
+{
+    gint ka = x_case_key(*(GNode **) a), kb = x_case_key(*(GNode **) b);
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+/* compares the selector, in registers[0], with the keys in a binary search */
+static void x_switch_search(GNode ** cases, guint * case_labels, gint lo, gint hi, guint none)
+{
+    guint right;
+    gint mid;
+
+    if (lo > hi) {
+	x_jump("jmp", none);
+	return;
+    }
+
+    mid = (lo + hi) / 2;
+    right = x_label_new();
+
+    x_line("cmpl $%d, %%%s", x_case_key(cases[mid]), R32(0));
+    x_jump("je", case_labels[mid]);
+    x_jump("jg", right);
+    x_switch_search(cases, case_labels, lo, mid - 1, none);
+    x_label(right);
+    x_switch_search(cases, case_labels, mid + 1, hi, none);
+}
+
+/*
+ * Dense keys index a table of offsets in .rodata, relative to the table,
+ * so the program needs no relocations (see generate_switch() in codegen.c).
+ */
+static void x_switch(GNode * node)
+{
+    GNode *selector = node->children, *otherwise = NULL, **cases, *n;
+    guint *case_labels, none, end, table;
+    gint n_cases = 0, i, base;
+    gint64 size, key;
+
+    cases = g_new(GNode *, g_node_n_children(node));
+
+    for (n = selector->next; n; n = n->next) {
+	if (token(n) == T_CASE)
+	    cases[n_cases++] = n;
+	else
+	    otherwise = n;
+    }
+
+    qsort(cases, n_cases, sizeof(GNode *), x_case_compare);
+
+    case_labels = g_new(guint, n_cases);
+    for (i = 0; i < n_cases; i++)
+	case_labels[i] = x_label_new();
+    none = x_label_new();
+    end = x_label_new();
+
+    base = x_case_key(cases[0]);
+    size = (gint64) x_case_key(cases[n_cases - 1]) - base + 1;
+
+    x_expression(selector, 0);
+
+    if (size <= SWITCH_MAX_TABLE && size <= 2 * n_cases) {
+	table = x_label_new();
+
+	if (base)
+	    x_line("subl $%d, %%%s", base, R32(0));
+	x_line("cmpl $%d, %%%s", (gint) size - 1, R32(0));
+	x_jump("ja", none);
+	x_line("leaq .L%d(%%rip), %%rcx", table);
+	x_line("movslq (%%rcx,%%%s,4), %%rax", R64(0));
+	x_line("addq %%rcx, %%rax");
+	x_line("jmp *%%rax");
+
+	g_string_append_printf(rodata, "\t.align 4\n.L%d:\n", table);
+	for (i = 0, key = base; i < n_cases; key++) {
+	    if (key == x_case_key(cases[i]))
+		g_string_append_printf(rodata, "\t.long .L%d - .L%d\n", case_labels[i++], table);
+	    else
+		g_string_append_printf(rodata, "\t.long .L%d - .L%d\n", none, table);
+	}
+    } else {
+	x_switch_search(cases, case_labels, 0, n_cases - 1, none);
+    }
+
+    x_label(none);
+    if (otherwise)
+	x_statements(otherwise->children);
+
+    for (i = 0; i < n_cases; i++) {
+	x_jump("jmp", end);
+	x_label(case_labels[i]);
+	x_statements(cases[i]->children);
+    }
+
+    x_label(end);
+
+    g_free(cases);
+    g_free(case_labels);
+}
+
+/*
+ * A tail call pushes the new arguments, stores them into the parameters
+ * once all of them are evaluated, and jumps back to the start of the body
+ * (see eliminate_tail_calls() in optimization.c).
+ */
+static void x_tail_call(GNode * node)
+{
+    Symbol *symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    gpointer param;
+    GNode *n;
+    gchar *address;
+    gint i;
+
+    if (!function->tail)
+	function->tail = x_label_new();
+
+    for (n = node->children; n; n = n->next) {
+	x_expression(n, 0);
+	x_line("pushq %%%s", R64(0));
+    }
+
+    for (i = g_slist_length(symbol->parameters) - 1; i >= 0; i--) {
+	param = g_slist_nth_data(symbol->parameters, i);
+	address = x_address((XVariable *) g_hash_table_lookup(variables, param));
+	x_line("popq %%rax");
+	x_line("movl %%eax, %s", address);
+	g_free(address);
+    }
+
+    x_jump("jmp", function->tail);
+}
+
+static XFunction *x_function_new(gint depth)
+{
+    XFunction *f = g_new0(XFunction, 1);
+
+    f->code = g_string_new(NULL);
+    f->depth = depth;
+
+    return f;
+}
+
+static void x_function_free(XFunction * f)
+{
+    g_string_free(f->code, TRUE);
+    g_free(f);
+}
+
+static void x_subprogram(GNode * node, gboolean procedure)
+{
+    XFunction *outer = function;
+    XProcedure *p;
+    XVariable *variable, *result = NULL;
+    CallGraphNode *cg_node;
+    Symbol *symbol;
+    GSList *l;
+    gint n_params, i;
+
+    symbol = symbol_table_lookup_symbol(symbol_table, name(node));
+    cg_node = callgraph_lookup(callgraph, symbol);
+
+    /* as in the object, procedures nothing calls are left out */
+    if (cg_node && !cg_node->reachable && pass_enabled("dead-procedures"))
+	return;
+
+    p = g_new0(XProcedure, 1);
+    p->label = x_name_new(symbol, procedure ? "p_" : "f_");
+    p->depth = outer->depth + 1;
+    g_hash_table_insert(procedures, symbol, p);
+
+    function = x_function_new(p->depth);
+
+    symbol_table_context_enter(symbol_table, name(node));
+
+    /* the last argument is pushed last, right above the static link */
+    n_params = g_slist_length(symbol->parameters);
+    for (l = symbol->parameters, i = 0; l; l = l->next, i++) {
+	variable = g_new0(XVariable, 1);
+	variable->depth = p->depth;
+	variable->offset = (p->depth > 1 ? 24 : 16) + 8 * (n_params - 1 - i);
+	g_hash_table_insert(variables, l->data, variable);
+    }
+
+    if (!procedure) {
+	result = x_local_new(symbol);
+	g_hash_table_insert(results, symbol, result);
+    }
+
+    x_statements(node->children);
+
+    symbol_table_context_leave(symbol_table);
+
+    g_string_append_printf(text, "\n%s:\n", p->label);
+    g_string_append(text, "\tpushq %rbp\n\tmovq %rsp, %rbp\n");
+    if (function->slots)
+	g_string_append_printf(text, "\tsubq $%d, %%rsp\n", 8 * function->slots);
+    if (function->tail)
+	g_string_append_printf(text, ".L%d:\n", function->tail);
+
+    g_string_append(text, function->code->str);
+
+    if (!procedure)
+	g_string_append_printf(text, "\tmovl %d(%%rbp), %%eax\n", result->offset);
+    g_string_append(text, "\tleave\n\tret\n");
+
+    x_function_free(function);
+    function = outer;
+}
+
+static void x_statement(GNode * node)
+{
+    gchar *address;
+
+    switch (token(node)) {
+    case T_VAR:
+	x_variables(node);
+	break;
+    case T_PROCEDURE:
+	x_subprogram(node, TRUE);
+	break;
+    case T_FUNCTION:
+	x_subprogram(node, FALSE);
+	break;
+    case T_MAIN_BEGIN:
+	break;
+    case T_ATTRIB:
+	x_assign(x_lookup(variables, name(node)), node->children);
+	break;
+    case T_FUNCTION_RETURN:
+	x_assign(x_lookup(results, name(node)), node->children);
+	break;
+    case T_READ:
+	x_line("call csd_read");
+	address = x_variable(name(node));
+	x_line("movl %%eax, %s", address);
+	g_free(address);
+	break;
+    case T_WRITE:
+	address = x_variable(name(node));
+	x_line("movl %s, %%eax", address);
+	x_line("call csd_write");
+	g_free(address);
+	break;
+    case T_PROCEDURE_CALL:
+	x_call(node, 0);
+	break;
+    case T_TAIL_CALL:
+	x_tail_call(node);
+	break;
+    case T_IF:
+	x_if(node);
+	break;
+    case T_WHILE:
+	x_while(node);
+	break;
+    case T_FOR:
+	x_for(node);
+	break;
+    case T_SWITCH:
+	x_switch(node);
+	break;
+    default:
+	g_error("Houston, we have a problem! Don't know how to "
+		"generate x86-64 code for node type ``%s'' (%d).",
+		literals[token(node)], token(node));
+    }
+}
+
+static void x_statements(GNode * nodes)
+{
+    GNode *n;
+
+    for (n = nodes; n && token(n) != T_ELSE; n = n->next)
+	x_statement(n);
+}
+
+void codegen_x86_64(GNode * root)
+{
+    callgraph = callgraph_new(root);
+    symbol_table_context_reset(symbol_table);
+
+    variables = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+				      (GDestroyNotify) x_variable_free);
+    results = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+				    (GDestroyNotify) x_variable_free);
+    procedures = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+				       (GDestroyNotify) x_procedure_free);
+    used_names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    text = g_string_new(NULL);
+    rodata = g_string_new(NULL);
+    bss = g_string_new(NULL);
+    labels = 0;
+    short_circuit = pass_enabled("short-circuit") || params.short_circuit;
+
+    function = x_function_new(0);
+    x_statements(root->children);
+
+    compiler_write("# %s, compiled by csd\n"
+		   "# build with: as -o prog.o prog.s && ld -o prog prog.o\n"
+		   "\n\t.text\n\t.globl _start\n%s\n_start:\n%s"
+		   "\txorl %%edi, %%edi\n\tjmp csd_exit\n%s"
+		   "\n\t.section .rodata\n%s%s"
+		   "\n\t.bss\n%s%s"
+		   "\n\t.section .note.GNU-stack,\"\",@progbits\n",
+		   params.input_file, text->str, function->code->str, runtime,
+		   runtime_rodata, rodata->str, runtime_bss, bss->str);
+
+    x_function_free(function);
+    function = NULL;
+
+    g_string_free(text, TRUE);
+    g_string_free(rodata, TRUE);
+    g_string_free(bss, TRUE);
+    g_hash_table_destroy(variables);
+    g_hash_table_destroy(results);
+    g_hash_table_destroy(procedures);
+    g_hash_table_destroy(used_names);
+
+    callgraph_free(callgraph);
+    callgraph = NULL;
+}
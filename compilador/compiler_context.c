@@ -0,0 +1,352 @@
+/*
+ * Simple Pascal Compiler
+ * Compiler Context
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <glib.h>
+
+#include "lex.h"
+#include "ast.h"
+#include "codegen.h"
+#include "optimization.h"
+#include "callgraph.h"
+#include "passes.h"
+#include "profile.h"
+
+#include "compiler_context.h"
+
+/* this is about contexts themselves, not only the current one */
+#undef params
+#undef symbol_table
+#undef passes
+#undef profile
+#undef modref
+#undef cse_stats
+#undef range_stats
+#undef codegen_stats
+
+PER_THREAD CompilerContext *compiler_context = NULL;
+
+static const struct {
+	const gchar	*name;
+	void		(*codegen)(GNode *root);
+} targets[] = {
+	{ "mvd",	codegen },
+	{ "c",		codegen_c },
+	{ "x86_64",	codegen_x86_64 },
+	{ "llvm",	codegen_llvm },
+	{ NULL }
+};
+
+static void
+default_write_function(gpointer data, const gchar *string)
+{
+	fputs(string, stdout);
+}
+
+/*
+ * Creates a context to compile the program read from ``input'' with the
+ * parameters ``p''. What the compiler outputs goes to ``write_function'',
+ * or to the standard output if it's NULL.
+ */
+CompilerContext *
+compiler_context_new(const CompilerParams *p, FILE *input,
+		     CompilerWriteFunction write_function,
+		     gpointer write_function_data)
+{
+	CompilerContext *ctx;
+
+	ctx = g_new0(CompilerContext, 1);
+	ctx->params = *p;
+	ctx->input = input;
+	ctx->line = ctx->column = 1;
+
+	ctx->allocations = g_ptr_array_new();
+	ctx->token_lists = g_ptr_array_new();
+
+	ctx->passes = passes_new();
+	ctx->range_stats = g_new0(RangeStats, 1);
+	ctx->codegen_stats = g_new0(CodegenStats, 1);
+
+	ctx->write_function = write_function ? write_function : default_write_function;
+	ctx->write_function_data = write_function_data;
+
+	return ctx;
+}
+
+void
+compiler_context_free(CompilerContext *ctx)
+{
+	GSList *l;
+	guint i;
+
+	for (l = ctx->diagnostics; l; l = l->next) {
+		CompilerDiagnostic *diagnostic = (CompilerDiagnostic *)l->data;
+
+		g_free(diagnostic->near);
+		g_free(diagnostic->message);
+		g_free(diagnostic);
+	}
+	g_slist_free(ctx->diagnostics);
+
+	/* a compilation that stopped in ast() left the nodes it made loose */
+	if (ctx->parsing) {
+		for (i = 0; i < ctx->parsing->len; i++) {
+			GNode *node = (GNode *)g_ptr_array_index(ctx->parsing, i);
+
+			node->parent = node->children = node->next = node->prev = NULL;
+			g_node_destroy(node);
+		}
+		g_ptr_array_free(ctx->parsing, TRUE);
+	}
+	if (ctx->ast)
+		g_node_destroy(ctx->ast);
+
+	for (i = 0; i < ctx->token_lists->len; i++) {
+		TokenList *tl = (TokenList *)g_ptr_array_index(ctx->token_lists, i);
+
+		g_list_free(tl->tokens);
+		g_free(tl);
+	}
+	g_ptr_array_free(ctx->token_lists, TRUE);
+
+	for (i = 0; i < ctx->allocations->len; i++)
+		g_free(g_ptr_array_index(ctx->allocations, i));
+	g_ptr_array_free(ctx->allocations, TRUE);
+
+	if (ctx->funcproc_names)
+		stack_free(ctx->funcproc_names);
+	if (ctx->expressions) {
+		Stack *stack;
+
+		while ((stack = (Stack *)stack_pop(ctx->expressions)))
+			stack_free(stack);
+		stack_free(ctx->expressions);
+	}
+	if (ctx->symbol_table)
+		symbol_table_free(ctx->symbol_table);
+	if (ctx->modref)
+		callgraph_free(ctx->modref);
+	if (ctx->profile)
+		profile_free(ctx->profile);
+
+	passes_free(ctx->passes);
+
+	for (l = ctx->cse_stats; l; l = l->next)
+		g_free(l->data);
+	g_slist_free(ctx->cse_stats);
+	g_free(ctx->range_stats);
+
+	for (l = ctx->codegen_stats->stack_depths; l; l = l->next)
+		g_free(l->data);
+	g_slist_free(ctx->codegen_stats->stack_depths);
+	g_slist_free(ctx->codegen_stats->removed);
+	g_free(ctx->codegen_stats);
+
+	g_slist_free(ctx->char_buf);
+	g_free(ctx);
+}
+
+/*
+ * Calls ``function'' with ``ctx'' as the context of the calling thread. If
+ * the compiler finds an error, the diagnostic is added to the context and
+ * this returns 1 right away; otherwise, it returns what ``function'' did.
+ */
+gint
+compiler_context_run(CompilerContext *ctx, CompilerFunction function, gpointer data)
+{
+	CompilerContext *outer = compiler_context;
+	gint result;
+
+	compiler_context = ctx;
+
+	if (setjmp(ctx->abort) == 0)
+		result = function(data);
+	else
+		result = 1;
+
+	compiler_context = outer;
+
+	return result;
+}
+
+static gint
+compile(gpointer data)
+{
+	CompilerContext *ctx = compiler_context;
+	TokenList      *token_list;
+	GSList	       *toggles = ctx->params.pass_toggles;
+	const gchar    *unknown;
+	gint		target = 0;
+
+	if (ctx->params.output_format) {
+		while (targets[target].name &&
+		       !g_str_equal(targets[target].name, ctx->params.output_format))
+			target++;
+
+		if (!targets[target].name)
+			compiler_error(0, 0, NULL, "unknown target ``%s''", ctx->params.output_format);
+
+		if (ctx->vm && target)
+			compiler_error(0, 0, NULL, "can't run code generated for ``%s''",
+				       ctx->params.output_format);
+	}
+
+	if (ctx->profile) {
+		profile_free(ctx->profile);
+		ctx->profile = NULL;
+	}
+
+	if (ctx->params.profile_use) {
+		if (!(ctx->profile = profile_load(ctx->params.profile_use)))
+			compiler_error(0, 0, NULL, "can't open profile ``%s''", ctx->params.profile_use);
+
+		/* before the toggles, so -fno-profile-layout still works */
+		toggles = g_slist_prepend(toggles, "profile-layout");
+	}
+
+	unknown = passes_setup(ctx->params.optimization_level, toggles);
+	if (toggles != ctx->params.pass_toggles)
+		g_slist_free_1(toggles);
+
+	if (unknown)
+		compiler_error(0, 0, NULL, "unknown optimization pass ``%s''", unknown);
+
+	gettimeofday(&ctx->tv_start, NULL);
+
+	token_list = lex();
+	gettimeofday(&ctx->tv_lex, NULL);
+
+	ast(token_list);
+	gettimeofday(&ctx->tv_ast, NULL);
+
+	passes_run(ctx->ast);
+	gettimeofday(&ctx->tv_opt, NULL);
+
+	if (ctx->params.dump_callgraph || ctx->params.dump_modref) {
+		CallGraph *cg = callgraph_new(ctx->ast);
+
+		if (ctx->params.dump_modref) {
+			callgraph_dump_modref(cg);
+		} else {
+			if (pass_enabled("static-frames"))
+				callgraph_layout_frames(cg);
+
+			callgraph_dump(cg);
+		}
+
+		callgraph_free(cg);
+	} else if (ctx->vm) {
+		codegen_vm(ctx->ast, ctx->vm);
+	} else {
+		targets[target].codegen(ctx->ast);
+	}
+	gettimeofday(&ctx->tv_codegen, NULL);
+
+	tl_destroy(token_list);
+
+	return 0;
+}
+
+/*
+ * Compiles the program of ``ctx'', writing the object to its sink (or, if
+ * it has a VM, generating it there). Returns FALSE if the program has
+ * errors, or the parameters are wrong; the reason is in ctx->diagnostics.
+ */
+gboolean
+compiler_context_compile(CompilerContext *ctx)
+{
+	return compiler_context_run(ctx, compile, NULL) == 0;
+}
+
+/*
+ * Allocates ``size'' bytes, zeroed, that belong to the current context: they
+ * are freed along with it, however far the compilation went.
+ */
+gpointer
+compiler_alloc(gsize size)
+{
+	gpointer memory = g_malloc0(size);
+
+	g_ptr_array_add(compiler_context->allocations, memory);
+
+	return memory;
+}
+
+gchar *
+compiler_strdup(const gchar *string)
+{
+	gchar *copy = g_strdup(string);
+
+	g_ptr_array_add(compiler_context->allocations, copy);
+
+	return copy;
+}
+
+/*
+ * Writes to the sink of the current context, printf()-style.
+ */
+void
+compiler_write(const gchar *format, ...)
+{
+	gchar *string;
+	va_list args;
+
+	va_start(args, format);
+	string = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	compiler_context->write_function(compiler_context->write_function_data, string);
+
+	g_free(string);
+}
+
+/*
+ * Stops compiling, with a diagnostic at ``line'' and ``column'' of the source
+ * (both 0 if it's not about the source), next to the token ``near'' if it's
+ * known.
+ */
+void
+compiler_error(gint line, gint column, const gchar *near, const gchar *format, ...)
+{
+	CompilerDiagnostic *diagnostic;
+	va_list args;
+
+	diagnostic = g_new0(CompilerDiagnostic, 1);
+	diagnostic->line = line;
+	diagnostic->column = column;
+	diagnostic->near = g_strdup(near);
+
+	va_start(args, format);
+	diagnostic->message = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	compiler_context->diagnostics = g_slist_append(compiler_context->diagnostics,
+						       diagnostic);
+
+	longjmp(compiler_context->abort, 1);
+}
+
+/*
+ * The diagnostic as the compiler has always shown it (with markup the GUI
+ * understands, if it's about the source).
+ */
+gchar *
+compiler_diagnostic_message(CompilerDiagnostic *diagnostic)
+{
+	if (!diagnostic->line)
+		return g_strdup(diagnostic->message);
+
+	if (diagnostic->near)
+		return g_strdup_printf("Erro: ln <b>%d</b>, col <b>%d</b>, próximo a <b>%s </b>\342\206\222 %s",
+				       diagnostic->line, diagnostic->column,
+				       diagnostic->near, diagnostic->message);
+
+	return g_strdup_printf("Erro: ln <b>%d</b>, col <b>%d</b> \342\206\222 %s",
+			       diagnostic->line, diagnostic->column, diagnostic->message);
+}
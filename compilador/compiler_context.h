@@ -0,0 +1,148 @@
+/*
+ * Simple Pascal Compiler
+ * Compiler Context
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ */
+#ifndef __COMPILER_CONTEXT_H__
+#define __COMPILER_CONTEXT_H__
+
+#include <glib.h>
+#include <stdio.h>
+#include <setjmp.h>
+#include <sys/time.h>
+
+#include "symbol-table.h"
+#include "stack.h"
+#include "vm.h"
+
+/*
+ * Scratch state that lives only while a pass or a backend runs, and that's
+ * set up again every time, is kept per thread: each thread compiles with its
+ * own context (see compiler_context_run()), so many can compile at once.
+ * Anything kept from one step of the compilation to another, or read after
+ * it, is in the context.
+ */
+#define PER_THREAD	__thread
+
+typedef struct _CompilerParams		CompilerParams;
+typedef struct _CompilerContext		CompilerContext;
+typedef struct _CompilerDiagnostic	CompilerDiagnostic;
+
+typedef void	(*CompilerWriteFunction)	(gpointer data, const gchar *string);
+typedef gint	(*CompilerFunction)		(gpointer data);
+
+struct _CompilerParams {
+	gboolean test_parser,
+		 test_ast,
+		 test_st,
+		 show_time,
+		 viagem_do_freitas,
+		 short_circuit,
+		 dump_callgraph,
+		 dump_modref,
+		 list_passes,
+		 run;
+	gint	 optimization_level;
+	GSList	*pass_toggles;		/* -f<pass> and -fno-<pass>, in order */
+	gchar	*input_file,
+		*output_format,
+		*profile_use,
+		*autotune;		/* the input data to tune for */
+};
+
+struct _CompilerDiagnostic {
+	gint	 line, column;		/* 0 if it's not about the source */
+	gchar	*near;			/* the token it was found at, if any */
+	gchar	*message;
+};
+
+struct _CompilerContext {
+	CompilerParams	 params;
+
+	/* the source, and what was pushed back of it (see charbuf.c) */
+	FILE		*input;
+	GSList		*char_buf;
+
+	/* where the lexer is (see lex.c) */
+	gint		 line, column;
+	gboolean	 in_block;		/* the program's block was matched */
+
+	/* semantic analysis (see ast.c) */
+	SymbolTable	*symbol_table;
+	Stack		*funcproc_names;
+	Stack		*expressions;		/* the Stack *s ast_expression() uses */
+
+	/*
+	 * What lex() and ast() made is the context's, and is freed with it,
+	 * whether the program compiled or not (see compiler_alloc())
+	 */
+	GPtrArray	*allocations;
+	GPtrArray	*token_lists;		/* TokenList *, destroyed or not */
+	GPtrArray	*parsing;		/* GNode * ast() made, until it returns */
+	GNode		*ast;			/* once it has */
+
+	/* the passes, set up for this compilation (see passes.c) */
+	struct _Pass	*passes;
+
+	/* the profile from --profile-use, if given (see profile.c) */
+	struct _Profile	*profile;
+
+	/* temporaries the optimizer made (see optimization.c) */
+	guint		 temp_count;
+
+	/* who reads and writes what, while the passes run (see modref_update()) */
+	struct _CallGraph *modref;
+
+	/* what the optimizer and the code generator did, for csd -t */
+	GSList		*cse_stats;		/* CSEStats *, one for each procedure */
+	struct _RangeStats *range_stats;
+	struct _CodegenStats *codegen_stats;
+
+	/* code generation (see codegen.c) */
+	guint		 label_value;
+	gint		 available_address;
+	gboolean	 has_procedure_or_function;
+
+	/* gets the object instead of the sink, if set (see codegen_vm()) */
+	VM		*vm;
+
+	CompilerWriteFunction write_function;
+	gpointer	 write_function_data;
+
+	GSList		*diagnostics;		/* CompilerDiagnostic *, in order */
+	jmp_buf		 abort;			/* see compiler_error() */
+
+	/* when each step ended, see compiler_context_compile() */
+	struct timeval	 tv_start, tv_lex, tv_ast, tv_opt, tv_codegen;
+};
+
+extern PER_THREAD CompilerContext *compiler_context;
+
+/* what the compiler is working with is the current context's */
+#define params		(compiler_context->params)
+#define symbol_table	(compiler_context->symbol_table)
+#define passes		(compiler_context->passes)
+#define profile		(compiler_context->profile)
+#define modref		(compiler_context->modref)
+#define cse_stats	(compiler_context->cse_stats)
+#define range_stats	(*compiler_context->range_stats)
+#define codegen_stats	(*compiler_context->codegen_stats)
+
+CompilerContext	*compiler_context_new(const CompilerParams *p, FILE *input,
+				      CompilerWriteFunction write_function,
+				      gpointer write_function_data);
+void		 compiler_context_free(CompilerContext *ctx);
+gint		 compiler_context_run(CompilerContext *ctx, CompilerFunction function,
+				      gpointer data);
+gboolean	 compiler_context_compile(CompilerContext *ctx);
+
+gpointer	 compiler_alloc(gsize size);
+gchar		*compiler_strdup(const gchar *string);
+
+void		 compiler_write(const gchar *format, ...) G_GNUC_PRINTF(1, 2);
+void		 compiler_error(gint line, gint column, const gchar *near,
+				const gchar *format, ...) G_GNUC_PRINTF(4, 5) G_GNUC_NORETURN;
+gchar		*compiler_diagnostic_message(CompilerDiagnostic *diagnostic);
+
+#endif	/* __COMPILER_CONTEXT_H__ */
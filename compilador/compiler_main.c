@@ -22,186 +22,501 @@
 #include "stack.h"
 
 #include "optimization.h"
+#include "callgraph.h"
+#include "passes.h"
+#include "profile.h"
+#include "autotune.h"
+#include "vm.h"
 
 #include "compiler_main.h"
 
 #define CALCTIME(start,end) 	((end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1e6))
 #define CALCPERC(t)		(t * 100.0f) / time_total
 
-CompilerParams params;
+static CompilerParams options;		/* from the command line */
 static GOptionEntry cmdline_options[] = {
 	{
 		.long_name = "pretty-print",
 		.short_name = 'P',
 		.arg = G_OPTION_ARG_NONE,
-		.arg_data = &params.test_parser,
+		.arg_data = &options.test_parser,
 		.description = "Pretty-print the input file (requires ANSI term.)"
 	},
 	{
 		.long_name = "generate-dot-ast",
 		.short_name = 'A',
 		.arg = G_OPTION_ARG_NONE,
-		.arg_data = &params.test_ast,
+		.arg_data = &options.test_ast,
 		.description = "Outputs a DOT-file with the AST"
 	},
 	{
 		.long_name = "print-symbol-table",
 		.short_name = 'S',
 		.arg = G_OPTION_ARG_NONE,
-		.arg_data = &params.test_st,
+		.arg_data = &options.test_st,
 		.description = "Prints the symbol table"
 	},
 	{
 		.long_name = "optimization-level",
 		.short_name = 'O',
 		.arg = G_OPTION_ARG_INT,
-		.arg_data = &params.optimization_level,
+		.arg_data = &options.optimization_level,
 		.description = "Sets the Optimization level (0-3)"
 	},
 	{
 		.long_name = "show-time",
 		.short_name = 't',
 		.arg = G_OPTION_ARG_NONE,
-		.arg_data = &params.show_time,
+		.arg_data = &options.show_time,
 		.description = "Show time taken by all steps"
 	},
 	{
 		.long_name = "viagem-do-freitas",
 		.short_name = 'v',
 		.arg = G_OPTION_ARG_NONE,
-		.arg_data = &params.viagem_do_freitas,
+		.arg_data = &options.viagem_do_freitas,
 		.description = "Habilita as viagens do Freitas"
 	},
+	{
+		.long_name = "short-circuit",
+		.short_name = 'c',
+		.arg = G_OPTION_ARG_NONE,
+		.arg_data = &options.short_circuit,
+		.description = "Always short-circuit \"e\" and \"ou\" in conditions"
+	},
+	{
+		.long_name = "dump-callgraph",
+		.short_name = 'G',
+		.arg = G_OPTION_ARG_NONE,
+		.arg_data = &options.dump_callgraph,
+		.description = "Outputs a DOT-file with the call graph, after optimization"
+	},
+	{
+		.long_name = "dump-modref",
+		.short_name = 'M',
+		.arg = G_OPTION_ARG_NONE,
+		.arg_data = &options.dump_modref,
+		.description = "Lists the non-local variables each procedure may modify or reference"
+	},
+	{
+		.long_name = "list-passes",
+		.arg = G_OPTION_ARG_NONE,
+		.arg_data = &options.list_passes,
+		.description = "Lists the optimization passes (enable or disable them with -f<pass> or -fno-<pass>)"
+	},
+	{
+		.long_name = "profile-use",
+		.arg = G_OPTION_ARG_FILENAME,
+		.arg_data = &options.profile_use,
+		.description = "Lays out the code as the execution profile written by mvd --profile says it runs",
+		.arg_description = "FILE"
+	},
+	{
+		.long_name = "target",
+		.arg = G_OPTION_ARG_STRING,
+		.arg_data = &options.output_format,
+		.description = "Generates code for TARGET: mvd (the default), c, x86_64 or llvm",
+		.arg_description = "TARGET"
+	},
+	{
+		.long_name = "autotune",
+		.arg = G_OPTION_ARG_FILENAME,
+		.arg_data = &options.autotune,
+		.description = "Picks the passes that make the program execute the fewest instructions when reading DATA",
+		.arg_description = "DATA"
+	},
+	{
+		.long_name = "run",
+		.arg = G_OPTION_ARG_NONE,
+		.arg_data = &options.run,
+		.description = "Runs the program right away, generating its code into the virtual machine"
+	},
 	{ NULL }
 };
 
-static int compiler_do(void)
+/*
+ * Reports the procedures left out of the object because they can't be
+ * reached from the main program, and how many bytes of object code this
+ * saved (also as a percentage of what the object would otherwise take).
+ */
+static void show_removed_procedures(void)
+{
+	GString *names;
+	GSList *l;
+	gint total;
+
+	names = g_string_new(NULL);
+	for (l = codegen_stats.removed; l; l = l->next)
+		g_string_append_printf(names, l == codegen_stats.removed ? "%s" : ", %s",
+				       (gchar *)l->data);
+
+	total = codegen_stats.object_size + codegen_stats.removed_size;
+
+	fprintf(stderr, "Procedimentos removidos (%s)|-%d bytes|%f\n",
+		codegen_stats.removed ? names->str : "nenhum",
+		codegen_stats.removed_size,
+		total ? (codegen_stats.removed_size * 100.0f) / total : 0.0f);
+
+	g_string_free(names, TRUE);
+}
+
+/*
+ * Reports, for each procedure, how many expressions are no longer computed
+ * because a value already computed was reused, and by how much this made
+ * its statements shorter.
+ */
+static void show_common_subexpressions(void)
+{
+	GSList *l;
+
+	for (l = cse_stats; l; l = l->next) {
+		CSEStats *stats = (CSEStats *)l->data;
+
+		if (!stats->eliminated)
+			continue;
+
+		fprintf(stderr, "Subexpressões comuns em %s|%d eliminadas|%f\n",
+			stats->name, stats->eliminated,
+			stats->size ? (stats->saved * 100.0f) / stats->size : 0.0f);
+	}
+}
+
+/*
+ * Reports how many divisions are generated without testing for a zero
+ * divisor, out of all of them.
+ */
+static void show_division_checks(void)
+{
+	fprintf(stderr, "Divisões sem teste de divisor zero|%d de %d|%f\n",
+		range_stats.unchecked, range_stats.divisions,
+		range_stats.divisions ?
+		(range_stats.unchecked * 100.0f) / range_stats.divisions : 0.0f);
+}
+
+/*
+ * Reports the time each pass of ``kind'' took, how many AST nodes there were
+ * before and after it, and how many transformations it made. IR passes run
+ * during code generation, so only the latter is known.
+ */
+static void show_passes(PassKind kind, gdouble time_total)
+{
+	Pass *pass;
+
+	for (pass = passes; pass->name; pass++) {
+		if (pass->kind != kind || !pass->enabled)
+			continue;
+
+		if (kind == PASS_AST) {
+			fprintf(stderr, "    %s|%fs, %d → %d nós, %d alterações|%f\n",
+				pass->description, pass->time,
+				pass->nodes_before, pass->nodes_after, pass->changes,
+				time_total ? (pass->time * 100.0f) / time_total : 0.0f);
+		} else {
+			fprintf(stderr, "    %s|%d alterações|%f\n",
+				pass->description, pass->changes, 0.0f);
+		}
+	}
+}
+
+static void list_passes(void)
+{
+	Pass *table = passes_new(), *pass;
+
+	for (pass = table; pass->name; pass++) {
+		if (pass->level)
+			g_print("%-18s -O%d  ", pass->name, pass->level);
+		else
+			g_print("%-18s       ", pass->name);
+
+		g_print("%s  %s\n", pass->kind == PASS_AST ? "AST" : "IR ",
+			pass->description);
+	}
+
+	passes_free(table);
+}
+
+/*
+ * Reports how many of the labels the code generator looked up the profile
+ * doesn't have: if any, it was taken from another program, or from this
+ * one compiled with other options, and the layout is only partly guided.
+ */
+static void show_profile(void)
+{
+	fprintf(stderr, "Perfil de execução (%s)|%d rótulos sem dados|%f\n",
+		options.profile_use, profile->missing, 0.0f);
+}
+
+/*
+ * Reports the peak depth of the operand stack while evaluating the
+ * expressions of each procedure, and what it would be without reordering
+ * the operands (the percentage is how much less is needed).
+ */
+static void show_stack_depths(void)
+{
+	GSList *l;
+
+	for (l = codegen_stats.stack_depths; l; l = l->next) {
+		StackDepth *sd = (StackDepth *)l->data;
+
+		fprintf(stderr, "Pilha de operandos em %s|%d células (%d sem reordenar)|%f\n",
+			sd->name, sd->depth, sd->left_to_right,
+			sd->left_to_right ?
+			((sd->left_to_right - sd->depth) * 100.0f) / sd->left_to_right : 0.0f);
+	}
+}
+
+/*
+ * The program run with --run reads its input from ours, and writes its
+ * output to ours, one value per line.
+ */
+static gchar *run_read(gpointer data)
+{
+	static gchar buffer[128];
+
+	if (!fgets(buffer, sizeof(buffer), stdin))
+		buffer[0] = '\0';
+
+	return buffer;
+}
+
+static void run_write(gpointer data, gchar *string)
+{
+	printf("%s\n", string);
+}
+
+/*
+ * Diagnostics are shown as they always were, on the standard output (it's
+ * where the GUI looks for them).
+ */
+static void show_diagnostics(CompilerContext *ctx)
 {
-	GNode          *root;
-	TokenList      *token_list;
-	struct timeval	tv_start, tv_lex, tv_ast, tv_codegen, tv_opt;
+	GSList *l;
+
+	for (l = ctx->diagnostics; l; l = l->next) {
+		gchar *message = compiler_diagnostic_message((CompilerDiagnostic *)l->data);
+
+		g_print("%s\n", message);
+		g_free(message);
+	}
+}
+
+/*
+ * How long the program compiled with --run took, see compiler_do().
+ */
+typedef struct {
+	struct timeval	tv_first, tv_run;
+	guint		steps;
+} RunTimes;
+
+/*
+ * Shows the time taken by each step, and what the passes did; it reads
+ * what the compilation left in the context, so it runs in it too.
+ */
+static gint show_times(gpointer data)
+{
+	CompilerContext *ctx = compiler_context;
+	RunTimes	*run = (RunTimes *)data;
 	gdouble		time_lex, time_ast, time_codegen, time_total, time_opt;
 	gdouble		p_lex, p_ast, p_codegen, p_total, p_opt = 0.0;
+
+	time_lex = CALCTIME(ctx->tv_start, ctx->tv_lex);
+	time_ast = CALCTIME(ctx->tv_lex, ctx->tv_ast);
+	time_opt = CALCTIME(ctx->tv_ast, ctx->tv_opt);
+	time_codegen = CALCTIME(ctx->tv_opt, ctx->tv_codegen);
 	
-	gettimeofday(&tv_start, NULL);
-	
-	token_list = lex();
-	gettimeofday(&tv_lex, NULL);
+	time_total = time_lex + time_ast + time_codegen + time_opt;
 
-	root = ast(token_list);
-	gettimeofday(&tv_ast, NULL);
+	p_lex = CALCPERC(time_lex);
+	p_ast = CALCPERC(time_ast);
+	p_codegen = CALCPERC(time_codegen);
+	p_opt = CALCPERC(time_opt);
+
+	p_total = p_lex + p_ast + p_codegen + p_opt;
 	
-	if (params.optimization_level & 1) {
-		optimize(root);
-		gettimeofday(&tv_opt, NULL);
+	fprintf(stderr, "Análise Léxica e Sintática|%fs|%0f\n", time_lex, p_lex);
+	fprintf(stderr, "Análise Semântica|%fs|%f\n", time_ast, p_ast);
+
+	if (passes_enabled(PASS_AST)) {
+		fprintf(stderr, "Otimização|%fs|%0f\n", time_opt, p_opt);
+		show_passes(PASS_AST, time_total);
 	}
 
-	codegen(root);
-	gettimeofday(&tv_codegen, NULL);
-	
-	tl_destroy(token_list);
-	
-	if (params.show_time) {
-		time_lex = CALCTIME(tv_start, tv_lex);
-		time_ast = CALCTIME(tv_lex, tv_ast);
-		
-		if (params.optimization_level & 1) {
-			time_opt = CALCTIME(tv_ast, tv_opt);
-			time_codegen = CALCTIME(tv_opt, tv_codegen);
-		} else {
-			time_opt = 0.0f;
-			time_codegen = CALCTIME(tv_ast, tv_codegen);
-		}
-		
-		time_total = time_lex + time_ast + time_codegen + time_opt;
+	fprintf(stderr, "Geração de Código|%fs|%f\n", time_codegen, p_codegen);
+	show_passes(PASS_IR, time_total);
 
-		p_lex = CALCPERC(time_lex);
-		p_ast = CALCPERC(time_ast);
-		p_codegen = CALCPERC(time_codegen);
+	fprintf(stderr, "Total|%fs|%f\n", time_total, p_total);
 
-		p_total = p_lex + p_ast + p_codegen;
-		
-		if (params.optimization_level & 1) {
-			p_opt = CALCPERC(time_opt);
-			p_total += p_opt;
-		}
-		
-		fprintf(stderr, "Análise Léxica e Sintática|%fs|%0f\n", time_lex, p_lex);
-		fprintf(stderr, "Análise Semântica|%fs|%f\n", time_ast, p_ast);
+	if (ctx->vm) {
+		fprintf(stderr, "Tempo até a primeira instrução|%fs|%f\n",
+			CALCTIME(ctx->tv_start, run->tv_first), 0.0f);
+		fprintf(stderr, "Execução|%fs, %u instruções|%f\n",
+			CALCTIME(run->tv_first, run->tv_run), run->steps, 0.0f);
+	}
 
-		if (params.optimization_level & 1)
-			fprintf(stderr, "Otimização|%fs|%0f\n", time_opt, p_opt);
-	
-		fprintf(stderr, "Geração de Código|%fs|%f\n", time_codegen, p_codegen);
+	show_stack_depths();
+
+	if (pass_enabled("cse"))
+		show_common_subexpressions();
+	if (pass_enabled("division-checks"))
+		show_division_checks();
+	if (pass_enabled("dead-procedures"))
+		show_removed_procedures();
+	if (profile && pass_enabled("profile-layout"))
+		show_profile();
+
+	return 0;
+}
+
+static int compiler_do(CompilerContext *ctx)
+{
+	RunTimes	run = { .steps = 0 };
+	int		status = 0;
+
+	if (options.run)
+		ctx->vm = vm_new(run_read, NULL, run_write, NULL);
+
+	if (!compiler_context_compile(ctx)) {
+		show_diagnostics(ctx);
+		status = 1;
+		goto out;
+	}
+
+	if (options.dump_callgraph || options.dump_modref)
+		goto out;
+
+	if (ctx->vm) {
+		VM *vm = ctx->vm;
+
+		vm->running = TRUE;
+
+		gettimeofday(&run.tv_first, NULL);
+		for (; vm->running && vm->instruction_pointer; run.steps++)
+			vm_step(vm);
+		gettimeofday(&run.tv_run, NULL);
 
-		fprintf(stderr, "Total|%fs|%f\n", time_total, p_total);
+		fflush(stdout);
 	}
+	
+	if (options.show_time)
+		compiler_context_run(ctx, show_times, &run);
+
+out:
+	if (ctx->vm)
+		vm_destroy(ctx->vm);
 		
-	return 0;
+	return status;
+}
+
+/*
+ * What csd can do other than compiling; it goes through the compiler all
+ * the same, so it runs in the context too. The autotuner's report is
+ * appended to ``data'', a GString.
+ */
+static gint compiler_other(gpointer data)
+{
+	if (params.test_parser)
+		return lex_test_main(0, NULL);
+	if (params.test_ast)
+		return ast_test_main(0, NULL);
+	if (params.test_st)
+		return symbol_table_test_main(0, NULL);
+
+	return autotune(params.autotune, (GString *)data);
+}
+
+static FILE *open_input(const gchar *input_file)
+{
+	if (g_str_equal(input_file, "-"))
+		return stdin;
+
+	return fopen(input_file, "r");
 }
 
 int
 compiler_compile_with_parameters(CompilerParams	*p)
 {
+	CompilerContext *ctx;
 	FILE *input_file;
+	int status;
 	
-	if (p->input_file) {
-		if (g_str_equal(p->input_file, "-")) {
-			char_buf_set_file(stdin);
-		} else if (!(input_file = fopen(p->input_file, "r"))) {
-			g_print("can't open input file ``%s''\n", params.input_file);
-			return 1;
-		} else {
-			char_buf_set_file(input_file);
-		}
-	} else {
+	if (!p->input_file) {
 		g_print("no input file\n");
 		return 1;
 	}
 
-	params = *p;
-	return compiler_do();
+	if (!(input_file = open_input(p->input_file))) {
+		g_print("can't open input file ``%s''\n", p->input_file);
+		return 1;
+	}
+
+	options = *p;
+
+	ctx = compiler_context_new(&options, input_file, NULL, NULL);
+	status = compiler_do(ctx);
+	compiler_context_free(ctx);
+
+	if (input_file != stdin)
+		fclose(input_file);
+
+	return status;
 }
 
 int
 compiler_main(int argc, char **argv)
 {
-	GOptionContext *ctx;
+	GOptionContext *option_ctx;
+	CompilerContext *ctx;
 	FILE	       *input_file;
+	GString	       *report;
+	gint		i, n, status;
 	
-	ctx = g_option_context_new("input-file.lpd ...");
-	g_option_context_set_help_enabled(ctx, TRUE);
-	g_option_context_add_main_entries(ctx, cmdline_options, NULL);
-	g_option_context_parse(ctx, &argc, &argv, NULL);
-	g_option_context_free(ctx);
+	/* GOption has no -f<name> options, so the pass toggles are taken out first */
+	for (i = n = 1; i < argc; i++) {
+		if (g_str_has_prefix(argv[i], "-f") && argv[i][2])
+			options.pass_toggles = g_slist_append(options.pass_toggles, argv[i] + 2);
+		else
+			argv[n++] = argv[i];
+	}
+	argv[argc = n] = NULL;
+
+	option_ctx = g_option_context_new("input-file.lpd ...");
+	g_option_context_set_help_enabled(option_ctx, TRUE);
+	g_option_context_add_main_entries(option_ctx, cmdline_options, NULL);
+	g_option_context_parse(option_ctx, &argc, &argv, NULL);
+	g_option_context_free(option_ctx);
+
+	if (options.list_passes) {
+		list_passes();
+		return 0;
+	}
 	
-	if (argv[1]) {
-		params.input_file = argv[1];
-		
-		if (g_str_equal(params.input_file, "-")) {
-			char_buf_set_file(stdin);
-		} else if (!(input_file = fopen(params.input_file, "r"))) {
-			g_print("can't open input file ``%s''\n", params.input_file);
-			return 1;
-		} else {
-			char_buf_set_file(input_file);
-		}
-	} else {
+	if (!argv[1]) {
 		g_print("%s: no input file\n", argv[0]);
 		return 1;
 	}
 
-	if (params.test_parser) {
-		return lex_test_main(argc, argv);
-	}
-	
-	if (params.test_ast) {
-		return ast_test_main(argc, argv);
+	options.input_file = argv[1];
+
+	if (!(input_file = open_input(options.input_file))) {
+		g_print("can't open input file ``%s''\n", options.input_file);
+		return 1;
 	}
 
-	if (params.test_st) {
-		return symbol_table_test_main(argc, argv);
+	ctx = compiler_context_new(&options, input_file, NULL, NULL);
+
+	if (options.test_parser || options.test_ast || options.test_st || options.autotune) {
+		report = g_string_new(NULL);
+
+		if ((status = compiler_context_run(ctx, compiler_other, report)))
+			show_diagnostics(ctx);
+
+		fputs(report->str, stderr);
+		g_string_free(report, TRUE);
+	} else {
+		status = compiler_do(ctx);
 	}
-	
-	return compiler_do();
+
+	compiler_context_free(ctx);
+
+	return status;
 }
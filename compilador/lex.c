@@ -13,6 +13,7 @@
 #include <glib.h>
 
 #include "lex.h"
+#include "compiler_context.h"
 
 #ifndef LPD
 const char     *literals[] = {
@@ -25,7 +26,9 @@ const char     *literals[] = {
 	"true", "var", "while", "write",
 	"id", "number",
 	"return", "function call", "procedure call", "-",
-	"for", "step", "+", "begin"
+	"for", "step", "+", "begin",
+	"tail call", "dup", "switch", "case",
+	"select", "div (unchecked)"
 };
 #else
 const char     *literals[] = {
@@ -38,12 +41,12 @@ const char     *literals[] = {
 	"verdadeiro", "var", "enquanto", "escreva",
 	"id", "numero",
 	"return", "cham. funcao", "cham. procedimento", "-",
-	"para", "passo", "+", "inicio principal"
+	"para", "passo", "+", "inicio principal",
+	"cham. de cauda", "duplica", "se em cadeia", "caso de",
+	"seleção", "div (sem verificação)"
 };
 #endif
 
-static int      line = 1, column = 1;
-
 static TokenList *match_program(void);
 static TokenList *match_block(void);
 static TokenList *match_variable_declare_step(void);
@@ -52,6 +55,7 @@ static TokenList *match_type(void);
 static TokenList *match_subroutine_declare_step(void);
 static TokenList *match_procedure_declare(void);
 static TokenList *match_function_declare(void);
+static TokenList *match_parameters(void);
 static TokenList *match_statements(void);
 static TokenList *match_statement(void);
 static TokenList *match_attrib_call(void);
@@ -69,6 +73,7 @@ static TokenList *match_term(void);
 static TokenList *match_factor(void);
 static TokenList *match_variable(void);
 static TokenList *match_function_call(void);
+static TokenList *match_arguments(void);
 static TokenList *match_identifier(void);
 static TokenList *match_number(void);
 
@@ -77,17 +82,14 @@ static void     lex_error(char *message, ...);
 static void
 lex_error(char *message, ...)
 {
-	gchar *buffer;
+	gchar buffer[256];
 	va_list args;
 	
 	va_start(args, message);
-	buffer = g_strdup_vprintf(message, args);
+	g_vsnprintf(buffer, sizeof(buffer), message, args);
 	va_end(args);
 	
-	printf("Erro: ln <b>%d</b>, col <b>%d</b> \342\206\222 %s\n", line, column, buffer);
-	
-	g_free(buffer);
-	exit(1);
+	compiler_error(compiler_context->line, compiler_context->column, NULL, "%s", buffer);
 }
 
 static int
@@ -96,10 +98,10 @@ get_character(void)
 	int ch = char_buf_get();
 
 	if (ch == '\n') {
-		line++;
-		column = 1;
+		compiler_context->line++;
+		compiler_context->column = 1;
 	} else {
-		column++;
+		compiler_context->column++;
 	}
 	
 	return ch;
@@ -111,11 +113,11 @@ unget_character(char ch)
 	if (ch == -1)
 		return;
 
-	if(--column <= 0)
-		column = 1;
+	if(--compiler_context->column <= 0)
+		compiler_context->column = 1;
 
 	if(ch == '\n')
-		line--;		/*
+		compiler_context->line--;		/*
 		             * FIXME: still needs to calculate the column correctly;
 					 *		  it's not column=1, since it will have a certain
 					 *		  length. anyway, since tokens cannot currently
@@ -132,11 +134,11 @@ unget_string(char *string)
 	char_buf_put_string(string);
 	
 	for (; *string; string++) {
-		if (--column <= 0)
-			column = 1;
+		if (--compiler_context->column <= 0)
+			compiler_context->column = 1;
 		
 		if (*string == '\n')
-			line--;
+			compiler_context->line--;
 	}
 }
 
@@ -279,13 +281,13 @@ match_token(TokenType token_type)
 	}
 	
 	if (*literal == '\0') {
-		token = g_new0(Token, 1);
+		token = compiler_alloc(sizeof(Token));
 		token->type = token_type;
 		token->id = (gchar*) literals[token_type];
-		token->line = line;
-		token->column = column - index - 1;
+		token->line = compiler_context->line;
+		token->column = compiler_context->column - index - 1;
 		
-		token_list = g_new0(TokenList, 1);
+		token_list = tl_new();
 		token_list->tokens = g_list_append(token_list->tokens, token);
 		
 		return token_list;		
@@ -383,9 +385,8 @@ static TokenList      *
 match_block(void)
 {
 	TokenList      *tl, *t;
-	static gboolean _first_time = TRUE;
-	gboolean first_time = _first_time;
-	_first_time = FALSE;
+	gboolean first_time = !compiler_context->in_block;
+	compiler_context->in_block = TRUE;
 
 	tl = tl_new();
 
@@ -401,11 +402,11 @@ match_block(void)
 	if (first_time) {
 		Token		*token;
 
-		token = g_new0(Token, 1);
+		token = compiler_alloc(sizeof(Token));
 		token->type = T_MAIN_BEGIN;
 		token->id = (char *)literals[T_MAIN_BEGIN];
-		token->line = line;
-		token->column = column;
+		token->line = compiler_context->line;
+		token->column = compiler_context->column;
 		
 		t->tokens = g_list_prepend(t->tokens, token);
 	}
@@ -505,7 +506,10 @@ match_subroutine_declare_step(void)
 	return NULL;
 }
 
-/* <declaracao_procedimento> ::= procedimento <identificador> ; <bloco> */
+/*
+ * <declaracao_procedimento> ::= procedimento <identificador> [<parametros>] ;
+ * <bloco>
+ */
 static TokenList      *
 match_procedure_declare(void)
 {
@@ -516,6 +520,7 @@ match_procedure_declare(void)
 
 		tl_add_token(&tl, t);
 		tl_add_token(&tl, match_identifier_req());
+		tl_add_token(&tl, match_parameters());
 		SUPPRESS(match_token_req(T_SEMICOLON));
 		tl_add_token(&tl, match_block_req());
 		return tl;
@@ -523,7 +528,10 @@ match_procedure_declare(void)
 	return NULL;
 }
 
-/* <declaracao_funcao> ::= funcao <identificador> : <tipo>; <bloco> */
+/*
+ * <declaracao_funcao> ::= funcao <identificador> [<parametros>] : <tipo>;
+ * <bloco>
+ */
 static TokenList      *
 match_function_declare(void)
 {
@@ -534,6 +542,7 @@ match_function_declare(void)
 
 		tl_add_token(&tl, t);
 		tl_add_token(&tl, match_identifier_req());
+		tl_add_token(&tl, match_parameters());
 		SUPPRESS(match_token_req(T_COLON));
 		tl_add_token(&tl, match_type_req());
 		SUPPRESS(match_token_req(T_SEMICOLON));
@@ -544,6 +553,32 @@ match_function_declare(void)
 	return NULL;
 }
 
+/*
+ * <parametros> ::= ( <declaracao_variaveis> {; <declaracao_variaveis>} )
+ */
+static TokenList      *
+match_parameters(void)
+{
+	TokenList      *tl, *t;
+
+	if ((t = match_token(T_OPENPAREN))) {
+		tl = tl_new();
+
+		tl_add_token(&tl, t);
+		tl_add_token(&tl, match_variable_declare_req());
+
+		while ((t = match_token(T_SEMICOLON))) {
+			tl_unref(t);
+			tl_add_token(&tl, match_variable_declare_req());
+		}
+
+		tl_add_token(&tl, match_token_req(T_CLOSEPAREN));
+
+		return tl;
+	}
+	return NULL;
+}
+
 
 /* <comandos> ::= inicio <comando> {; <comando>}[;] fim */
 static TokenList      *
@@ -602,7 +637,7 @@ match_attrib_call(void)
 
 	if ((t = match_attrib()) ||
 	    (t = match_procedure_call())) {
-	    	tl_add_semicolon(t, line, column);
+	    	tl_add_semicolon(t, compiler_context->line, compiler_context->column);
 		return t;
 	}
 	return NULL;
@@ -635,11 +670,21 @@ match_attrib(void)
 	return NULL;
 }
 
-/* <chamada_procedimento> ::= <identificador> */
+/* <chamada_procedimento> ::= <identificador> [<argumentos>] */
 static TokenList      *
 match_procedure_call(void)
 {
-	return match_identifier();
+	TokenList      *tl, *t;
+
+	if ((t = match_identifier())) {
+		tl = tl_new();
+
+		tl_add_token(&tl, t);
+		tl_add_token(&tl, match_arguments());
+
+		return tl;
+	}
+	return NULL;
 }
 
 /* <cmd_condicional> ::= se <expressao> entao <comando> [senao <comando>] */
@@ -662,7 +707,7 @@ match_conditional(void)
 			tl_add_token(&tl, match_statement_req());
 		}
 		
-		tl_add_semicolon(tl, line, column);
+		tl_add_semicolon(tl, compiler_context->line, compiler_context->column);
 
 		return tl;
 	}
@@ -685,19 +730,19 @@ match_for(void)
 		tl_add_token(&tl, match_token_req(T_WHILE));
 		tl_add_token(&tl, match_expression_req());
 		
-		tl_add_semicolon(tl, line, column);
+		tl_add_semicolon(tl, compiler_context->line, compiler_context->column);
 
 		if ((t = match_token(T_STEP))) {
 			tl_add_token(&tl, t);
 			tl_add_token(&tl, match_expression_req());
 
-			tl_add_semicolon(tl, line, column);
+			tl_add_semicolon(tl, compiler_context->line, compiler_context->column);
 		}
 		
 		SUPPRESS(match_token_req(T_DO));
 		tl_add_token(&tl, match_statement_req());
 
-		tl_add_semicolon(tl, line, column);
+		tl_add_semicolon(tl, compiler_context->line, compiler_context->column);
 		
 		return tl;
 	}
@@ -719,7 +764,7 @@ match_while(void)
 		tl_add_token(&tl, match_token_req(T_DO));
 		tl_add_token(&tl, match_statement_req());
 		
-		tl_add_semicolon(tl, line, column);
+		tl_add_semicolon(tl, compiler_context->line, compiler_context->column);
 
 		return tl;
 	}
@@ -740,7 +785,7 @@ match_read(void)
 		tl_add_token(&tl, match_identifier_req());
 		SUPPRESS(match_token_req(T_CLOSEPAREN));
 
-		tl_add_semicolon(tl, line, column);
+		tl_add_semicolon(tl, compiler_context->line, compiler_context->column);
 
 		return tl;
 	}
@@ -761,7 +806,7 @@ match_write(void)
 		tl_add_token(&tl, match_identifier_req());
 		SUPPRESS(match_token_req(T_CLOSEPAREN));
 
-		tl_add_semicolon(tl, line, column);
+		tl_add_semicolon(tl, compiler_context->line, compiler_context->column);
 
 		return tl;
 	}
@@ -866,9 +911,9 @@ match_factor(void)
 
 	if ((t = match_token(T_TRUE)) ||
 	    (t = match_token(T_FALSE)) ||
+	    (t = match_function_call()) ||
 	    (t = match_variable()) ||
-	    (t = match_number()) ||
-	    (t = match_function_call())) {
+	    (t = match_number())) {
 		tl_add_token(&tl, t);
 	} else if ((t = match_token(T_OPENPAREN))) {
 		tl_add_token(&tl, t);
@@ -893,11 +938,59 @@ match_variable(void)
 	return match_identifier();
 }
 
-/* <chamada_funcao> ::= <identificador> */
+/*
+ * <chamada_funcao> ::= <identificador> <argumentos>
+ *
+ * Chamadas sem argumentos são reconhecidas como <variavel>; a análise
+ * semântica descobre o que o identificador é.
+ */
 static TokenList      *
 match_function_call(void)
 {
-	return match_identifier();
+	TokenList      *tl, *t1, *t2;
+
+	if ((t1 = match_identifier())) {
+		tl = tl_new();
+
+		tl_ref(t1);
+		tl_add_token(&tl, t1);
+
+		if ((t2 = match_arguments())) {
+			tl_add_token(&tl, t2);
+
+			tl_unref(t1);
+			return tl;
+		} else {
+			unget_tokenlist(t1);
+			tl_unref(t1);
+			tl_destroy(tl);
+		}
+	}
+	return NULL;
+}
+
+/* <argumentos> ::= ( <expressao> {, <expressao>} ) */
+static TokenList      *
+match_arguments(void)
+{
+	TokenList      *tl, *t;
+
+	if ((t = match_token(T_OPENPAREN))) {
+		tl = tl_new();
+
+		tl_add_token(&tl, t);
+		tl_add_token(&tl, match_expression_req());
+
+		while ((t = match_token(T_COMMA))) {
+			tl_add_token(&tl, t);
+			tl_add_token(&tl, match_expression_req());
+		}
+
+		tl_add_token(&tl, match_token_req(T_CLOSEPAREN));
+
+		return tl;
+	}
+	return NULL;
 }
 
 int
@@ -947,11 +1040,11 @@ match_identifier(void)
 			return NULL;
 		}
 
-		t = g_new0(Token, 1);
+		t = compiler_alloc(sizeof(Token));
 		t->type = T_IDENTIFIER;
-		t->id = strdup(buffer);
-		t->line = line;
-		t->column = column - index - 1; /* point to start of token */
+		t->id = compiler_strdup(buffer);
+		t->line = compiler_context->line;
+		t->column = compiler_context->column - index - 1; /* point to start of token */
 
 		tl = tl_new();
 		tl->tokens = g_list_append(tl->tokens, t);
@@ -989,11 +1082,11 @@ match_number(void)
 		
 		tl = tl_new();
 
-		t = g_new0(Token, 1);
+		t = compiler_alloc(sizeof(Token));
 		t->type = T_NUMBER;
-		t->id = strdup(buffer);
-		t->line = line;
-		t->column = column;
+		t->id = compiler_strdup(buffer);
+		t->line = compiler_context->line;
+		t->column = compiler_context->column;
 
 		tl->tokens = g_list_append(tl->tokens, t);
 
@@ -1080,7 +1173,7 @@ lex_test_main(int argc, char **argv)
 			    token->type == T_VAR ||
 			    token->type == T_FUNCTION ||
 			    token->type == T_PROCEDURE) {
-				putchar('\n');
+				compiler_write("\n");
 			}
 
 			if (token->type == T_BEGIN) {
@@ -1090,13 +1183,13 @@ lex_test_main(int argc, char **argv)
 			}
 
 			if (!(token->type == T_SEMICOLON && last == T_SEMICOLON)) {
-				printf("\033[40;%sm%s\033[m ",
-				       cores[qual_cor(token->type)],
-				       token->id);
+				compiler_write("\033[40;%sm%s\033[m ",
+					       cores[qual_cor(token->type)],
+					       token->id);
 
 				if (token->type == T_SEMICOLON ||
 				    token->type == T_BEGIN) {
-					putchar('\n');
+					compiler_write("\n");
 				}
 			}
 			
@@ -1105,7 +1198,7 @@ lex_test_main(int argc, char **argv)
 		}
 	}
 	
-	puts("");
+	compiler_write("\n");
 	
 	tl_unref(tl);
 	return 0;
@@ -11,6 +11,7 @@
 
 #include "ast.h"
 #include "tokenlist.h"
+#include "callgraph.h"
 
 /*
  * TODO
@@ -18,6 +19,13 @@
  * - Strength reduction
  */
 
+/* the operand of LDC takes three columns in the object file */
+#define LDC_MIN -99
+#define LDC_MAX 999
+
+/* transformations made by the pass being run, reported by passes.c */
+static PER_THREAD gint changes = 0;
+
 static void
 fold_constants(GNode *node, GNode *parent)
 {
@@ -34,6 +42,10 @@ fold_constants(GNode *node, GNode *parent)
     
     fold_constants(lchild, node);
     fold_constants(rchild, node);
+
+    /* either operand may have been replaced by its value */
+    if (!(lchild = node->children) || !(rchild = lchild->next))
+        return;
     
     for (child = rchild->children; child; child = child->next)
         fold_constants(child, node);
@@ -47,7 +59,7 @@ fold_constants(GNode *node, GNode *parent)
     
     if ((lan->token == T_NUMBER && ran->token == T_NUMBER) ||
         (nan->token == T_UNARY_MINUS && lan->token == T_NUMBER)) {
-        short p1, p2;
+        gint p1, p2, result;
         gchar *r = NULL;
         
         p1 = lan ? atoi((char *)lan->data) : 0;
@@ -98,7 +110,13 @@ fold_constants(GNode *node, GNode *parent)
         }
         
         if (r) {
-            replace = ast_node_new(T_NUMBER, r);
+            result = atoi(r);
+
+            if (result >= LDC_MIN && result <= LDC_MAX) {
+                replace = ast_node_new(T_NUMBER, r);
+            } else {
+                g_free(r);
+            }
         }
     }
       
@@ -112,6 +130,7 @@ fold_constants(GNode *node, GNode *parent)
             if (temp == node) {
                 g_node_destroy(node);
                 g_node_insert(parent, position, g_node_new(replace));
+                changes++;
                 return;
             }
         }
@@ -130,7 +149,12 @@ fold_constants_traverse_func(GNode *node,
       case T_WHILE:
       case T_FUNCTION_RETURN:
           fold_constants(node, NULL);
-          /* fall through */
+          break;
+      case T_FOR:
+          /* the condition and the step; the start value is a T_ATTRIB */
+          fold_constants(node->children->next, node);
+          fold_constants(node->children->next->next, node);
+          break;
       default:
           ;
     }
@@ -138,14 +162,3152 @@ fold_constants_traverse_func(GNode *node,
     return FALSE;
 }
 
-
-void optimize(GNode *ast)
+gint
+fold_all_constants(GNode *ast)
 {
+    changes = 0;
     g_node_traverse(ast,
                     G_PRE_ORDER,
                     G_TRAVERSE_NON_LEAVES,
                     -1,
                     fold_constants_traverse_func,
                     NULL);
+
+    return changes;
+}
+
+static TokenType
+node_token(GNode *node)
+{
+    return ((ASTNode *)node->data)->token;
+}
+
+/*
+ * Compiler-generated variables
+ *
+ * Temporaries are named "$tN" (which the lexer will never produce) and are
+ * declared in the single "var" node of a procedure, function or program, so
+ * the code generator allocates them like any other variable.
+ */
+
+static gboolean
+is_temp(gchar *name)
+{
+    return name && name[0] == '$';
+}
+
+/*
+ * Declares a new temporary in ``scope'', which must be the current context of
+ * the symbol table. The scope's "var" node is created if it has none.
+ */
+static gchar *
+temp_new(GNode *scope, SymbolSubType subtype)
+{
+    GNode *var_node, *type_node;
+    gchar *name;
+
+    for (var_node = scope->children; var_node; var_node = var_node->next) {
+        if (node_token(var_node) == T_VAR)
+            break;
+    }
+
+    if (!var_node) {
+        var_node = g_node_new(ast_node_new(T_VAR, NULL));
+        g_node_prepend(scope, var_node);
+    }
+
+    name = g_strdup_printf("$t%d", ++compiler_context->temp_count);
+    symbol_table_install(symbol_table, name, ST_VARIABLE, subtype);
+
+    type_node = g_node_new(ast_node_new(subtype == SST_INTEGER ? T_INTEGER : T_BOOLEAN, NULL));
+    g_node_append(type_node, g_node_new(ast_node_new(T_IDENTIFIER, name)));
+    g_node_append(var_node, type_node);
+
+    return name;
+}
+
+/*
+ * Inliner
+ *
+ * Calls to small procedures and functions that are not recursive and have
+ * no nested subroutines are replaced by a copy of their bodies. Locals of
+ * the callee (and the result of a function) become temporaries of the
+ * caller, and parameters are temporaries assigned to the arguments before
+ * the body. Function calls are only expanded when the order of evaluation
+ * can't be observed: a single call in an assignment or "se" condition that
+ * reads nothing the callee may write, outside of "e"/"ou".
+ */
+
+#define INLINE_MAX_SIZE         32      /* AST nodes */
+#define INLINE_MAX_SIZE_ONCE    128     /* ...if there's a single call site */
+
+typedef struct _Subroutine Subroutine;
+
+struct _Subroutine {
+    Symbol      *symbol;
+    GNode       *node;          /* T_PROCEDURE or T_FUNCTION */
+    GNode       *scope;         /* its context in the symbol table */
+    GSList      *callees;       /* Symbol * */
+    GSList      *writes;        /* Symbol * */
+    guint        size, call_sites;
+    gboolean     has_subroutines;
+};
+
+static PER_THREAD GHashTable *subroutines = NULL;  /* Symbol * -> Subroutine * */
+static PER_THREAD GHashTable *inline_temps = NULL; /* callee Symbol * -> temporary */
+static PER_THREAD GNode *inline_scope = NULL;
+
+static void
+subroutine_free(gpointer data)
+{
+    Subroutine *sub = (Subroutine *)data;
+
+    g_slist_free(sub->callees);
+    g_slist_free(sub->writes);
+    g_free(sub);
+}
+
+static Symbol *
+lookup_from(GNode *level, gchar *name)
+{
+    GNode *node;
+
+    for (; level; level = level->parent) {
+        for (node = level->children; node; node = node->next) {
+            if (g_str_equal(((Symbol *)node->data)->name, name))
+                return (Symbol *)node->data;
+        }
+    }
+
+    return NULL;
+}
+
+static gboolean
+is_local(Subroutine *sub, Symbol *symbol)
+{
+    GNode *node;
+
+    for (node = sub->scope->children; node; node = node->next) {
+        if (node->data == symbol)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+inline_collect(GNode *node, Subroutine *current)
+{
+    GNode *child;
+    ASTNode *ast_node;
+    Subroutine *sub;
+    Symbol *symbol;
+
+    for (child = node->children; child; child = child->next) {
+        ast_node = (ASTNode *)child->data;
+
+        switch (ast_node->token) {
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              sub = g_new0(Subroutine, 1);
+              sub->symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+              sub->node = child;
+              sub->size = g_node_n_nodes(child, G_TRAVERSE_ALL);
+              g_hash_table_insert(subroutines, sub->symbol, sub);
+
+              if (current)
+                  current->has_subroutines = TRUE;
+
+              symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+              sub->scope = symbol_table->current_level;
+              inline_collect(child, sub);
+              symbol_table_context_leave(symbol_table);
+              continue;
+          case T_PROCEDURE_CALL:
+          case T_FUNCTION_CALL:
+              symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+
+              if ((sub = g_hash_table_lookup(subroutines, symbol)))
+                  sub->call_sites++;
+
+              if (current && !g_slist_find(current->callees, symbol))
+                  current->callees = g_slist_prepend(current->callees, symbol);
+              break;
+          case T_ATTRIB:
+          case T_READ:
+              symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+
+              if (current && !g_slist_find(current->writes, symbol))
+                  current->writes = g_slist_prepend(current->writes, symbol);
+              break;
+          default:
+              ;
+        }
+
+        inline_collect(child, current);
+    }
+}
+
+static gboolean
+inline_reaches(Subroutine *from, Symbol *target, GSList **visited)
+{
+    GSList *c;
+    Subroutine *sub;
+
+    for (c = from->callees; c; c = c->next) {
+        if (c->data == target)
+            return TRUE;
+
+        if (g_slist_find(*visited, c->data))
+            continue;
+
+        *visited = g_slist_prepend(*visited, c->data);
+
+        if ((sub = g_hash_table_lookup(subroutines, c->data)) &&
+            inline_reaches(sub, target, visited))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* may ``sub'', or anything it calls, write ``symbol''? */
+static gboolean
+inline_may_write(Subroutine *sub, Symbol *symbol, GSList **visited)
+{
+    GSList *c;
+    Subroutine *callee;
+
+    if (g_slist_find(sub->writes, symbol))
+        return TRUE;
+
+    for (c = sub->callees; c; c = c->next) {
+        if (g_slist_find(*visited, c->data))
+            continue;
+
+        *visited = g_slist_prepend(*visited, c->data);
+
+        if ((callee = g_hash_table_lookup(subroutines, c->data)) &&
+            inline_may_write(callee, symbol, visited))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Every name the body of ``sub'' uses must either be one of its locals or
+ * mean the same thing at the call site.
+ */
+static gboolean
+inline_names_resolve(GNode *node, Subroutine *sub)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+    Symbol *symbol;
+
+    switch (ast_node->token) {
+      case T_IDENTIFIER:
+      case T_ATTRIB:
+      case T_READ:
+      case T_WRITE:
+      case T_PROCEDURE_CALL:
+      case T_FUNCTION_CALL:
+          symbol = lookup_from(sub->scope, (gchar *)ast_node->data);
+
+          if (!is_local(sub, symbol) &&
+              symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data) != symbol)
+              return FALSE;
+          break;
+      default:
+          ;
+    }
+
+    for (child = node->children; child; child = child->next) {
+        if (!inline_names_resolve(child, sub))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static Subroutine *
+inline_candidate(gchar *name)
+{
+    Subroutine *sub;
+    GSList *visited = NULL;
+    gboolean recursive;
+
+    sub = g_hash_table_lookup(subroutines, symbol_table_lookup_symbol(symbol_table, name));
+    if (!sub || sub->has_subroutines)
+        return NULL;
+
+    if (sub->size > INLINE_MAX_SIZE &&
+        (sub->call_sites > 1 || sub->size > INLINE_MAX_SIZE_ONCE))
+        return NULL;
+
+    recursive = inline_reaches(sub, sub->symbol, &visited);
+    g_slist_free(visited);
+
+    if (recursive || !inline_names_resolve(sub->node, sub))
+        return NULL;
+
+    return sub;
+}
+
+static gchar *
+inline_temp(Symbol *symbol)
+{
+    gchar *name;
+
+    if (!(name = g_hash_table_lookup(inline_temps, symbol))) {
+        name = temp_new(inline_scope, symbol->subtype);
+        g_hash_table_insert(inline_temps, symbol, name);
+    }
+
+    return name;
 }
 
+static void
+inline_rename(GNode *node, Subroutine *sub)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+    Symbol *symbol;
+
+    switch (ast_node->token) {
+      case T_FUNCTION_RETURN:
+          ast_node->token = T_ATTRIB;
+          ast_node->data = inline_temp(sub->symbol);
+          break;
+      case T_IDENTIFIER:
+      case T_ATTRIB:
+      case T_READ:
+      case T_WRITE:
+          symbol = lookup_from(sub->scope, (gchar *)ast_node->data);
+
+          if (is_local(sub, symbol))
+              ast_node->data = inline_temp(symbol);
+          break;
+      default:
+          ;
+    }
+
+    for (child = node->children; child; child = child->next)
+        inline_rename(child, sub);
+}
+
+/*
+ * Inserts a copy of the body of ``sub'' before ``stmt'', preceded by the
+ * assignment of the arguments of ``call'' (which are moved out of it) to
+ * the parameters. Returns the first inserted statement, so that calls
+ * inside it get expanded as well.
+ */
+static GNode *
+inline_expand(Subroutine *sub, GNode *stmt, GNode *call)
+{
+    GNode *body, *copy, *arg, *first = NULL;
+    GSList *param;
+
+    for (param = sub->symbol->parameters; param; param = param->next) {
+        arg = call->children;
+        g_node_unlink(arg);
+
+        copy = g_node_new(ast_node_new(T_ATTRIB, inline_temp((Symbol *)param->data)));
+        g_node_append(copy, arg);
+        g_node_insert_before(stmt->parent, stmt, copy);
+
+        if (!first)
+            first = copy;
+    }
+
+    for (body = sub->node->children; body; body = body->next) {
+        if (node_token(body) == T_VAR)
+            continue;
+
+        copy = ast_copy(body);
+        inline_rename(copy, sub);
+        g_node_insert_before(stmt->parent, stmt, copy);
+
+        if (!first)
+            first = copy;
+    }
+
+    changes++;
+    return first;
+}
+
+static GNode *
+inline_find_call(GNode *expr, gint *n_calls, gboolean in_logic_op)
+{
+    ASTNode *ast_node = (ASTNode *)expr->data;
+    GNode *child, *call = NULL, *c;
+
+    if (ast_node->token == T_FUNCTION_CALL) {
+        /* an "e"/"ou" operand might be skipped when short-circuiting */
+        *n_calls += in_logic_op ? 2 : 1;
+
+        /* calls in the arguments would run before the ones to the left */
+        for (child = expr->children; child; child = child->next)
+            inline_find_call(child, n_calls, in_logic_op);
+
+        return expr;
+    }
+
+    in_logic_op |= ast_node->token == T_AND || ast_node->token == T_OR;
+
+    for (child = expr->children; child; child = child->next) {
+        if ((c = inline_find_call(child, n_calls, in_logic_op)))
+            call = c;
+    }
+
+    return call;
+}
+
+static gboolean
+inline_reads_written(GNode *expr, Subroutine *sub)
+{
+    ASTNode *ast_node = (ASTNode *)expr->data;
+    GNode *child;
+    GSList *visited = NULL;
+    gboolean written;
+
+    if (ast_node->token == T_IDENTIFIER) {
+        written = inline_may_write(sub,
+            symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data), &visited);
+        g_slist_free(visited);
+
+        return written;
+    }
+
+    for (child = expr->children; child; child = child->next) {
+        if (inline_reads_written(child, sub))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Expands the function call in the expression of an assignment, a function
+ * return or a "se" condition. Returns the first inserted statement.
+ */
+static GNode *
+inline_function_call(GNode *stmt)
+{
+    GNode *call, *first;
+    ASTNode *ast_node;
+    Subroutine *sub;
+    gint n_calls = 0;
+
+    call = inline_find_call(stmt->children, &n_calls, FALSE);
+    if (!call || n_calls != 1)
+        return NULL;
+
+    ast_node = (ASTNode *)call->data;
+    if (!(sub = inline_candidate((gchar *)ast_node->data)))
+        return NULL;
+
+    if (inline_reads_written(stmt->children, sub))
+        return NULL;
+
+    first = inline_expand(sub, stmt, call);
+
+    ast_node->token = T_IDENTIFIER;
+    ast_node->data = inline_temp(sub->symbol);
+
+    return first ? first : stmt;
+}
+
+static void
+inline_statements(GNode *stmt)
+{
+    GNode *next, *first, *scope, *loop_body;
+    ASTNode *ast_node;
+    Subroutine *sub;
+    GHashTable *temps;
+
+    for (; stmt; stmt = next) {
+        next = stmt->next;
+        ast_node = (ASTNode *)stmt->data;
+
+        switch (ast_node->token) {
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              scope = inline_scope;
+              temps = inline_temps;
+              inline_scope = stmt;
+              inline_temps = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+              symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+              inline_statements(stmt->children);
+              symbol_table_context_leave(symbol_table);
+
+              g_hash_table_destroy(inline_temps);
+              inline_scope = scope;
+              inline_temps = temps;
+              break;
+          case T_PROCEDURE_CALL:
+              if ((sub = inline_candidate((gchar *)ast_node->data))) {
+                  first = inline_expand(sub, stmt, stmt);
+                  g_node_destroy(stmt);
+
+                  if (first)
+                      next = first;
+              }
+              break;
+          case T_ATTRIB:
+          case T_FUNCTION_RETURN:
+          case T_IF:
+              if ((first = inline_function_call(stmt))) {
+                  next = first;
+              } else if (ast_node->token == T_IF) {
+                  inline_statements(stmt->children->next);
+              }
+              break;
+          case T_ELSE:
+              inline_statements(stmt->children);
+              break;
+          case T_WHILE:
+              inline_statements(stmt->children->next);
+              break;
+          case T_FOR:
+              loop_body = stmt->children->next->next->next;
+              inline_statements(loop_body);
+              break;
+          default:
+              ;
+        }
+    }
+}
+
+static void modref_invalidate(void);
+
+gint
+inline_subroutines(GNode *ast)
+{
+    changes = 0;
+    subroutines = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                        NULL, subroutine_free);
+    inline_temps = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    symbol_table_context_reset(symbol_table);
+    inline_collect(ast, NULL);
+
+    inline_scope = ast;
+    inline_statements(ast->children);
+    inline_scope = NULL;
+
+    g_hash_table_destroy(inline_temps);
+    g_hash_table_destroy(subroutines);
+
+    /* what is called changed */
+    if (changes)
+        modref_invalidate();
+
+    return changes;
+}
+
+/*
+ * Tail-recursion elimination
+ *
+ * A procedure calling itself as the last thing it does, or a function
+ * returning the result of calling itself, doesn't need a new activation:
+ * locals already have the values the callee would see, and the caller
+ * would only restore them and return. Such calls become T_TAIL_CALL nodes,
+ * which the code generator emits as a jump back to the procedure body,
+ * after storing the new arguments into the parameters.
+ */
+
+static void
+tre_statement(GNode *stmt, gchar *name, gboolean function)
+{
+    ASTNode *ast_node = (ASTNode *)stmt->data;
+    GNode *last;
+
+    switch (ast_node->token) {
+      case T_PROCEDURE_CALL:
+          if (!function && g_str_equal(ast_node->data, name)) {
+              ast_node->token = T_TAIL_CALL;
+              changes++;
+          }
+          break;
+      case T_FUNCTION_RETURN:
+          if (function && node_token(stmt->children) == T_FUNCTION_CALL &&
+              g_str_equal(((ASTNode *)stmt->children->data)->data, name)) {
+              GNode *call = stmt->children, *arg;
+
+              /* the arguments of the call become the ones of the jump */
+              ast_node->token = T_TAIL_CALL;
+              g_node_unlink(call);
+
+              while ((arg = call->children)) {
+                  g_node_unlink(arg);
+                  g_node_append(stmt, arg);
+              }
+
+              g_node_destroy(call);
+              changes++;
+          }
+          break;
+      case T_IF:
+          last = g_node_last_child(stmt);
+
+          if (node_token(last) == T_ELSE) {
+              if (last->children)
+                  tre_statement(g_node_last_child(last), name, function);
+
+              last = last->prev;
+          }
+
+          if (last != stmt->children)
+              tre_statement(last, name, function);
+          break;
+      default:
+          ;
+    }
+}
+
+static void
+tre_traverse(GNode *node)
+{
+    GNode *child, *last;
+    ASTNode *ast_node;
+
+    for (child = node->children; child; child = child->next) {
+        ast_node = (ASTNode *)child->data;
+
+        if (ast_node->token != T_PROCEDURE && ast_node->token != T_FUNCTION)
+            continue;
+
+        tre_traverse(child);
+
+        last = g_node_last_child(child);
+        switch (node_token(last)) {
+          case T_VAR:
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              /* empty body */
+              break;
+          default:
+              tre_statement(last, (gchar *)ast_node->data,
+                            ast_node->token == T_FUNCTION);
+        }
+    }
+}
+
+gint
+eliminate_tail_calls(GNode *ast)
+{
+    changes = 0;
+    tre_traverse(ast);
+
+    /* recursive calls turned into jumps are no longer calls */
+    if (changes)
+        modref_invalidate();
+
+    return changes;
+}
+
+/*
+ * Side effects of calls
+ *
+ * Which variables a call may write comes from the mod/ref summaries of the
+ * call graph (see callgraph.c). They are built by the first pass that needs
+ * them, and again after the inliner or the tail call elimination change what
+ * is called.
+ */
+
+static void
+modref_update(GNode *ast)
+{
+    if (!modref)
+        modref = callgraph_new(ast);
+}
+
+static void
+modref_invalidate(void)
+{
+    if (modref) {
+        callgraph_free(modref);
+        modref = NULL;
+    }
+}
+
+static void
+collect_callees(GNode *node, GSList **callees)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+    Symbol *symbol;
+
+    if (ast_node->token == T_PROCEDURE_CALL || ast_node->token == T_FUNCTION_CALL) {
+        symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+        if (!g_slist_find(*callees, symbol))
+            *callees = g_slist_prepend(*callees, symbol);
+    }
+
+    for (child = node->children; child; child = child->next)
+        collect_callees(child, callees);
+}
+
+static gboolean
+calls_may_write(GSList *callees, Symbol *symbol)
+{
+    GSList *l;
+
+    for (l = callees; l; l = l->next) {
+        if (callgraph_may_write(modref, (Symbol *)l->data, symbol))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Compile-time evaluation of pure functions
+ *
+ * A function that neither writes nor reads variables declared outside of
+ * it, not even through what it calls (see callgraph.c), and that does no
+ * "leia"/"escreva", returns the same value whenever given the same
+ * arguments. Calls to it with constant arguments are evaluated by
+ * interpreting its body and replaced by the result. Evaluation gives up,
+ * leaving the call alone, on a division by zero, a variable read before
+ * being assigned, too many nested calls or once its budget is spent.
+ */
+
+#define EVAL_BUDGET     100000  /* AST nodes evaluated per call */
+#define EVAL_MAX_DEPTH  256     /* nested calls */
+
+
+typedef struct _EvalFrame EvalFrame;
+
+struct _EvalFrame {
+    Symbol      *function;
+    GNode       *level;         /* its context in the symbol table */
+    GHashTable  *values;        /* Symbol * -> value of locals and parameters */
+    gint         result;
+    gboolean     has_result;
+    EvalFrame   *caller;
+};
+
+static PER_THREAD GHashTable *io_visited = NULL;   /* CallGraphNode * already looked at */
+static PER_THREAD gint eval_budget, eval_depth;
+
+static gboolean
+has_io(GNode *node)
+{
+    GNode *child;
+
+    for (child = node->children; child; child = child->next) {
+        switch (node_token(child)) {
+          case T_READ:
+          case T_WRITE:
+              return TRUE;
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              /* looked at if called */
+              break;
+          default:
+              if (has_io(child))
+                  return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* whether ``cg_node'', or anything it calls, does input or output */
+static gboolean
+does_io(CallGraphNode *cg_node)
+{
+    GSList *l;
+
+    if (g_hash_table_lookup(io_visited, cg_node))
+        return FALSE;
+    g_hash_table_insert(io_visited, cg_node, cg_node);
+
+    if (has_io(cg_node->node))
+        return TRUE;
+
+    for (l = cg_node->callees; l; l = l->next) {
+        if (does_io((CallGraphNode *)l->data))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+is_pure(CallGraphNode *cg_node)
+{
+    gboolean io;
+
+    if (cg_node->symbol->type != ST_FUNCTION || cg_node->mod || cg_node->ref)
+        return FALSE;
+
+    io_visited = g_hash_table_new(g_direct_hash, g_direct_equal);
+    io = does_io(cg_node);
+    g_hash_table_destroy(io_visited);
+
+    return !io;
+}
+
+/* the most recent activation of the procedure declaring ``symbol'' */
+static EvalFrame *
+eval_frame_of(EvalFrame *frame, Symbol *symbol)
+{
+    GNode *decl;
+
+    decl = g_node_find(symbol_table->root, G_PRE_ORDER, G_TRAVERSE_ALL, symbol);
+    if (!decl)
+        return NULL;
+
+    for (; frame; frame = frame->caller) {
+        if (frame->level == decl->parent)
+            return frame;
+    }
+
+    return NULL;
+}
+
+static gboolean
+eval_variable(EvalFrame *frame, gchar *name, gint *value)
+{
+    Symbol *symbol;
+    EvalFrame *owner;
+    gpointer v;
+
+    if (!frame)
+        return FALSE;
+
+    symbol = lookup_from(frame->level, name);
+    owner = eval_frame_of(frame, symbol);
+
+    if (!owner || !g_hash_table_lookup_extended(owner->values, symbol, NULL, &v))
+        return FALSE;
+
+    *value = GPOINTER_TO_INT(v);
+    return TRUE;
+}
+
+static gboolean
+eval_assign(EvalFrame *frame, gchar *name, gint value)
+{
+    Symbol *symbol;
+    EvalFrame *owner;
+
+    symbol = lookup_from(frame->level, name);
+    if (!(owner = eval_frame_of(frame, symbol)))
+        return FALSE;
+
+    g_hash_table_insert(owner->values, symbol, GINT_TO_POINTER(value));
+    return TRUE;
+}
+
+static gboolean eval_call(GNode *call, GNode *level, EvalFrame *frame, gint *value);
+
+static gboolean
+eval_expression(GNode *expr, EvalFrame *frame, gint *value)
+{
+    ASTNode *ast_node = (ASTNode *)expr->data;
+    gint a, b = 0;
+
+    if (--eval_budget < 0)
+        return FALSE;
+
+    switch (ast_node->token) {
+      case T_NUMBER:
+          *value = atoi((gchar *)ast_node->data);
+          return TRUE;
+      case T_TRUE:
+      case T_FALSE:
+          *value = ast_node->token == T_TRUE;
+          return TRUE;
+      case T_IDENTIFIER:
+          return eval_variable(frame, (gchar *)ast_node->data, value);
+      case T_FUNCTION_CALL:
+          return frame && eval_call(expr, frame->level, frame, value);
+      default:
+          ;
+    }
+
+    if (!expr->children || !eval_expression(expr->children, frame, &a))
+        return FALSE;
+
+    if (expr->children->next && !eval_expression(expr->children->next, frame, &b))
+        return FALSE;
+
+    /* as the virtual machine does it */
+    switch (ast_node->token) {
+      case T_UNARY_PLUS:
+          *value = a;
+          break;
+      case T_UNARY_MINUS:
+          *value = (gint)(0u - (guint)a);
+          break;
+      case T_NOT:
+          *value = 1 - a;
+          break;
+      case T_PLUS:
+          *value = (gint)((guint)a + (guint)b);
+          break;
+      case T_MINUS:
+          *value = (gint)((guint)a - (guint)b);
+          break;
+      case T_MULTIPLY:
+          *value = (gint)((guint)a * (guint)b);
+          break;
+      case T_DIVIDE:
+          if (b == 0 || (a == G_MININT && b == -1))
+              return FALSE;
+          *value = a / b;
+          break;
+      case T_AND:
+          *value = a == 1 && b == 1;
+          break;
+      case T_OR:
+          *value = a == 1 || b == 1;
+          break;
+      case T_OP_EQUAL:
+          *value = a == b;
+          break;
+      case T_OP_DIFFERENT:
+          *value = a != b;
+          break;
+      case T_OP_GT:
+          *value = a > b;
+          break;
+      case T_OP_GEQ:
+          *value = a >= b;
+          break;
+      case T_OP_LT:
+          *value = a < b;
+          break;
+      case T_OP_LEQ:
+          *value = a <= b;
+          break;
+      default:
+          return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean eval_statement(GNode *stmt, EvalFrame *frame);
+
+/* runs ``stmt'' and the ones after it, up to the "senao" of a "se" */
+static gboolean
+eval_statements(GNode *stmt, EvalFrame *frame)
+{
+    for (; stmt && node_token(stmt) != T_ELSE; stmt = stmt->next) {
+        if (!eval_statement(stmt, frame))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+eval_statement(GNode *stmt, EvalFrame *frame)
+{
+    ASTNode *ast_node = (ASTNode *)stmt->data;
+    EvalFrame *owner;
+    GNode *child;
+    Symbol *symbol;
+    gint value, step;
+
+    if (--eval_budget < 0)
+        return FALSE;
+
+    switch (ast_node->token) {
+      case T_ATTRIB:
+          return eval_expression(stmt->children, frame, &value) &&
+                 eval_assign(frame, (gchar *)ast_node->data, value);
+      case T_FUNCTION_RETURN:
+          if (!eval_expression(stmt->children, frame, &value))
+              return FALSE;
+
+          symbol = lookup_from(frame->level, (gchar *)ast_node->data);
+          for (owner = frame; owner; owner = owner->caller) {
+              if (owner->function == symbol) {
+                  owner->result = value;
+                  owner->has_result = TRUE;
+                  return TRUE;
+              }
+          }
+          return FALSE;
+      case T_PROCEDURE_CALL:
+          return eval_call(stmt, frame->level, frame, &value);
+      case T_IF:
+          if (!eval_expression(stmt->children, frame, &value))
+              return FALSE;
+
+          if (value)
+              return eval_statements(stmt->children->next, frame);
+
+          child = g_node_last_child(stmt);
+          return node_token(child) != T_ELSE || eval_statements(child->children, frame);
+      case T_WHILE:
+          for (;;) {
+              if (!eval_expression(stmt->children, frame, &value))
+                  return FALSE;
+              if (!value)
+                  return TRUE;
+              if (!eval_statements(stmt->children->next, frame))
+                  return FALSE;
+          }
+      case T_FOR:
+          child = stmt->children;
+          if (!eval_statement(child, frame))
+              return FALSE;
+
+          for (;;) {
+              if (!eval_expression(child->next, frame, &value))
+                  return FALSE;
+              if (!value)
+                  return TRUE;
+              if (!eval_statements(child->next->next->next, frame))
+                  return FALSE;
+
+              if (!eval_expression(child->next->next, frame, &step) ||
+                  !eval_variable(frame, (gchar *)((ASTNode *)child->data)->data, &value) ||
+                  !eval_assign(frame, (gchar *)((ASTNode *)child->data)->data,
+                               (gint)((guint)value + (guint)step)))
+                  return FALSE;
+          }
+      case T_VAR:
+      case T_PROCEDURE:
+      case T_FUNCTION:
+          return TRUE;
+      default:
+          return FALSE;
+    }
+}
+
+/*
+ * Calls the procedure or function of ``call'', whose name is looked up from
+ * ``level''. Arguments are evaluated in ``frame'', which is NULL for a call
+ * in the program being compiled: they must be constants then.
+ */
+static gboolean
+eval_call(GNode *call, GNode *level, EvalFrame *frame, gint *value)
+{
+    EvalFrame callee;
+    CallGraphNode *cg_node;
+    GNode *n;
+    GSList *param;
+    gboolean ok = TRUE;
+    gint v;
+
+    cg_node = callgraph_lookup(modref, lookup_from(level, (gchar *)((ASTNode *)call->data)->data));
+    if (!cg_node || eval_depth >= EVAL_MAX_DEPTH)
+        return FALSE;
+
+    callee.function = cg_node->symbol;
+    callee.level = g_node_find(symbol_table->root, G_PRE_ORDER, G_TRAVERSE_ALL, cg_node->symbol);
+    callee.values = g_hash_table_new(g_direct_hash, g_direct_equal);
+    callee.has_result = FALSE;
+    callee.caller = frame;
+
+    for (n = call->children, param = cg_node->symbol->parameters; ok && n && param;
+         n = n->next, param = param->next) {
+        if ((ok = eval_expression(n, frame, &v)))
+            g_hash_table_insert(callee.values, param->data, GINT_TO_POINTER(v));
+    }
+
+    eval_depth++;
+    for (n = cg_node->node->children; ok && n; n = n->next)
+        ok = eval_statement(n, &callee);
+    eval_depth--;
+
+    if (cg_node->symbol->type == ST_FUNCTION)
+        ok = ok && callee.has_result;
+
+    *value = callee.result;
+    g_hash_table_destroy(callee.values);
+
+    return ok;
+}
+
+static void
+eval_replace(GNode *call)
+{
+    ASTNode *ast_node = (ASTNode *)call->data;
+    CallGraphNode *cg_node;
+    GNode *result;
+    gint value;
+
+    cg_node = callgraph_lookup(modref,
+                               symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data));
+    if (!cg_node || !is_pure(cg_node))
+        return;
+
+    eval_budget = EVAL_BUDGET;
+    if (!eval_call(call, symbol_table->current_level, NULL, &value))
+        return;
+
+    if (cg_node->symbol->subtype == SST_BOOLEAN) {
+        result = g_node_new(ast_node_new(value ? T_TRUE : T_FALSE, NULL));
+    } else if (value >= LDC_MIN && value <= LDC_MAX) {
+        result = g_node_new(ast_node_new(T_NUMBER, g_strdup_printf("%d", value)));
+    } else {
+        return;
+    }
+
+    g_node_insert_before(call->parent, call, result);
+    g_node_unlink(call);
+    g_node_destroy(call);
+
+    changes++;
+}
+
+static void
+eval_traverse(GNode *node)
+{
+    GNode *child, *next;
+    ASTNode *ast_node;
+
+    for (child = node->children; child; child = next) {
+        next = child->next;
+        ast_node = (ASTNode *)child->data;
+
+        switch (ast_node->token) {
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+              eval_traverse(child);
+              symbol_table_context_leave(symbol_table);
+              break;
+          case T_FUNCTION_CALL:
+              /* arguments first, they may be calls too */
+              eval_traverse(child);
+              eval_replace(child);
+              break;
+          default:
+              eval_traverse(child);
+        }
+    }
+}
+
+gint
+evaluate_pure_functions(GNode *ast)
+{
+    gint evaluated;
+
+    changes = 0;
+    modref_update(ast);
+
+    symbol_table_context_reset(symbol_table);
+    eval_traverse(ast);
+
+    /* results of calls may fold further */
+    evaluated = changes;
+    fold_all_constants(ast);
+
+    /* the calls evaluated are gone */
+    if (evaluated)
+        modref_invalidate();
+
+    return evaluated;
+}
+
+/*
+ * Loop unrolling
+ *
+ * The number of iterations of a "para" whose start value and step are
+ * constants, and whose condition only depends on the loop variable, is
+ * found by running the loop test at compile time. Small loops are replaced
+ * by a copy of their body for every iteration, in which the loop variable
+ * is a constant. Larger ones get their body repeated a few times in the
+ * loop, with the variable plus a constant in the copies after the first;
+ * the iterations left over go before the loop, also with constants. The
+ * loop variable must not be written by the body, nor read by what it calls,
+ * and still holds the value it would have after the loop.
+ */
+
+#define UNROLL_MAX_SIZE  64     /* AST nodes of the unrolled body */
+#define UNROLL_MAX_TRIPS 16     /* iterations unrolled completely */
+#define UNROLL_MAX_COUNT 100000 /* iterations counted at compile time */
+#define UNROLL_FACTOR    4      /* copies of the body in a partial unroll */
+
+/* evaluates ``expr'' with the loop variable ``name'' set to ``var'' */
+static gboolean
+unroll_eval(GNode *expr, gchar *name, gint var, gint *value)
+{
+    ASTNode *ast_node = (ASTNode *)expr->data;
+    gint a, b = 0;
+
+    switch (ast_node->token) {
+      case T_NUMBER:
+          *value = atoi((gchar *)ast_node->data);
+          return TRUE;
+      case T_TRUE:
+      case T_FALSE:
+          *value = ast_node->token == T_TRUE;
+          return TRUE;
+      case T_IDENTIFIER:
+          *value = var;
+          return name && g_str_equal(ast_node->data, name);
+      default:
+          ;
+    }
+
+    if (!expr->children || !unroll_eval(expr->children, name, var, &a))
+        return FALSE;
+
+    if (expr->children->next && !unroll_eval(expr->children->next, name, var, &b))
+        return FALSE;
+
+    switch (ast_node->token) {
+      case T_UNARY_PLUS:    *value = a; break;
+      case T_UNARY_MINUS:   *value = -a; break;
+      case T_NOT:           *value = !a; break;
+      case T_PLUS:          *value = a + b; break;
+      case T_MINUS:         *value = a - b; break;
+      case T_MULTIPLY:      *value = a * b; break;
+      case T_DIVIDE:
+          if (!b)
+              return FALSE;
+          *value = a / b;
+          break;
+      case T_AND:           *value = a && b; break;
+      case T_OR:            *value = a || b; break;
+      case T_OP_EQUAL:      *value = a == b; break;
+      case T_OP_DIFFERENT:  *value = a != b; break;
+      case T_OP_GT:         *value = a > b; break;
+      case T_OP_GEQ:        *value = a >= b; break;
+      case T_OP_LT:         *value = a < b; break;
+      case T_OP_LEQ:        *value = a <= b; break;
+      default:
+          return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Whether ``node'' writes or prints ``symbol'', or calls something that may
+ * read or write it.
+ */
+static gboolean
+unroll_uses(GNode *node, Symbol *symbol)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+    Symbol *s;
+
+    switch (ast_node->token) {
+      case T_ATTRIB:
+      case T_READ:
+      case T_WRITE:
+          /* "escreva" takes a variable, not an expression */
+          if (symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data) == symbol)
+              return TRUE;
+          break;
+      case T_PROCEDURE_CALL:
+      case T_FUNCTION_CALL:
+          s = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+          if (callgraph_may_read(modref, s, symbol) || callgraph_may_write(modref, s, symbol))
+              return TRUE;
+          break;
+      default:
+          ;
+    }
+
+    for (child = node->children; child; child = child->next) {
+        if (unroll_uses(child, symbol))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* replaces reads of ``name'' in ``node'' by ``name'' + ``offset'', or by ``value'' */
+static void
+unroll_substitute(GNode *node, gchar *name, gint offset, gint value, gboolean constant)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+
+    if (ast_node->token == T_IDENTIFIER && g_str_equal(ast_node->data, name)) {
+        if (constant) {
+            ast_node->token = T_NUMBER;
+            ast_node->data = g_strdup_printf("%d", value);
+        } else if (offset) {
+            ast_node->token = T_PLUS;
+            g_node_append(node, g_node_new(ast_node_new(T_IDENTIFIER, name)));
+            g_node_append(node, g_node_new(ast_node_new(T_NUMBER,
+                                                        g_strdup_printf("%d", offset))));
+            ast_node->data = NULL;
+        }
+
+        return;
+    }
+
+    for (child = node->children; child; child = child->next)
+        unroll_substitute(child, name, offset, value, constant);
+}
+
+/*
+ * Inserts into ``parent'', before ``sibling'', a copy of the body of ``loop'',
+ * which ends at ``last'', with the reads of its variable replaced (see
+ * unroll_substitute()).
+ */
+static void
+unroll_copy(GNode *loop, GNode *last, GNode *parent, GNode *sibling,
+            gint offset, gint value, gboolean constant)
+{
+    GNode *body, *copy;
+    gchar *name = ((ASTNode *)loop->children->data)->data;
+
+    for (body = loop->children->next->next->next; body; body = body->next) {
+        copy = ast_copy(body);
+        unroll_substitute(copy, name, offset, value, constant);
+        g_node_insert_before(parent, sibling, copy);
+
+        if (body == last)
+            break;
+    }
+}
+
+static gint
+unroll_body_size(GNode *loop)
+{
+    GNode *body;
+    gint size = 0;
+
+    for (body = loop->children->next->next->next; body; body = body->next)
+        size += g_node_n_nodes(body, G_TRAVERSE_ALL);
+
+    return size;
+}
+
+static void
+unroll_set_value(GNode *node, gint value)
+{
+    GNode *parent = node->parent, *number;
+
+    number = g_node_new(ast_node_new(T_NUMBER, g_strdup_printf("%d", value)));
+    g_node_insert_before(parent, node, number);
+    g_node_destroy(node);
+}
+
+/* unrolls ``loop'', returning whether it was replaced by copies of its body */
+static gboolean
+unroll_loop(GNode *loop)
+{
+    GNode *var = loop->children, *cond = var->next, *step = cond->next, *body;
+    GNode *last = g_node_last_child(loop);
+    gchar *name = ((ASTNode *)var->data)->data;
+    gint start, increment, trips, size, factor, i, v, test;
+    Symbol *symbol;
+
+    if (!step->next)
+        return FALSE;
+
+    if (!unroll_eval(var->children, NULL, 0, &start) ||
+        !unroll_eval(step, NULL, 0, &increment) ||
+        increment < LDC_MIN || increment > LDC_MAX)
+        return FALSE;
+
+    symbol = symbol_table_lookup_symbol(symbol_table, name);
+    for (body = step->next; body; body = body->next) {
+        if (unroll_uses(body, symbol))
+            return FALSE;
+    }
+
+    for (trips = 0, v = start; trips <= UNROLL_MAX_COUNT; trips++, v += increment) {
+        if (!unroll_eval(cond, name, v, &test))
+            return FALSE;
+
+        if (!test)
+            break;
+    }
+
+    /* the variable only goes from ``start'' to ``v'': both must fit LDC */
+    if (!trips || trips > UNROLL_MAX_COUNT ||
+        start < LDC_MIN || start > LDC_MAX || v < LDC_MIN || v > LDC_MAX)
+        return FALSE;
+
+    size = unroll_body_size(loop);
+
+    if (trips <= UNROLL_MAX_TRIPS && trips * size <= UNROLL_MAX_SIZE) {
+        for (i = 0, v = start; i < trips; i++, v += increment)
+            unroll_copy(loop, last, loop->parent, loop, 0, v, TRUE);
+
+        /* the value the variable has after the loop */
+        unroll_set_value(var->children, v);
+        g_node_unlink(var);
+        g_node_insert_before(loop->parent, loop, var);
+
+        return TRUE;
+    }
+
+    for (factor = UNROLL_FACTOR; factor > 1 && factor * size > UNROLL_MAX_SIZE; factor--)
+        ;
+
+    if (factor < 2 || trips < 2 * factor ||
+        factor * increment < LDC_MIN || factor * increment > LDC_MAX)
+        return FALSE;
+
+    /* the iterations left over go before the loop */
+    for (i = 0, v = start; i < trips % factor; i++, v += increment)
+        unroll_copy(loop, last, loop->parent, loop, 0, v, TRUE);
+
+    unroll_set_value(var->children, v);
+
+    for (i = 1; i < factor; i++)
+        unroll_copy(loop, last, loop, NULL, i * increment, 0, FALSE);
+
+    unroll_set_value(step, factor * increment);
+    changes++;
+
+    return FALSE;
+}
+
+static void
+unroll_traverse(GNode *node)
+{
+    GNode *child, *next;
+    ASTNode *ast_node;
+
+    for (child = node->children; child; child = next) {
+        next = child->next;
+        ast_node = (ASTNode *)child->data;
+
+        switch (ast_node->token) {
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+              unroll_traverse(child);
+              symbol_table_context_leave(symbol_table);
+              break;
+          case T_FOR:
+              /* inner loops first */
+              unroll_traverse(child);
+
+              if (unroll_loop(child)) {
+                  g_node_destroy(child);
+                  changes++;
+              }
+              break;
+          case T_WHILE:
+          case T_IF:
+          case T_ELSE:
+              unroll_traverse(child);
+              break;
+          default:
+              ;
+        }
+    }
+}
+
+gint
+unroll_loops(GNode *ast)
+{
+    gint unrolled;
+
+    changes = 0;
+    modref_update(ast);
+
+    symbol_table_context_reset(symbol_table);
+    unroll_traverse(ast);
+
+    /* the loop variable becomes a constant in unrolled loops */
+    unrolled = changes;
+    fold_all_constants(ast);
+
+    return unrolled;
+}
+
+/*
+ * Loop-invariant code motion
+ *
+ * Expressions inside "enquanto" and "para" loops that only read variables
+ * not written by the loop are computed once, before the loop, into
+ * temporaries of the enclosing procedure.
+ */
+
+typedef struct _LoopInfo LoopInfo;
+
+struct _LoopInfo {
+    GNode       *loop;
+    GSList      *written;       /* Symbol * written inside the loop */
+    GSList      *callees;       /* Symbol * called inside the loop */
+    GSList      *hoisted;       /* T_ATTRIB nodes of the temporaries */
+};
+
+static PER_THREAD GNode *licm_scope = NULL;
+
+static void
+licm_collect_writes(GNode *node, LoopInfo *info)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+    Symbol *symbol;
+
+    switch (ast_node->token) {
+      case T_ATTRIB:
+      case T_READ:
+          symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+          if (symbol && !g_slist_find(info->written, symbol))
+              info->written = g_slist_prepend(info->written, symbol);
+          break;
+      default:
+          ;
+    }
+
+    for (child = node->children; child; child = child->next)
+        licm_collect_writes(child, info);
+}
+
+static gboolean
+licm_is_invariant(GNode *node, LoopInfo *info)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+    Symbol *symbol;
+
+    switch (ast_node->token) {
+      case T_NUMBER:
+      case T_TRUE:
+      case T_FALSE:
+          return TRUE;
+      case T_IDENTIFIER:
+          symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+
+          if (!symbol || g_slist_find(info->written, symbol))
+              return FALSE;
+
+          return !calls_may_write(info->callees, symbol);
+      case T_FUNCTION_CALL:
+          return FALSE;
+      case T_DIVIDE:
+          /* don't move a possible division by zero before the loop test */
+          child = node->children->next;
+          if (node_token(child) != T_NUMBER || atoi((gchar *)((ASTNode *)child->data)->data) == 0)
+              return FALSE;
+          /* fall through */
+      default:
+          for (child = node->children; child; child = child->next) {
+              if (!licm_is_invariant(child, info))
+                  return FALSE;
+          }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+licm_expression_equal(GNode *a, GNode *b)
+{
+    ASTNode *an = (ASTNode *)a->data, *bn = (ASTNode *)b->data;
+
+    if (an->token != bn->token)
+        return FALSE;
+
+    if (an->data != bn->data &&
+        (!an->data || !bn->data || !g_str_equal(an->data, bn->data)))
+        return FALSE;
+
+    for (a = a->children, b = b->children; a && b; a = a->next, b = b->next) {
+        if (!licm_expression_equal(a, b))
+            return FALSE;
+    }
+
+    return a == b;
+}
+
+static void
+licm_hoist(GNode *expr, LoopInfo *info)
+{
+    GSList *h;
+    GNode *attrib;
+    gchar *name = NULL;
+
+    for (h = info->hoisted; h; h = h->next) {
+        attrib = (GNode *)h->data;
+
+        if (licm_expression_equal(attrib->children, expr)) {
+            name = (gchar *)((ASTNode *)attrib->data)->data;
+            break;
+        }
+    }
+
+    g_node_insert_before(expr->parent, expr,
+                         g_node_new(ast_node_new(T_IDENTIFIER, name)));
+    changes++;
+
+    if (name) {
+        ((ASTNode *)expr->prev->data)->data = name;
+        g_node_unlink(expr);
+        g_node_destroy(expr);
+        return;
+    }
+
+    name = temp_new(licm_scope, ast_node_subtype(expr));
+    ((ASTNode *)expr->prev->data)->data = name;
+    g_node_unlink(expr);
+
+    attrib = g_node_new(ast_node_new(T_ATTRIB, name));
+    g_node_append(attrib, expr);
+    g_node_insert_before(info->loop->parent, info->loop, attrib);
+
+    info->hoisted = g_slist_append(info->hoisted, attrib);
+}
+
+static void
+licm_expression(GNode *expr, LoopInfo *info)
+{
+    GNode *child, *next;
+
+    if (G_NODE_IS_LEAF(expr))
+        return;
+
+    if (licm_is_invariant(expr, info)) {
+        licm_hoist(expr, info);
+        return;
+    }
+
+    for (child = expr->children; child; child = next) {
+        next = child->next;
+        licm_expression(child, info);
+    }
+}
+
+static void licm_statement(GNode *stmt, LoopInfo *info);
+
+/*
+ * Visits the parts of a loop that run on every iteration: the condition,
+ * the step of a "para" and the body.
+ */
+static void
+licm_loop_parts(GNode *loop, LoopInfo *info)
+{
+    GNode *child, *next, *body;
+
+    if (node_token(loop) == T_FOR) {
+        licm_expression(loop->children->next, info);
+        licm_expression(loop->children->next->next, info);
+        body = loop->children->next->next->next;
+    } else {
+        licm_expression(loop->children, info);
+        body = loop->children->next;
+    }
+
+    for (child = body; child; child = next) {
+        next = child->next;
+        licm_statement(child, info);
+    }
+}
+
+static void
+licm_statement(GNode *stmt, LoopInfo *info)
+{
+    GNode *child, *next;
+
+    switch (node_token(stmt)) {
+      case T_ATTRIB:
+      case T_FUNCTION_RETURN:
+          licm_expression(stmt->children, info);
+          return;
+      case T_FOR:
+          licm_statement(stmt->children, info);
+          /* fall through */
+      case T_WHILE:
+          licm_loop_parts(stmt, info);
+          return;
+      case T_IF:
+          licm_expression(stmt->children, info);
+          child = stmt->children->next;
+          break;
+      case T_ELSE:
+          child = stmt->children;
+          break;
+      default:
+          return;
+    }
+
+    for (; child; child = next) {
+        next = child->next;
+        licm_statement(child, info);
+    }
+}
+
+static void
+licm_loop(GNode *loop)
+{
+    LoopInfo info = { loop, NULL, NULL, NULL };
+    GNode *child, *next, *body;
+
+    licm_collect_writes(loop, &info);
+    collect_callees(loop, &info.callees);
+
+    /* temporaries hoisted from inner loops may be invariant here as well */
+    body = node_token(loop) == T_FOR ? loop->children->next->next->next
+                                     : loop->children->next;
+    for (child = body; child; child = next) {
+        ASTNode *ast_node = (ASTNode *)child->data;
+
+        next = child->next;
+
+        if (ast_node->token == T_ATTRIB && is_temp(ast_node->data) &&
+            licm_is_invariant(child->children, &info)) {
+            g_node_unlink(child);
+            g_node_insert_before(loop->parent, loop, child);
+
+            info.written = g_slist_remove(info.written,
+                symbol_table_lookup_symbol(symbol_table, ast_node->data));
+        }
+    }
+
+    /* the start value of a "para" is evaluated only once */
+    licm_loop_parts(loop, &info);
+
+    g_slist_free(info.written);
+    g_slist_free(info.callees);
+    g_slist_free(info.hoisted);
+}
+
+static void
+licm_traverse(GNode *node)
+{
+    GNode *child, *next, *scope;
+    ASTNode *ast_node;
+
+    for (child = node->children; child; child = next) {
+        next = child->next;
+        ast_node = (ASTNode *)child->data;
+
+        switch (ast_node->token) {
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              scope = licm_scope;
+              licm_scope = child;
+
+              symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+              licm_traverse(child);
+              symbol_table_context_leave(symbol_table);
+
+              licm_scope = scope;
+              break;
+          case T_WHILE:
+          case T_FOR:
+              /* inner loops first, so their temporaries can move further out */
+              licm_traverse(child);
+              licm_loop(child);
+              break;
+          case T_IF:
+          case T_ELSE:
+              licm_traverse(child);
+              break;
+          default:
+              ;
+        }
+    }
+}
+
+gint
+hoist_loop_invariants(GNode *ast)
+{
+    changes = 0;
+    modref_update(ast);
+
+    symbol_table_context_reset(symbol_table);
+
+    licm_scope = ast;
+    licm_traverse(ast);
+    licm_scope = NULL;
+
+    return changes;
+}
+
+/*
+ * Common subexpression elimination
+ *
+ * Local value numbering over the basic blocks of each procedure: runs of
+ * assignments, "leia", "escreva" and procedure calls, up to the condition of
+ * a "se" or the start of a loop. An expression computed again in the same
+ * block, with none of its variables written in between, reuses the value:
+ * from the variable it was assigned to, if that wasn't written either, or
+ * from a temporary assigned before the statement that first computed it,
+ * when this makes the code shorter. The two operands of a binary operator
+ * that are the same expression are computed once and duplicated with DUP.
+ *
+ * Values read from variables the callees may write (see calls_may_write())
+ * are forgotten around statements with calls, and such statements don't
+ * create new values.
+ */
+
+typedef struct _CSEValue CSEValue;
+
+struct _CSEValue {
+    GNode       *expr;          /* first occurrence */
+    Symbol      *holder;        /* variable assigned the value, if any */
+    GSList      *operands;      /* Symbol * read by the expression */
+    GSList      *uses;          /* later occurrences, if there's no holder */
+};
+
+static PER_THREAD GNode *cse_scope = NULL;
+static PER_THREAD CSEStats *cse_current = NULL;
+
+static gboolean
+has_calls(GNode *node)
+{
+    GNode *child;
+
+    if (node_token(node) == T_FUNCTION_CALL)
+        return TRUE;
+
+    for (child = node->children; child; child = child->next) {
+        if (has_calls(child))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+cse_collect_operands(GNode *node, GSList **operands)
+{
+    GNode *child;
+    Symbol *symbol;
+
+    if (node_token(node) == T_IDENTIFIER) {
+        symbol = symbol_table_lookup_symbol(symbol_table,
+                                            (gchar *)((ASTNode *)node->data)->data);
+        if (!g_slist_find(*operands, symbol))
+            *operands = g_slist_prepend(*operands, symbol);
+        return;
+    }
+
+    for (child = node->children; child; child = child->next)
+        cse_collect_operands(child, operands);
+}
+
+static GNode *
+cse_statement_of(GNode *expr)
+{
+    for (;;) {
+        expr = expr->parent;
+
+        switch (node_token(expr)) {
+          case T_ATTRIB:
+          case T_FUNCTION_RETURN:
+          case T_PROCEDURE_CALL:
+          case T_TAIL_CALL:
+          case T_IF:
+              return expr;
+          default:
+              ;
+        }
+    }
+}
+
+static void
+cse_replace(GNode *expr, gchar *name)
+{
+    g_node_insert_before(expr->parent, expr,
+                         g_node_new(ast_node_new(T_IDENTIFIER, name)));
+    g_node_unlink(expr);
+    g_node_destroy(expr);
+
+    cse_current->eliminated++;
+    changes++;
+}
+
+/*
+ * Ends the life of a value. If it was computed more than once and has no
+ * holder, it goes to a temporary when "$t := e" plus an identifier for each
+ * occurrence has less nodes than the occurrences themselves. The assignment
+ * goes right before the statement computing it first, which may itself be
+ * the assignment of a temporary made from a value recorded later.
+ */
+static void
+cse_value_free(CSEValue *value)
+{
+    GNode *attrib, *stmt;
+    GSList *u;
+    gchar *name;
+    gint cost, n_uses;
+
+    n_uses = g_slist_length(value->uses);
+    cost = g_node_n_nodes(value->expr, G_TRAVERSE_ALL);
+
+    if (n_uses && cost * n_uses > n_uses + 2) {
+        name = temp_new(cse_scope, ast_node_subtype(value->expr));
+        stmt = cse_statement_of(value->expr);
+
+        g_node_insert_before(value->expr->parent, value->expr,
+                             g_node_new(ast_node_new(T_IDENTIFIER, name)));
+        g_node_unlink(value->expr);
+
+        attrib = g_node_new(ast_node_new(T_ATTRIB, name));
+        g_node_append(attrib, value->expr);
+        g_node_insert_before(stmt->parent, stmt, attrib);
+
+        for (u = value->uses; u; u = u->next)
+            cse_replace((GNode *)u->data, name);
+    }
+
+    g_slist_free(value->uses);
+    g_slist_free(value->operands);
+    g_free(value);
+}
+
+static gboolean
+cse_call_may_change(CSEValue *value, GSList *callees)
+{
+    GSList *l;
+
+    if (value->holder && calls_may_write(callees, value->holder))
+        return TRUE;
+
+    for (l = value->operands; l; l = l->next) {
+        if (calls_may_write(callees, (Symbol *)l->data))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Forgets the values that depend on ``symbol'' (if not NULL) or on variables
+ * a call to one of ``callees'' may write. With neither, forgets everything.
+ * Values are kept in the order they were recorded, so the temporaries of
+ * subexpressions are assigned before the ones of the expressions using them.
+ */
+static GSList *
+cse_kill(GSList *values, Symbol *symbol, GSList *callees)
+{
+    GSList *l, *alive = NULL;
+
+    for (l = values; l; l = l->next) {
+        CSEValue *value = (CSEValue *)l->data;
+
+        if ((!symbol && !callees) ||
+            (symbol && (value->holder == symbol || g_slist_find(value->operands, symbol))) ||
+            cse_call_may_change(value, callees)) {
+            cse_value_free(value);
+        } else {
+            alive = g_slist_append(alive, value);
+        }
+    }
+
+    g_slist_free(values);
+
+    return alive;
+}
+
+static gboolean
+cse_is_binop(TokenType token)
+{
+    switch (token) {
+      case T_PLUS:
+      case T_MINUS:
+      case T_MULTIPLY:
+      case T_DIVIDE:
+      case T_OP_EQUAL:
+      case T_OP_DIFFERENT:
+      case T_OP_GT:
+      case T_OP_GEQ:
+      case T_OP_LT:
+      case T_OP_LEQ:
+          return TRUE;
+      default:
+          return FALSE;
+    }
+}
+
+/*
+ * "e" and "ou" are left out: in conditions, they are compiled to jumps and
+ * there would be nothing on the stack to duplicate.
+ */
+static void
+cse_duplicates(GNode *expr)
+{
+    GNode *child, *left, *right;
+
+    for (child = expr->children; child; child = child->next)
+        cse_duplicates(child);
+
+    if (!cse_is_binop(node_token(expr)))
+        return;
+
+    left = expr->children;
+    right = left->next;
+
+    if (!G_NODE_IS_LEAF(left) && !has_calls(left) && licm_expression_equal(left, right)) {
+        g_node_unlink(right);
+        g_node_destroy(right);
+        g_node_append(expr, g_node_new(ast_node_new(T_DUP, NULL)));
+
+        cse_current->eliminated++;
+        changes++;
+    }
+}
+
+/*
+ * Numbers the subexpressions of ``expr'', replacing the ones already known.
+ * New values are only recorded if ``record'' is set, and not if they contain
+ * an occurrence of a value that may still become a temporary (its assignment
+ * would have to come after theirs). Returns whether ``expr'' has any.
+ */
+static gboolean
+cse_expression(GNode *expr, GSList **values, gboolean record)
+{
+    CSEValue *value;
+    GNode *child, *next;
+    GSList *l;
+    gboolean pure, pending = FALSE;
+
+    if (G_NODE_IS_LEAF(expr))
+        return FALSE;
+
+    pure = !has_calls(expr);
+
+    if (pure) {
+        for (l = *values; l; l = l->next) {
+            value = (CSEValue *)l->data;
+
+            if (licm_expression_equal(value->expr, expr)) {
+                if (value->holder) {
+                    cse_replace(expr, value->holder->name);
+                    return FALSE;
+                }
+
+                value->uses = g_slist_append(value->uses, expr);
+                return TRUE;
+            }
+        }
+    }
+
+    for (child = expr->children; child; child = next) {
+        next = child->next;
+
+        /* in conditions, the right operand of "e" and "ou" may be skipped */
+        if (child != expr->children &&
+            (node_token(expr) == T_AND || node_token(expr) == T_OR))
+            record = FALSE;
+
+        pending |= cse_expression(child, values, record);
+    }
+
+    if (record && pure && !pending) {
+        value = g_new0(CSEValue, 1);
+        value->expr = expr;
+        cse_collect_operands(expr, &value->operands);
+
+        *values = g_slist_append(*values, value);
+    }
+
+    return pending;
+}
+
+/*
+ * Numbers the expressions of ``stmt'': its children, or the condition of a
+ * "se". A procedure call statement is made after its arguments.
+ */
+static void
+cse_statement_expressions(GNode *stmt, GSList **values)
+{
+    GNode *child, *next, *last;
+    GSList *callees = NULL;
+
+    last = node_token(stmt) == T_IF ? stmt->children->next : NULL;
+
+    for (child = stmt->children; child != last; child = child->next)
+        collect_callees(child, &callees);
+
+    if (callees)
+        *values = cse_kill(*values, NULL, callees);
+
+    for (child = stmt->children; child != last; child = next) {
+        next = child->next;
+
+        cse_duplicates(child);
+        cse_expression(child, values, !callees);
+    }
+
+    if (node_token(stmt) == T_PROCEDURE_CALL) {
+        g_slist_free(callees);
+        callees = NULL;
+        collect_callees(stmt, &callees);
+    }
+
+    if (callees)
+        *values = cse_kill(*values, NULL, callees);
+
+    g_slist_free(callees);
+}
+
+static void cse_subroutine(GNode *node);
+
+static void
+cse_statements(GNode *stmt)
+{
+    GSList *values = NULL;
+    CSEValue *value;
+    GNode *next;
+    Symbol *symbol;
+
+    for (; stmt; stmt = next) {
+        ASTNode *ast_node = (ASTNode *)stmt->data;
+
+        next = stmt->next;
+
+        switch (ast_node->token) {
+          case T_ATTRIB:
+              cse_statement_expressions(stmt, &values);
+
+              symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+              values = cse_kill(values, symbol, NULL);
+
+              /* the variable now holds the value just computed */
+              value = values ? (CSEValue *)g_slist_last(values)->data : NULL;
+              if (value && value->expr == stmt->children)
+                  value->holder = symbol;
+              break;
+          case T_FUNCTION_RETURN:
+              cse_statement_expressions(stmt, &values);
+              break;
+          case T_READ:
+              symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+              values = cse_kill(values, symbol, NULL);
+              break;
+          case T_PROCEDURE_CALL:
+              cse_statement_expressions(stmt, &values);
+              break;
+          case T_TAIL_CALL:
+              cse_statement_expressions(stmt, &values);
+              values = cse_kill(values, NULL, NULL);
+              break;
+          case T_IF:
+              cse_statement_expressions(stmt, &values);
+              values = cse_kill(values, NULL, NULL);
+              cse_statements(stmt->children->next);
+              break;
+          case T_ELSE:
+              values = cse_kill(values, NULL, NULL);
+              cse_statements(stmt->children);
+              break;
+          case T_WHILE:
+              values = cse_kill(values, NULL, NULL);
+              cse_statements(stmt->children->next);
+              break;
+          case T_FOR:
+              values = cse_kill(values, NULL, NULL);
+              cse_statements(stmt->children->next->next->next);
+              break;
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              cse_subroutine(stmt);
+              break;
+          default:
+              ;
+        }
+    }
+
+    cse_kill(values, NULL, NULL);
+}
+
+/*
+ * Size of the statements of a procedure, not counting declarations and
+ * nested procedures.
+ */
+static gint
+cse_size(GNode *node)
+{
+    GNode *child;
+    gint size = 0;
+
+    for (child = node->children; child; child = child->next) {
+        switch (node_token(child)) {
+          case T_VAR:
+          case T_PROCEDURE:
+          case T_FUNCTION:
+              break;
+          default:
+              size += g_node_n_nodes(child, G_TRAVERSE_ALL);
+        }
+    }
+
+    return size;
+}
+
+static void
+cse_subroutine(GNode *node)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    CSEStats *stats, *outer_stats = cse_current;
+    GNode *outer_scope = cse_scope;
+
+    stats = g_new0(CSEStats, 1);
+    stats->name = (gchar *)ast_node->data;
+    stats->size = cse_size(node);
+    cse_stats = g_slist_append(cse_stats, stats);
+
+    if (node_token(node) != T_PROGRAM)
+        symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+
+    cse_scope = node;
+    cse_current = stats;
+    cse_statements(node->children);
+    cse_scope = outer_scope;
+    cse_current = outer_stats;
+
+    if (node_token(node) != T_PROGRAM)
+        symbol_table_context_leave(symbol_table);
+
+    stats->saved = stats->size - cse_size(node);
+}
+
+gint
+eliminate_common_subexpressions(GNode *ast)
+{
+    GSList *l;
+
+    changes = 0;
+    modref_update(ast);
+
+    for (l = cse_stats; l; l = l->next)
+        g_free(l->data);
+    g_slist_free(cse_stats);
+    cse_stats = NULL;
+
+    symbol_table_context_reset(symbol_table);
+    cse_subroutine(ast);
+
+    return changes;
+}
+
+/*
+ * Multiway branches
+ *
+ * Chains of "se x = 1 entao ... senao se x = 2 entao ..." comparing the
+ * same variable against constants are replaced by a T_SWITCH node: the
+ * variable, followed by a T_CASE node (with the key as data) holding the
+ * statements of each "se", and the final "senao", if any. The code generator
+ * dispatches through a jump table when the keys are dense, or with a binary
+ * search on them otherwise (see generate_switch() in codegen.c). Shorter
+ * chains are cheaper as they are.
+ */
+
+#define SWITCH_MIN_CASES 4
+
+/* the variable and key of a condition like "x = 1" or "1 = x" */
+static gboolean
+switch_key(GNode *cond, GNode **var, GNode **key)
+{
+    GNode *left, *right;
+
+    if (node_token(cond) != T_OP_EQUAL)
+        return FALSE;
+
+    left = cond->children;
+    right = left->next;
+
+    if (node_token(left) == T_NUMBER) {
+        GNode *tmp = left;
+
+        left = right;
+        right = tmp;
+    }
+
+    if (node_token(left) != T_IDENTIFIER || node_token(right) != T_NUMBER)
+        return FALSE;
+
+    *var = left;
+    *key = right;
+
+    return TRUE;
+}
+
+/* the "se" of a "senao se", if ``stmt'' has one */
+static GNode *
+switch_next(GNode *stmt)
+{
+    GNode *last = g_node_last_child(stmt);
+
+    if (node_token(last) == T_ELSE && last->children &&
+        !last->children->next && node_token(last->children) == T_IF)
+        return last->children;
+
+    return NULL;
+}
+
+static gint
+switch_key_value(GNode *key)
+{
+    return atoi((gchar *)((ASTNode *)key->data)->data);
+}
+
+/* how many distinct keys the chain starting at ``stmt'' compares ``name'' to */
+static gint
+switch_count(GNode *stmt, gchar *name)
+{
+    GSList *keys = NULL;
+    GNode *var, *key;
+    gint n_keys = 0;
+
+    for (; stmt && switch_key(stmt->children, &var, &key); stmt = switch_next(stmt)) {
+        gint value = switch_key_value(key);
+
+        if (!g_str_equal(((ASTNode *)var->data)->data, name))
+            break;
+
+        if (!g_slist_find(keys, GINT_TO_POINTER(value))) {
+            keys = g_slist_prepend(keys, GINT_TO_POINTER(value));
+            n_keys++;
+        }
+    }
+
+    g_slist_free(keys);
+
+    return n_keys;
+}
+
+static GNode *
+switch_build(GNode *stmt)
+{
+    GNode *node, *var, *key, *next, *n;
+    gchar *name;
+    gint n_cases;
+
+    if (!switch_key(stmt->children, &var, &key))
+        return NULL;
+
+    name = ((ASTNode *)var->data)->data;
+    n_cases = switch_count(stmt, name);
+
+    if (n_cases < SWITCH_MIN_CASES)
+        return NULL;
+
+    node = g_node_new(ast_node_new(T_SWITCH, NULL));
+    g_node_append(node, g_node_new(ast_node_new(T_IDENTIFIER, name)));
+
+    for (; n_cases; stmt = next) {
+        GNode *c;
+
+        switch_key(stmt->children, &var, &key);
+        next = switch_next(stmt);
+
+        /* a key already seen never matches again */
+        for (c = node->children->next; c; c = c->next) {
+            if (atoi(((ASTNode *)c->data)->data) == switch_key_value(key))
+                break;
+        }
+
+        if (!c) {
+            c = g_node_append(node, g_node_new(ast_node_new(T_CASE,
+                                                            ((ASTNode *)key->data)->data)));
+            n_cases--;
+
+            while ((n = stmt->children->next) && node_token(n) != T_ELSE) {
+                g_node_unlink(n);
+                g_node_append(c, n);
+            }
+        }
+
+        if (!n_cases) {
+            /* whatever is left of the chain runs when no key matches */
+            n = g_node_last_child(stmt);
+
+            if (node_token(n) == T_ELSE) {
+                g_node_unlink(n);
+                g_node_append(node, n);
+            }
+        }
+    }
+
+    return node;
+}
+
+static void
+switch_traverse(GNode *node)
+{
+    GNode *child, *sw;
+
+    for (child = node->children; child; child = child->next) {
+        if (node_token(child) == T_IF && (sw = switch_build(child))) {
+            g_node_insert_before(node, child, sw);
+            g_node_unlink(child);
+            g_node_destroy(child);
+
+            child = sw;
+            changes++;
+        }
+
+        switch_traverse(child);
+    }
+}
+
+gint
+lower_switches(GNode *ast)
+{
+    changes = 0;
+    switch_traverse(ast);
+
+    return changes;
+}
+
+/*
+ * If-conversion
+ *
+ * A "se c entao x := a senao x := b" where evaluating a and b has no side
+ * effects and costs little becomes "x := T_SELECT(c, a, b)", evaluated
+ * without jumps by the SEL instruction. Both values are always computed,
+ * so they can't have calls or divisions that may fail.
+ */
+
+#define SELECT_MAX_COST 4	/* nodes of both values together */
+
+/* whether ``expr'' can be evaluated even when its value isn't needed */
+static gboolean
+select_is_safe(GNode *expr)
+{
+    GNode *child;
+
+    switch (node_token(expr)) {
+      case T_FUNCTION_CALL:
+          return FALSE;
+      case T_DIVIDE:
+          child = expr->children->next;
+          if (node_token(child) != T_NUMBER || atoi((gchar *)((ASTNode *)child->data)->data) == 0)
+              return FALSE;
+          break;
+      default:
+          ;
+    }
+
+    for (child = expr->children; child; child = child->next) {
+        if (!select_is_safe(child))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* the assignment replacing ``stmt'', or NULL if it can't be converted */
+static GNode *
+select_build(GNode *stmt)
+{
+    GNode *cond = stmt->children, *then, *otherwise, *a, *b, *select;
+    ASTNode *then_node, *else_node;
+
+    then = cond->next;
+    otherwise = then ? then->next : NULL;
+
+    if (!otherwise || otherwise->next || node_token(otherwise) != T_ELSE ||
+        !otherwise->children || otherwise->children->next)
+        return NULL;
+
+    otherwise = otherwise->children;
+    then_node = (ASTNode *)then->data;
+    else_node = (ASTNode *)otherwise->data;
+
+    if ((then_node->token != T_ATTRIB && then_node->token != T_FUNCTION_RETURN) ||
+        then_node->token != else_node->token ||
+        !g_str_equal(then_node->data, else_node->data))
+        return NULL;
+
+    a = then->children;
+    b = otherwise->children;
+
+    if (has_calls(cond) || !select_is_safe(a) || !select_is_safe(b) ||
+        g_node_n_nodes(a, G_TRAVERSE_ALL) + g_node_n_nodes(b, G_TRAVERSE_ALL) > SELECT_MAX_COST)
+        return NULL;
+
+    select = g_node_new(ast_node_new(T_SELECT, NULL));
+
+    g_node_unlink(cond);
+    g_node_unlink(a);
+    g_node_unlink(b);
+    g_node_append(select, cond);
+    g_node_append(select, a);
+    g_node_append(select, b);
+
+    g_node_unlink(then);
+    g_node_append(then, select);
+
+    return then;
+}
+
+static void
+select_traverse(GNode *node)
+{
+    GNode *child, *attrib;
+
+    for (child = node->children; child; child = child->next) {
+        if (node_token(child) == T_IF && (attrib = select_build(child))) {
+            g_node_insert_before(node, child, attrib);
+            g_node_unlink(child);
+            g_node_destroy(child);
+
+            child = attrib;
+            changes++;
+            continue;
+        }
+
+        select_traverse(child);
+    }
+}
+
+gint
+convert_selects(GNode *ast)
+{
+    changes = 0;
+    select_traverse(ast);
+
+    return changes;
+}
+
+/*
+ * Value ranges
+ *
+ * The values each variable may hold are followed through the statements
+ * of every procedure, as an interval that may also exclude zero:
+ * assignments set it to the range of their expression, conditions of "se",
+ * "enquanto" and "para" narrow it in what they guard, the variable of a
+ * "para" only moves away from its start value, and reads and calls forget
+ * it (see calls_may_write()). Divisions by something that can't be zero
+ * become T_DIVIDE_UNCHECKED, generated as DIVU, which doesn't test the
+ * divisor.
+ */
+
+typedef struct _Range Range;
+
+struct _Range {
+    Symbol      *symbol;        /* NULL for the range of an expression */
+    gint64       lo, hi;
+    gboolean     nonzero;
+};
+
+#define RANGE_MIN ((gint64)G_MININT)
+#define RANGE_MAX ((gint64)G_MAXINT)
+
+static void
+range_full(Range *range)
+{
+    range->lo = RANGE_MIN;
+    range->hi = RANGE_MAX;
+    range->nonzero = FALSE;
+}
+
+static gboolean
+range_excludes_zero(Range *range)
+{
+    return range->nonzero || range->lo > 0 || range->hi < 0;
+}
+
+static Range *
+range_lookup(GSList *facts, Symbol *symbol)
+{
+    for (; facts; facts = facts->next) {
+        if (((Range *)facts->data)->symbol == symbol)
+            return (Range *)facts->data;
+    }
+
+    return NULL;
+}
+
+static void
+range_forget(GSList **facts, Symbol *symbol)
+{
+    Range *range = range_lookup(*facts, symbol);
+
+    if (range) {
+        *facts = g_slist_remove(*facts, range);
+        g_free(range);
+    }
+}
+
+static void
+range_set(GSList **facts, Symbol *symbol, Range *value)
+{
+    Range *range;
+
+    range_forget(facts, symbol);
+
+    if (value->lo == RANGE_MIN && value->hi == RANGE_MAX && !value->nonzero)
+        return;
+
+    range = g_new(Range, 1);
+    *range = *value;
+    range->symbol = symbol;
+
+    *facts = g_slist_prepend(*facts, range);
+}
+
+static GSList *
+range_copy(GSList *facts)
+{
+    GSList *copy = NULL;
+
+    for (; facts; facts = facts->next)
+        copy = g_slist_prepend(copy, g_memdup(facts->data, sizeof(Range)));
+
+    return copy;
+}
+
+static void
+range_free(GSList *facts)
+{
+    GSList *l;
+
+    for (l = facts; l; l = l->next)
+        g_free(l->data);
+    g_slist_free(facts);
+}
+
+/* what is known after either ``a'' or ``b''; both are freed */
+static GSList *
+range_join(GSList *a, GSList *b)
+{
+    GSList *joined = NULL, *l;
+    Range *ra, *rb, range;
+
+    for (l = a; l; l = l->next) {
+        ra = (Range *)l->data;
+
+        if (!(rb = range_lookup(b, ra->symbol)))
+            continue;
+
+        range.lo = MIN(ra->lo, rb->lo);
+        range.hi = MAX(ra->hi, rb->hi);
+        range.nonzero = range_excludes_zero(ra) && range_excludes_zero(rb);
+        range_set(&joined, ra->symbol, &range);
+    }
+
+    range_free(a);
+    range_free(b);
+
+    return joined;
+}
+
+/* forgets the variables ``node'' may write, or what it calls may */
+static void
+range_forget_writes(GSList **facts, GNode *node)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+    GSList *l, *next;
+    Symbol *symbol;
+
+    switch (ast_node->token) {
+      case T_ATTRIB:
+      case T_READ:
+          range_forget(facts, symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data));
+          break;
+      case T_PROCEDURE_CALL:
+      case T_FUNCTION_CALL:
+      case T_TAIL_CALL:
+          symbol = symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data);
+
+          for (l = *facts; l; l = next) {
+              next = l->next;
+
+              if (callgraph_may_write(modref, symbol, ((Range *)l->data)->symbol))
+                  range_forget(facts, ((Range *)l->data)->symbol);
+          }
+          break;
+      default:
+          ;
+    }
+
+    for (child = node->children; child; child = child->next)
+        range_forget_writes(facts, child);
+}
+
+/* whether ``node'' may write ``symbol'', even through what it calls */
+static gboolean
+range_may_write(GNode *node, Symbol *symbol)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GNode *child;
+
+    switch (ast_node->token) {
+      case T_ATTRIB:
+      case T_READ:
+          if (symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data) == symbol)
+              return TRUE;
+          break;
+      case T_PROCEDURE_CALL:
+      case T_FUNCTION_CALL:
+      case T_TAIL_CALL:
+          if (callgraph_may_write(modref,
+                                  symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data),
+                                  symbol))
+              return TRUE;
+          break;
+      default:
+          ;
+    }
+
+    for (child = node->children; child; child = child->next) {
+        if (range_may_write(child, symbol))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* products and quotients of the bounds of ``a'' and ``b'' */
+static void
+range_corners(Range *a, Range *b, TokenType op, Range *result)
+{
+    gint64 corners[4];
+    gint i;
+
+    for (i = 0; i < 4; i++) {
+        gint64 x = i & 1 ? a->hi : a->lo, y = i & 2 ? b->hi : b->lo;
+
+        corners[i] = op == T_MULTIPLY ? x * y : x / y;
+    }
+
+    result->lo = result->hi = corners[0];
+    for (i = 1; i < 4; i++) {
+        result->lo = MIN(result->lo, corners[i]);
+        result->hi = MAX(result->hi, corners[i]);
+    }
+}
+
+/*
+ * Range of the value of ``expr'', marking the divisions in it that can't be
+ * by zero. Values that may overflow have the full range.
+ */
+static void
+range_expression(GNode *expr, GSList *facts, Range *range)
+{
+    ASTNode *ast_node = (ASTNode *)expr->data;
+    Range a, b, *fact;
+    GNode *child;
+
+    range_full(range);
+
+    switch (ast_node->token) {
+      case T_NUMBER:
+          range->lo = range->hi = atoi((gchar *)ast_node->data);
+          return;
+      case T_TRUE:
+      case T_FALSE:
+          range->lo = range->hi = ast_node->token == T_TRUE;
+          return;
+      case T_IDENTIFIER:
+          fact = range_lookup(facts, symbol_table_lookup_symbol(symbol_table,
+                                                                (gchar *)ast_node->data));
+          if (fact)
+              *range = *fact;
+          return;
+      case T_SELECT:
+          range_expression(expr->children, facts, &a);
+          range_expression(expr->children->next, facts, &a);
+          range_expression(expr->children->next->next, facts, &b);
+
+          range->lo = MIN(a.lo, b.lo);
+          range->hi = MAX(a.hi, b.hi);
+          range->nonzero = range_excludes_zero(&a) && range_excludes_zero(&b);
+          return;
+      default:
+          ;
+    }
+
+    if (!expr->children || (expr->children->next && expr->children->next->next) ||
+        ast_node->token == T_FUNCTION_CALL) {
+        /* calls: the arguments may have divisions as well */
+        for (child = expr->children; child; child = child->next)
+            range_expression(child, facts, &a);
+        return;
+    }
+
+    range_expression(expr->children, facts, &a);
+
+    if (!expr->children->next) {
+        switch (ast_node->token) {
+          case T_UNARY_PLUS:
+              *range = a;
+              break;
+          case T_UNARY_MINUS:
+              range->lo = -a.hi;
+              range->hi = -a.lo;
+              range->nonzero = a.nonzero;
+              break;
+          case T_NOT:
+              range->lo = 0;
+              range->hi = 1;
+              break;
+          default:
+              ;
+        }
+    } else {
+        if (node_token(expr->children->next) == T_DUP)
+            b = a;
+        else
+            range_expression(expr->children->next, facts, &b);
+
+        switch (ast_node->token) {
+          case T_PLUS:
+              range->lo = a.lo + b.lo;
+              range->hi = a.hi + b.hi;
+              break;
+          case T_MINUS:
+              range->lo = a.lo - b.hi;
+              range->hi = a.hi - b.lo;
+              break;
+          case T_MULTIPLY:
+              range_corners(&a, &b, T_MULTIPLY, range);
+              range->nonzero = range_excludes_zero(&a) && range_excludes_zero(&b);
+              break;
+          case T_DIVIDE:
+              range_stats.divisions++;
+
+              if (!range_excludes_zero(&b))
+                  break;
+
+              ast_node->token = T_DIVIDE_UNCHECKED;
+              range_stats.unchecked++;
+
+              /* the quotient is largest when the divisor is closest to zero */
+              if (b.lo == 0)
+                  b.lo = 1;
+              if (b.hi == 0)
+                  b.hi = -1;
+              if (b.lo < 0 && b.hi > 0)
+                  b.lo = -1, b.hi = 1;
+              range_corners(&a, &b, T_DIVIDE, range);
+              break;
+          default:
+              /* relational and logic operators */
+              range->lo = 0;
+              range->hi = 1;
+          }
+    }
+
+    if (range->lo < RANGE_MIN || range->hi > RANGE_MAX || range->lo > range->hi)
+        range_full(range);
+}
+
+/* narrows ``facts'' to what is known when ``cond'' evaluates to ``truth'' */
+static void
+range_refine(GSList **facts, GNode *cond, gboolean truth)
+{
+    TokenType op = node_token(cond);
+    GNode *var, *other;
+    Range range, bound, *fact;
+    gint i;
+
+    switch (op) {
+      case T_NOT:
+          range_refine(facts, cond->children, !truth);
+          return;
+      case T_AND:
+      case T_OR:
+          /* both hold if "e" is true, or if "ou" is false */
+          if ((op == T_AND) == truth) {
+              range_refine(facts, cond->children, truth);
+              range_refine(facts, cond->children->next, truth);
+          }
+          return;
+      case T_OP_EQUAL:
+      case T_OP_DIFFERENT:
+      case T_OP_LT:
+      case T_OP_LEQ:
+      case T_OP_GT:
+      case T_OP_GEQ:
+          break;
+      default:
+          return;
+    }
+
+    /* either side may be the variable */
+    for (i = 0; i < 2; i++) {
+        var = i ? cond->children->next : cond->children;
+        other = i ? cond->children : cond->children->next;
+
+        if (node_token(var) != T_IDENTIFIER || !G_NODE_IS_LEAF(other) ||
+            node_token(other) == T_DUP)
+            continue;
+
+        op = node_token(cond);
+        if (i) {
+            /* "k < x" is "x > k" */
+            switch (op) {
+              case T_OP_LT:  op = T_OP_GT; break;
+              case T_OP_LEQ: op = T_OP_GEQ; break;
+              case T_OP_GT:  op = T_OP_LT; break;
+              case T_OP_GEQ: op = T_OP_LEQ; break;
+              default: ;
+            }
+        }
+
+        if (!truth) {
+            switch (op) {
+              case T_OP_EQUAL:     op = T_OP_DIFFERENT; break;
+              case T_OP_DIFFERENT: op = T_OP_EQUAL; break;
+              case T_OP_LT:        op = T_OP_GEQ; break;
+              case T_OP_LEQ:       op = T_OP_GT; break;
+              case T_OP_GT:        op = T_OP_LEQ; break;
+              case T_OP_GEQ:       op = T_OP_LT; break;
+              default: ;
+            }
+        }
+
+        range_expression(var, *facts, &range);
+        range_expression(other, *facts, &bound);
+
+        switch (op) {
+          case T_OP_EQUAL:
+              range.lo = MAX(range.lo, bound.lo);
+              range.hi = MIN(range.hi, bound.hi);
+              range.nonzero |= range_excludes_zero(&bound);
+              break;
+          case T_OP_DIFFERENT:
+              if (bound.lo != bound.hi)
+                  continue;
+              if (bound.lo == 0)
+                  range.nonzero = TRUE;
+              if (range.lo == bound.lo)
+                  range.lo++;
+              if (range.hi == bound.hi)
+                  range.hi--;
+              break;
+          case T_OP_LT:
+              range.hi = MIN(range.hi, bound.hi - 1);
+              break;
+          case T_OP_LEQ:
+              range.hi = MIN(range.hi, bound.hi);
+              break;
+          case T_OP_GT:
+              range.lo = MAX(range.lo, bound.lo + 1);
+              break;
+          case T_OP_GEQ:
+              range.lo = MAX(range.lo, bound.lo);
+              break;
+          default:
+              ;
+        }
+
+        /* never true: nothing after it runs, anything goes */
+        if (range.lo > range.hi)
+            continue;
+
+        fact = &range;
+        range_set(facts, symbol_table_lookup_symbol(symbol_table,
+                                                    (gchar *)((ASTNode *)var->data)->data),
+                  fact);
+    }
+}
+
+/*
+ * Narrows ``facts'' to what is known after ``cond'', a condition a statement
+ * tests, evaluates to ``truth''; a call in it may change what a comparison
+ * made before the call tested, so what calls may write is forgotten again.
+ */
+static void
+range_refine_condition(GSList **facts, GNode *cond, gboolean truth)
+{
+    range_refine(facts, cond, truth);
+
+    if (has_calls(cond))
+        range_forget_writes(facts, cond);
+}
+
+/* ranges of an expression evaluated by a statement, which may make calls */
+static void
+range_statement_expression(GNode *expr, GSList **facts, Range *range)
+{
+    if (has_calls(expr))
+        range_forget_writes(facts, expr);
+
+    range_expression(expr, *facts, range);
+}
+
+static void range_subroutine(GNode *node);
+static void range_statement(GNode *stmt, GSList **facts);
+
+/* runs ``stmt'' and the ones after it, up to the "senao" of a "se" */
+static void
+range_statements(GNode *stmt, GSList **facts)
+{
+    for (; stmt && node_token(stmt) != T_ELSE; stmt = stmt->next)
+        range_statement(stmt, facts);
+}
+
+static void
+range_loop(GNode *loop, GNode *cond, GNode *body, Symbol *var, Range *var_range,
+           GSList **facts)
+{
+    GSList *inside;
+    Range range;
+
+    /* what the loop writes may have any value when the test is made */
+    range_forget_writes(facts, loop);
+
+    if (var)
+        range_set(facts, var, var_range);
+
+    inside = range_copy(*facts);
+    range_statement_expression(cond, &inside, &range);
+    range_refine_condition(&inside, cond, TRUE);
+    range_statements(body, &inside);
+    range_free(inside);
+
+    range_refine_condition(facts, cond, FALSE);
+}
+
+static void
+range_statement(GNode *stmt, GSList **facts)
+{
+    ASTNode *ast_node = (ASTNode *)stmt->data;
+    GSList *then, *otherwise, *inside;
+    GNode *child, *last;
+    Symbol *symbol;
+    Range range, step, *fact;
+
+    switch (ast_node->token) {
+      case T_ATTRIB:
+          range_statement_expression(stmt->children, facts, &range);
+          range_set(facts, symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data),
+                    &range);
+          break;
+      case T_READ:
+          range_forget(facts, symbol_table_lookup_symbol(symbol_table, (gchar *)ast_node->data));
+          break;
+      case T_FUNCTION_RETURN:
+          range_statement_expression(stmt->children, facts, &range);
+          break;
+      case T_PROCEDURE_CALL:
+      case T_TAIL_CALL:
+          for (child = stmt->children; child; child = child->next)
+              range_statement_expression(child, facts, &range);
+
+          range_forget_writes(facts, stmt);
+          break;
+      case T_IF:
+          range_statement_expression(stmt->children, facts, &range);
+
+          then = range_copy(*facts);
+          range_refine_condition(&then, stmt->children, TRUE);
+          range_statements(stmt->children->next, &then);
+
+          otherwise = *facts;
+          range_refine_condition(&otherwise, stmt->children, FALSE);
+          last = g_node_last_child(stmt);
+          if (node_token(last) == T_ELSE)
+              range_statements(last->children, &otherwise);
+
+          *facts = range_join(then, otherwise);
+          break;
+      case T_SWITCH:
+          symbol = symbol_table_lookup_symbol(symbol_table,
+                                              (gchar *)((ASTNode *)stmt->children->data)->data);
+          otherwise = NULL;
+
+          for (child = stmt->children->next; child; child = child->next) {
+              then = range_copy(*facts);
+
+              if (node_token(child) == T_CASE) {
+                  range.lo = range.hi = atoi((gchar *)((ASTNode *)child->data)->data);
+                  range.nonzero = FALSE;
+                  range_set(&then, symbol, &range);
+              }
+
+              range_statements(child->children, &then);
+              otherwise = otherwise ? range_join(otherwise, then) : then;
+          }
+
+          /* no "senao": nothing runs if no key matches */
+          if (node_token(g_node_last_child(stmt)) != T_ELSE)
+              otherwise = range_join(otherwise, range_copy(*facts));
+
+          range_free(*facts);
+          *facts = otherwise;
+          break;
+      case T_WHILE:
+          range_loop(stmt, stmt->children, stmt->children->next, NULL, NULL, facts);
+          break;
+      case T_FOR:
+          /* start value */
+          range_statement(stmt->children, facts);
+
+          symbol = symbol_table_lookup_symbol(symbol_table,
+                                              (gchar *)((ASTNode *)stmt->children->data)->data);
+          if ((fact = range_lookup(*facts, symbol)))
+              range = *fact;
+          else
+              range_full(&range);
+
+          /* the step is evaluated after the body, so with what the loop writes */
+          inside = range_copy(*facts);
+          range_forget_writes(&inside, stmt);
+          range_statement_expression(stmt->children->next->next, &inside, &step);
+          range_free(inside);
+
+          /* the variable only moves away from where it started */
+          if (step.lo != step.hi || range_may_write(stmt->children->next, symbol)) {
+              range_full(&range);
+          } else {
+              for (child = stmt->children->next->next->next; child; child = child->next) {
+                  if (range_may_write(child, symbol))
+                      break;
+              }
+
+              if (child || !step.lo)
+                  range_full(&range);
+              else if (step.lo > 0)
+                  range.hi = RANGE_MAX;
+              else
+                  range.lo = RANGE_MIN;
+
+              range.nonzero = FALSE;
+          }
+
+          range_loop(stmt, stmt->children->next, stmt->children->next->next->next,
+                     symbol, &range, facts);
+          break;
+      case T_PROCEDURE:
+      case T_FUNCTION:
+          range_subroutine(stmt);
+          break;
+      default:
+          ;
+    }
+}
+
+static void
+range_subroutine(GNode *node)
+{
+    ASTNode *ast_node = (ASTNode *)node->data;
+    GSList *facts = NULL;
+
+    if (node_token(node) != T_PROGRAM)
+        symbol_table_context_enter(symbol_table, (gchar *)ast_node->data);
+
+    range_statements(node->children, &facts);
+    range_free(facts);
+
+    if (node_token(node) != T_PROGRAM)
+        symbol_table_context_leave(symbol_table);
+}
+
+gint
+remove_division_checks(GNode *ast)
+{
+    range_stats.divisions = range_stats.unchecked = 0;
+    modref_update(ast);
+
+    symbol_table_context_reset(symbol_table);
+    range_subroutine(ast);
+
+    return range_stats.unchecked;
+}
+
+/*
+ * Frees what the passes kept between them; called once all of them ran.
+ */
+void
+optimization_finish(void)
+{
+    modref_invalidate();
+}
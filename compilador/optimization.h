@@ -9,6 +9,36 @@
 
 #include <glib.h>
 
-void	optimize(GNode *ast_root);
+#include "compiler_context.h"
+
+typedef struct _CSEStats CSEStats;
+
+struct _CSEStats {
+	gchar	*name;		/* procedure, function or program */
+	gint	 eliminated;	/* expressions no longer computed */
+	gint	 size;		/* AST nodes of its statements, before */
+	gint	 saved;		/* ...and how many of them were removed */
+};
+
+typedef struct _RangeStats RangeStats;
+
+struct _RangeStats {
+	gint	 divisions;	/* "div" operators in the program */
+	gint	 unchecked;	/* ...whose divisor is known not to be zero */
+};
+
+/* each pass returns how many transformations it made (see passes.c) */
+gint	fold_all_constants(GNode *ast);
+gint	evaluate_pure_functions(GNode *ast);
+gint	inline_subroutines(GNode *ast);
+gint	eliminate_tail_calls(GNode *ast);
+gint	unroll_loops(GNode *ast);
+gint	hoist_loop_invariants(GNode *ast);
+gint	eliminate_common_subexpressions(GNode *ast);
+gint	lower_switches(GNode *ast);
+gint	convert_selects(GNode *ast);
+gint	remove_division_checks(GNode *ast);
+
+void	optimization_finish(void);
 
 #endif	/* __OPTIMIZATION_H__ */
@@ -0,0 +1,182 @@
+/*
+ * Simple Pascal Compiler
+ * Pass Manager
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ * Every optimization is a pass, enabled by the optimization level (a pass
+ * runs at its level and all the ones above it) or by -f<name>/-fno-<name>;
+ * passes of level 0 are only enabled by the latter, or by the options
+ * they need, such as --profile-use.
+ * AST passes rewrite the tree in the order they're listed here, and are
+ * timed and measured one by one; IR passes change how the code generator
+ * emits code, and only tell how many times they did (see pass_note()).
+ */
+#include <glib.h>
+#include <sys/time.h>
+
+#include "optimization.h"
+#include "passes.h"
+
+#define CALCTIME(start,end) 	((end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1e6))
+
+static const Pass pass_table[] = {
+  { "fold-constants", "Avaliação de expressões constantes",
+    PASS_AST, 1, fold_all_constants },
+  { "pure-functions", "Avaliação de funções puras",
+    PASS_AST, 1, evaluate_pure_functions },
+  { "inline", "Expansão de procedimentos",
+    PASS_AST, 2, inline_subroutines },
+  { "tail-calls", "Eliminação de chamadas de cauda",
+    PASS_AST, 1, eliminate_tail_calls },
+  { "unroll-loops", "Desenrolamento de laços",
+    PASS_AST, 3, unroll_loops },
+  { "licm", "Movimentação de código invariante",
+    PASS_AST, 1, hoist_loop_invariants },
+  { "cse", "Eliminação de subexpressões comuns",
+    PASS_AST, 1, eliminate_common_subexpressions },
+  { "jump-tables", "Tabelas de desvio",
+    PASS_AST, 1, lower_switches },
+  { "if-conversion", "Conversão de desvios em seleção",
+    PASS_AST, 1, convert_selects },
+  { "division-checks", "Remoção de testes de divisor zero",
+    PASS_AST, 1, remove_division_checks },
+
+  { "short-circuit", "Avaliação em curto-circuito",
+    PASS_IR, 1, NULL },
+  { "rotate-loops", "Rotação de laços",
+    PASS_IR, 1, NULL },
+  { "reorder-operands", "Reordenação de operandos",
+    PASS_IR, 1, NULL },
+  { "dead-procedures", "Remoção de procedimentos inalcançáveis",
+    PASS_IR, 1, NULL },
+  { "static-frames", "Registros de ativação estáticos",
+    PASS_IR, 1, NULL },
+  { "profile-layout", "Disposição do código guiada por perfil",
+    PASS_IR, 0, NULL },
+
+  { NULL }
+};
+
+/*
+ * A table of the passes, in pipeline order and ending with a NULL name, for
+ * a context to set up (see passes_setup()); free it with passes_free().
+ */
+Pass *
+passes_new(void)
+{
+  return g_memdup(pass_table, sizeof(pass_table));
+}
+
+void
+passes_free(Pass *table)
+{
+  g_free(table);
+}
+
+static Pass *
+pass_lookup(const gchar *name)
+{
+  Pass *pass;
+
+  for (pass = passes; pass->name; pass++) {
+    if (g_str_equal(pass->name, name))
+      return pass;
+  }
+
+  return NULL;
+}
+
+/*
+ * Enables the passes of optimization level ``level'', then applies the
+ * toggles, in order: a pass name enables it, and a name prefixed by "no-"
+ * disables it. Returns the first toggle that names no pass, or NULL.
+ */
+const gchar *
+passes_setup(gint level, GSList *toggles)
+{
+  Pass *pass;
+  const gchar *name;
+  gboolean enable;
+
+  for (pass = passes; pass->name; pass++) {
+    pass->enabled = pass->level && level >= pass->level;
+    pass->ran = FALSE;
+    pass->time = 0.0;
+    pass->nodes_before = pass->nodes_after = pass->changes = 0;
+  }
+
+  for (; toggles; toggles = toggles->next) {
+    name = (const gchar *)toggles->data;
+    enable = !g_str_has_prefix(name, "no-");
+
+    if (!(pass = pass_lookup(enable ? name : name + 3)))
+      return name;
+
+    pass->enabled = enable;
+  }
+
+  return NULL;
+}
+
+gboolean
+passes_enabled(PassKind kind)
+{
+  Pass *pass;
+
+  for (pass = passes; pass->name; pass++) {
+    if (pass->kind == kind && pass->enabled)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+gboolean
+pass_enabled(const gchar *name)
+{
+  Pass *pass = pass_lookup(name);
+
+  return pass && pass->enabled;
+}
+
+/*
+ * Counts ``changes'' transformations made by the IR pass ``name''.
+ */
+void
+pass_note(const gchar *name, gint changes)
+{
+  Pass *pass = pass_lookup(name);
+
+  g_return_if_fail(pass && pass->enabled);
+
+  pass->ran = TRUE;
+  pass->changes += changes;
+}
+
+/*
+ * Runs the enabled AST passes over ``ast''.
+ */
+void
+passes_run(GNode *ast)
+{
+  struct timeval tv_start, tv_end;
+  Pass *pass;
+
+  for (pass = passes; pass->name; pass++) {
+    if (pass->kind != PASS_AST || !pass->enabled)
+      continue;
+
+    pass->nodes_before = g_node_n_nodes(ast, G_TRAVERSE_ALL);
+
+    gettimeofday(&tv_start, NULL);
+    pass->changes = pass->run(ast);
+    gettimeofday(&tv_end, NULL);
+
+    pass->time = CALCTIME(tv_start, tv_end);
+    pass->nodes_after = g_node_n_nodes(ast, G_TRAVERSE_ALL);
+    pass->ran = TRUE;
+  }
+
+  optimization_finish();
+}
@@ -0,0 +1,44 @@
+/*
+ * Simple Pascal Compiler
+ * Pass Manager
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ */
+#ifndef __PASSES_H__
+#define __PASSES_H__
+
+#include <glib.h>
+
+#include "compiler_context.h"
+
+typedef struct _Pass	Pass;
+
+typedef enum {
+  PASS_AST,		/* rewrites the AST before code generation */
+  PASS_IR		/* changes the code being generated */
+} PassKind;
+
+struct _Pass {
+  gchar		*name;		/* as in -f<name> and -fno-<name> */
+  gchar		*description;
+  PassKind	 kind;
+  gint		 level;		/* lowest -O that enables it, 0 for none */
+  gint		(*run)(GNode *ast);	/* returns the transformations made */
+
+  gboolean	 enabled;
+  gboolean	 ran;
+  gdouble	 time;		/* seconds; AST passes only */
+  gint		 nodes_before, nodes_after;
+  gint		 changes;
+};
+
+Pass		*passes_new(void);
+void		 passes_free(Pass *table);
+const gchar	*passes_setup(gint level, GSList *toggles);
+gboolean	 passes_enabled(PassKind kind);
+gboolean	 pass_enabled(const gchar *name);
+void		 pass_note(const gchar *name, gint changes);
+void		 passes_run(GNode *ast);
+
+#endif	/* __PASSES_H__ */
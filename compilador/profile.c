@@ -0,0 +1,89 @@
+/*
+ * Simple Pascal Compiler
+ * Execution Profiles
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ * Profiles are written by the virtual machine (mvd --profile), after
+ * running an object compiled from the same program with the same options:
+ * the code generator numbers labels the same way, so what the machine
+ * counted for a label can be found from its name. See vm_profile_save() for
+ * the format.
+ */
+#include <glib.h>
+#include <stdio.h>
+
+#include "profile.h"
+
+Profile *
+profile_load(const gchar *profile_file)
+{
+  Profile *p;
+  ProfileLabel *label;
+  FILE *file;
+  gchar buffer[256], name[16], caller[16], callee[16];
+  guint hits, arrivals, calls;
+
+  if (!(file = fopen(profile_file, "r")))
+    return NULL;
+
+  p = g_new0(Profile, 1);
+  p->labels = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  p->calls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  while (fgets(buffer, sizeof(buffer), file)) {
+    if (buffer[0] == ';')
+      continue;
+
+    if (sscanf(buffer, "label %15s %u %u", name, &hits, &arrivals) == 3) {
+      label = g_new(ProfileLabel, 1);
+      label->hits = hits;
+      label->arrivals = arrivals;
+
+      g_hash_table_replace(p->labels, g_strdup(name), label);
+    } else if (sscanf(buffer, "call %15s %15s %u", caller, callee, &calls) == 3) {
+      g_hash_table_replace(p->calls, g_strdup_printf("%s %s", caller, callee),
+                           GUINT_TO_POINTER(calls));
+    }
+  }
+
+  fclose(file);
+
+  return p;
+}
+
+void
+profile_free(Profile *p)
+{
+  g_hash_table_destroy(p->labels);
+  g_hash_table_destroy(p->calls);
+  g_free(p);
+}
+
+/*
+ * What the profile has for ``label'', or NULL if it doesn't have it (then
+ * the profile is not of this program, or not with these options).
+ */
+ProfileLabel *
+profile_label(Profile *p, const gchar *label)
+{
+  ProfileLabel *pl;
+
+  if (!(pl = (ProfileLabel *)g_hash_table_lookup(p->labels, label)))
+    p->missing++;
+
+  return pl;
+}
+
+guint
+profile_calls(Profile *p, const gchar *caller, const gchar *callee)
+{
+  gchar *key;
+  guint calls;
+
+  key = g_strdup_printf("%s %s", caller, callee);
+  calls = GPOINTER_TO_UINT(g_hash_table_lookup(p->calls, key));
+  g_free(key);
+
+  return calls;
+}
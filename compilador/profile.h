@@ -0,0 +1,35 @@
+/*
+ * Simple Pascal Compiler
+ * Execution Profiles
+ *
+ * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
+ *
+ */
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <glib.h>
+
+#include "compiler_context.h"
+
+typedef struct _Profile		Profile;
+typedef struct _ProfileLabel	ProfileLabel;
+
+struct _ProfileLabel {
+  guint		 hits;		/* times the label was passed */
+  guint		 arrivals;	/* ...of them coming from a jump */
+};
+
+struct _Profile {
+  GHashTable	*labels;	/* label name -> ProfileLabel * */
+  GHashTable	*calls;		/* "caller callee" -> number of calls */
+  gint		 missing;	/* labels looked up that it doesn't have */
+};
+
+Profile		*profile_load(const gchar *profile_file);
+void		 profile_free(Profile *p);
+
+ProfileLabel	*profile_label(Profile *p, const gchar *label);
+guint		 profile_calls(Profile *p, const gchar *caller, const gchar *callee);
+
+#endif	/* __PROFILE_H__ */
@@ -27,10 +27,28 @@ symbol_table_new(void)
   return st;
 }
 
+static gboolean
+symbol_table_free_func(GNode *node, gpointer data)
+{
+  Symbol *symbol = (Symbol *)node->data;
+
+  g_free(symbol->name);
+  g_slist_free(symbol->parameters);
+  g_free(symbol);
+
+  return FALSE;
+}
+
 void
 symbol_table_free(SymbolTable *st)
 {
-  symbol_table_print(st);
+  if (st->root) {
+    g_node_traverse(st->root, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+                    symbol_table_free_func, NULL);
+    g_node_destroy(st->root);
+  }
+
+  g_free(st);
 }
 
 Symbol *
@@ -125,6 +143,8 @@ symbol_table_set_attribute_int(SymbolTable *st, gchar *name, SymbolTableField fi
       symbol->subtype = value; break;
     case STF_MEMORY_ADDRESS:
       symbol->memory_address = value; break;
+    case STF_FRAME_RELATIVE:
+      symbol->frame_relative = value; break;
     default: return;
     }
   }
@@ -143,6 +163,8 @@ symbol_table_get_attribute_int(SymbolTable *st, gchar *name, SymbolTableField fi
       return symbol->subtype;
     case STF_MEMORY_ADDRESS:
       return symbol->memory_address;
+    case STF_FRAME_RELATIVE:
+      return symbol->frame_relative;
     default: return 0;
     }
   }
@@ -192,9 +214,9 @@ symbol_table_print_func(SymbolTable *st, GNode *node)
   memset(indentation, ' ', depth - 1);
   indentation[depth - 1] = '\0';
   
-  printf("%s%s|%s|%s|%d\n", indentation, symbol->name,
-         symbol_types[symbol->type], symbol_subtypes[symbol->subtype],
-	 symbol->memory_address);
+  compiler_write("%s%s|%s|%s|%d\n", indentation, symbol->name,
+                 symbol_types[symbol->type], symbol_subtypes[symbol->subtype],
+                 symbol->memory_address);
   
   for (node = node->children; node; node = node->next) {
     symbol_table_print_func(st, node);
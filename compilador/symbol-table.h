@@ -26,6 +26,7 @@ typedef enum {
   STF_TYPE,
   STF_SUBTYPE,
   STF_MEMORY_ADDRESS,
+  STF_FRAME_RELATIVE,
 } SymbolTableField;
 
 typedef enum {
@@ -44,6 +45,8 @@ struct _Symbol {
   SymbolType	type;
   SymbolSubType subtype;
   gint		memory_address;
+  gboolean	frame_relative;	/* memory_address is an offset from the frame pointer */
+  GSList	*parameters;	/* procedures and functions: their parameters, in order */
 };
 
 SymbolTable	*symbol_table_new(void);
@@ -5,6 +5,12 @@
  * Copyright (c) 2007-2008 Leandro A. F. Pereira <leandro@hardinfo.org>
  */
 #include "tokenlist.h"
+#include "compiler_context.h"
+
+/*
+ * The lists and their tokens are the current context's: what's left of them,
+ * even when the lexer stops at an error, is freed along with it.
+ */
 
 TokenList      *
 tl_new(void)
@@ -13,6 +19,7 @@ tl_new(void)
 
 	tl = g_new0(TokenList, 1);
 	tl->tokens = NULL;
+	g_ptr_array_add(compiler_context->token_lists, tl);
 
 	return tl;
 }
@@ -48,8 +55,8 @@ tl_add_token(TokenList ** token_list, TokenList * t)
 void
 tl_destroy(TokenList * tl)
 {
-	g_list_free(tl->tokens);	
-	g_free(tl);
+	g_list_free(tl->tokens);
+	tl->tokens = NULL;
 }
 
 void
@@ -57,7 +64,7 @@ tl_add_semicolon(TokenList *token_list, gint line, gint column)
 {
 	Token		*token;
 
-	token = g_new0(Token, 1);
+	token = compiler_alloc(sizeof(Token));
 	token->type = T_SEMICOLON;
 	token->id = ";";
 	token->line = line;
@@ -18,7 +18,8 @@ typedef enum {
   T_PLUS,  T_PROCEDURE,  T_PROGRAM,  T_READ,  T_SEMICOLON,  T_AND,  T_TRUE,
   T_VAR,  T_WHILE,  T_WRITE,  T_IDENTIFIER,  T_NUMBER, T_FUNCTION_RETURN,
   T_FUNCTION_CALL, T_PROCEDURE_CALL, T_UNARY_MINUS, T_FOR, T_STEP, T_UNARY_PLUS,
-  T_MAIN_BEGIN
+  T_MAIN_BEGIN, T_TAIL_CALL, T_DUP, T_SWITCH, T_CASE,
+  T_SELECT, T_DIVIDE_UNCHECKED
 } TokenType;
 
 typedef struct	_Token		Token;
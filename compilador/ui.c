@@ -441,7 +441,7 @@ void ui_show_performance(UI *ui, gchar *performance_output)
               gtk_list_store_append(ui->store_performance, &iter);
             
               gtk_list_store_set(ui->store_performance, &iter,
-                                 P_PASS, g_strchug(step[0]),
+                                 P_PASS, step[0],	/* passes are indented */
                                  P_TIME, g_strchug(step[1]),
                                  P_PERCENTAGE, atof(step[2]),
                                  -1);
@@ -458,6 +458,21 @@ void ui_show_performance(UI *ui, gchar *performance_output)
     }
 }
 
+/* the items of cmb_output_language: csd --target, and the output extension */
+static const gchar *output_languages[][2] = {
+    { "mvd",    "obj" },
+    { "c",      "c" },
+    { "x86_64", "s" },
+    { "llvm",   "ll" },
+};
+
+static gint ui_get_output_language(void)
+{
+    gint language = conf_get_integer("compiler", "outputlanguage", 0);
+
+    return language >= 0 && language < G_N_ELEMENTS(output_languages) ? language : 0;
+}
+
 static gchar *ui_get_object_file(UI *ui)
 {
     gchar *output_file, *temp;
@@ -466,7 +481,8 @@ static gchar *ui_get_object_file(UI *ui)
     if ((temp = g_strrstr(output_file, "."))) {
       *temp = '\0';
     }
-    temp = g_strdup_printf("%s.obj", output_file);
+    temp = g_strdup_printf("%s.%s", output_file,
+                           output_languages[ui_get_output_language()][1]);
     g_free(output_file);
     
     return temp;
@@ -478,7 +494,7 @@ static void cb_btn_execute_clicked(GtkWidget * widget, gpointer data)
     gchar 	*mvd_location, *cmdline, *objfile;
     GError	*error = NULL;
     
-    if (conf_get_integer("compiler", "outputlanguage", 0) != 0) {
+    if (ui_get_output_language() != 0) {
 	GtkWidget	*dialog;
 
 	dialog = gtk_message_dialog_new(NULL,
@@ -564,10 +580,11 @@ static void cb_btn_compile_clicked(GtkWidget * widget, gpointer data)
     g_file_set_contents(temp_output, source_code, -1, NULL);
     g_free(source_code);
 
-    command_line = g_strdup_printf("'%s' '%s' -t -O %d %s",
+    command_line = g_strdup_printf("'%s' '%s' -t -O %d --target=%s %s",
                                    argv0,				/* ourself */
                                    temp_output,				/* input file */
 				   optimization_level,			/* optimization level */
+				   output_languages[ui_get_output_language()][0],
 				   viagem ? "-v" : "");			/* viagem do Freitas */
 				   
     g_spawn_command_line_sync(command_line, &std_output, &std_error,
@@ -5,20 +5,111 @@
  * Copyright (c) 2008 Leandro A. F. Pereira <leandro@hardinfo.org>
  */
 
+#include <stdio.h>
+#include <string.h>
+
 #include "ui.h"
 #include "vm.h"
 
+static gboolean terminal = FALSE;
+static gchar *profile_file = NULL;
+static GOptionEntry options[] = {
+  { "terminal", 't', 0, G_OPTION_ARG_NONE, &terminal,
+    "Executa o objeto sem a interface gráfica, lendo da entrada e escrevendo na saída padrão", NULL },
+  { "profile", 'p', 0, G_OPTION_ARG_FILENAME, &profile_file,
+    "Grava o perfil de cada execução em ARQUIVO (veja csd --profile-use)", "ARQUIVO" },
+  { NULL }
+};
+
+static gchar *
+terminal_read(gpointer data)
+{
+  gchar *buffer = (gchar *)data;
+
+  if (!fgets(buffer, 128, stdin)) {
+    /* as the programs of --target=c do */
+    strcpy(buffer, "0");
+  }
+
+  return buffer;
+}
+
+static void
+terminal_write(gpointer data, char *string)
+{
+  printf("%s\n", string);
+}
+
+static int
+terminal_run(char *object_file)
+{
+  VM *vm;
+  gchar buffer[128];
+
+  if (!g_file_test(object_file, G_FILE_TEST_IS_REGULAR)) {
+    fprintf(stderr, "%s: No such file\n", object_file);
+    return 1;
+  }
+
+  vm = vm_new(terminal_read, buffer, terminal_write, NULL);
+  vm_object_load(vm, object_file);
+
+  vm->profiling = profile_file != NULL;
+  vm->running = TRUE;
+  while (vm->running && vm->instruction_pointer) {
+    vm_step(vm);
+  }
+
+  if (profile_file && !vm_profile_save(vm, profile_file)) {
+    fprintf(stderr, "Could not save the profile to %s\n", profile_file);
+  }
+
+  vm_destroy(vm);
+
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
   UI *ui;
+  GOptionContext *context;
+  GError *error = NULL;
   
-  gtk_init(&argc, &argv);
+  /* GTK's options are parsed without opening the display, which
+     --terminal doesn't need */
+  context = g_option_context_new("[objeto.obj]");
+  g_option_context_add_main_entries(context, options, NULL);
+  g_option_context_add_group(context, gtk_get_option_group(FALSE));
+
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_print("%s\n", error->message);
+    return 1;
+  }
+
+  g_option_context_free(context);
+
+  if (terminal) {
+    if (argc != 2) {
+      g_print("--terminal needs an object file\n");
+      return 1;
+    }
+
+    return terminal_run(argv[1]);
+  }
+
+  if (!gtk_init_check(&argc, &argv)) {
+    g_print("Cannot open the display\n");
+    return 1;
+  }
 
   if (argc < 2) {
     ui = ui_new(NULL);
   } else {
     ui = ui_new(argv[1]);
   }
+
+  ui->profile_file = profile_file;
+  ui->vm->profiling = profile_file != NULL;
   
   gtk_main();
   ui_destroy(ui);
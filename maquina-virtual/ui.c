@@ -220,6 +220,11 @@ ui_execute(UI *ui)
     while (gtk_events_pending())
       gtk_main_iteration();
   }
+
+  if (ui->profile_file && !vm_profile_save(ui->vm, ui->profile_file)) {
+    ui_console_write(ui, "\342\212\227\tNão foi possível gravar o perfil em %s.\n",
+                     ui->profile_file);
+  }
   
   ui_reset(ui, FALSE);
   ui_console_write(ui, "\342\212\227\tExecução terminada.\n\n");
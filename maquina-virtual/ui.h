@@ -50,6 +50,7 @@ struct _UI {
                 *store_memory;
   GdkPixbuf	*pbuf_arrow;
   gboolean	selection_changeable;
+  gchar		*profile_file;	/* written after each execution, if set */
 };
 
 UI	*ui_new(char *object_file);
@@ -30,6 +30,7 @@ static void vm_cmeq(VM *vm, VMInstruction *i);
 static void vm_cmaq(VM *vm, VMInstruction *i);
 static void vm_jmp(VM *vm, VMInstruction *i);
 static void vm_jmpf(VM *vm, VMInstruction *i);
+static void vm_jmpv(VM *vm, VMInstruction *i);
 static void vm_alloc(VM *vm, VMInstruction *i);
 static void vm_dalloc(VM *vm, VMInstruction *i);
 static void vm_start(VM *vm, VMInstruction *i);
@@ -37,9 +38,19 @@ static void vm_hlt(VM *vm, VMInstruction *i);
 static void vm_call(VM *vm, VMInstruction *i);
 static void vm_return(VM *vm, VMInstruction *i);
 static void vm_returnf(VM *vm, VMInstruction *i);
+static void vm_returnv(VM *vm, VMInstruction *i);
 static void vm_rd(VM *vm, VMInstruction *i);
 static void vm_prn(VM *vm, VMInstruction *i);
 static void vm_str(VM *vm, VMInstruction *i);
+static void vm_ldl(VM *vm, VMInstruction *i);
+static void vm_stl(VM *vm, VMInstruction *i);
+static void vm_enter(VM *vm, VMInstruction *i);
+static void vm_leave(VM *vm, VMInstruction *i);
+static void vm_dup(VM *vm, VMInstruction *i);
+static void vm_swap(VM *vm, VMInstruction *i);
+static void vm_jmpt(VM *vm, VMInstruction *i);
+static void vm_sel(VM *vm, VMInstruction *i);
+static void vm_divu(VM *vm, VMInstruction *i);
 
 const Instruction instructions[] = {
   { OP_LABEL,	"NULL",		vm_null },
@@ -61,6 +72,7 @@ const Instruction instructions[] = {
   { OP_CMAQ,	"CMAQ",		vm_cmaq },
   { OP_JMP,	"JMP",		vm_jmp },
   { OP_JMPF,	"JMPF",		vm_jmpf },
+  { OP_JMPV,	"JMPV",		vm_jmpv },
   { OP_ALLOC,	"ALLOC",	vm_alloc },
   { OP_DALLOC,	"DALLOC",	vm_dalloc },
   { OP_START,	"START",	vm_start },
@@ -68,9 +80,19 @@ const Instruction instructions[] = {
   { OP_CALL,	"CALL",		vm_call },
   { OP_RETURN,	"RETURN",	vm_return },
   { OP_RETURNF,	"RETURNF",	vm_returnf },
+  { OP_RETURNV,	"RETURNV",	vm_returnv },
   { OP_RD,	"RD",		vm_rd },
   { OP_PRN,	"PRN",		vm_prn },
   { OP_STR,	"STR",		vm_str },
+  { OP_LDL,	"LDL",		vm_ldl },
+  { OP_STL,	"STL",		vm_stl },
+  { OP_ENTER,	"ENTER",	vm_enter },
+  { OP_LEAVE,	"LEAVE",	vm_leave },
+  { OP_DUP,	"DUP",		vm_dup },
+  { OP_SWAP,	"SWAP",		vm_swap },
+  { OP_JMPT,	"JMPT",		vm_jmpt },
+  { OP_SEL,	"SEL",		vm_sel },
+  { OP_DIVU,	"DIVU",		vm_divu },
 };
 
 static gchar *
@@ -101,6 +123,9 @@ vm_new(VMReadFunction read_function, gpointer read_function_data,
   vm->read_function       = read_function  ? read_function  : vm_default_read_function;
   vm->write_function_data = write_function_data;
   vm->read_function_data  = read_function_data;
+
+  vm->calls = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                    (GDestroyNotify)g_hash_table_destroy);
     
   vm_reset(vm);
   
@@ -110,94 +135,160 @@ vm_new(VMReadFunction read_function, gpointer read_function_data,
 void
 vm_destroy(VM *vm)
 {
+  g_slist_free(vm->active_procedures);
+  g_hash_table_destroy(vm->calls);
   g_free(vm);
 }
 
 void
 vm_reset(VM *vm)
 {
+  GList *list;
+
   vm->running = FALSE;
   vm->stack_top = -1;
+  vm->frame_pointer = -1;
   vm->instruction_pointer = vm->program;
   
   memset(vm->memory, 0, sizeof(vm->memory));
+
+  for (list = vm->program; list; list = list->next) {
+    VMInstruction *instruction = (VMInstruction *)list->data;
+
+    instruction->hits = instruction->arrivals = 0;
+  }
+
+  g_slist_free(vm->active_procedures);
+  vm->active_procedures = NULL;
+  g_hash_table_remove_all(vm->calls);
 }
 
+typedef struct {
+  FILE		*profile;
+  VMInstruction	*callee;
+} VMProfileCalls;
+
+static void
+vm_profile_save_caller(gpointer key, gpointer value, gpointer data)
+{
+  VMProfileCalls *calls = (VMProfileCalls *)data;
+  VMInstruction *caller = (VMInstruction *)key;
+
+  fprintf(calls->profile, "call %s %s %u\n", caller ? caller->label_name : "PRG",
+          calls->callee->label_name, GPOINTER_TO_UINT(value));
+}
+
+static void
+vm_profile_save_call(gpointer key, gpointer value, gpointer data)
+{
+  VMProfileCalls calls = { .profile = (FILE *)data, .callee = (VMInstruction *)key };
+
+  g_hash_table_foreach((GHashTable *)value, vm_profile_save_caller, &calls);
+}
+
+/*
+ * Writes what was executed since the last reset, for csd --profile-use (only
+ * counted if vm->profiling is set):
+ *
+ *   label L1 <hits> <arrivals>	how many times the label was passed, and
+ *				how many of them came from a jump
+ *   call L1 L2 <calls>		calls from the procedure whose entry label is
+ *				L1 (PRG for the main program) to the one of L2
+ */
+gboolean
+vm_profile_save(VM *vm, const char *profile_file)
+{
+  FILE *profile;
+  GList *list;
+
+  if (!(profile = fopen(profile_file, "w")))
+    return FALSE;
+
+  fprintf(profile, "; execution profile\n");
+
+  for (list = vm->program; list; list = list->next) {
+    VMInstruction *instruction = (VMInstruction *)list->data;
+
+    if (instruction->opcode == OP_LABEL) {
+      fprintf(profile, "label %s %u %u\n", instruction->label_name,
+              instruction->hits, instruction->arrivals);
+    }
+  }
+
+  g_hash_table_foreach(vm->calls, vm_profile_save_call, profile);
+  fclose(profile);
+
+  return TRUE;
+}
+
+/*
+ * Appends an instruction to the program, as it would appear in a line of an
+ * object: ``instruction'' is "NULL" for a label. Jumps and calls are only
+ * resolved by vm_program_link(), once the whole program is there. Returns
+ * FALSE if there's no such instruction.
+ */
+gboolean
+vm_program_append(VM *vm, const gchar *label, const gchar *instruction,
+                  const gchar *param1, const gchar *param2)
+{
+  VMInstruction *i;
+  int k;
+
+  if (g_str_equal(instruction, "NULL")) {
+    i = g_new0(VMInstruction, 1);
+    i->opcode = OP_LABEL;
+    i->label_name = g_strdup(label);
+  } else {
+    for (k = 0; k < G_N_ELEMENTS(instructions); k++) {
+      if (g_str_equal(instruction, instructions[k].name))
+        break;
+    }
+
+    if (k == G_N_ELEMENTS(instructions))
+      return FALSE;
+
+    i = g_new0(VMInstruction, 1);
+    i->opcode = instructions[k].opcode;
+
+    i->param1 = param1 ? atoi(param1) : 0;
+    i->sparam1 = g_strdup(param1 ? param1 : "");
+
+    i->param2 = param2 ? atoi(param2) : 0;
+    i->sparam2 = g_strdup(param2 ? param2 : "");
+  }
+
+  /* the last element is kept, so appending doesn't walk the whole program */
+  if (vm->program_last) {
+    vm->program_last = g_list_append(vm->program_last, i)->next;
+  } else {
+    vm->program = vm->program_last = g_list_append(NULL, i);
+  }
+
+  return TRUE;
+}
+
+/*
+ * Resolves the labels of jumps and calls into lines of the program, and
+ * builds the jump tables, so it can be run.
+ */
 void
-vm_object_load(VM *vm, const char *object_file)
+vm_program_link(VM *vm)
 {
   GHashTable *label_table;
   GList *list;
   VMInstruction	*instruction;
-  gchar buffer[256];
-  FILE *object;
-  gint line = 0;
-  
-  vm_object_unload(vm);
-  
+  gint line;
+
   label_table = g_hash_table_new(g_str_hash, g_str_equal);
-  
-  if ((object = fopen(object_file, "r"))) {
-    while (fgets(buffer, 256, object)) {
-      gchar *label, *instr, *param1, *param2;
-      
-      if (buffer[0] == ';')
-          continue;
 
-      line++;
-      
-      buffer[3] = '\0';
-      buffer[11] = '\0';
-      buffer[15] = '\0';
-      buffer[19] = '\0';      
-
-      label = g_strchomp(buffer);
-      instr = g_strchomp(buffer + 4);
-      param1 = g_strchomp(buffer + 12);
-      param2 = g_strchomp(buffer + 16);
-      
-      if (g_str_equal(instr, "NULL")) {		/* label */
-        instruction = g_new0(VMInstruction, 1);
-        instruction->opcode = OP_LABEL;
-        instruction->label_name = g_strdup(label);
-        
-        g_hash_table_insert(label_table, instruction->label_name,
-                            GINT_TO_POINTER(line));
-        vm->program = g_list_append(vm->program, instruction);
-      } else {					/* everything else */
-        int i, valid_instruction = 0;
-        
-        for (i = 0; i < G_N_ELEMENTS(instructions); i++) {
-          if (g_str_equal(instr, instructions[i].name)) {
-            instruction = g_new0(VMInstruction, 1);
-            instruction->opcode = instructions[i].opcode;
-            
-            instruction->param1 = atoi(param1);
-            instruction->sparam1 = g_strdup(param1);
-
-            instruction->param2 = atoi(param2);
-            instruction->sparam2 = g_strdup(param2);
-
-            vm->program = g_list_append(vm->program, instruction);
-            
-            valid_instruction = 1;
-            break;
-          }
-        }
-        
-        if (!valid_instruction) {
-          g_warning("Ignorando instrução \"%s\" (desconhecida) na linha %d.\n\n"
-                    "O programa pode não funcionar corretamente.\n",
-                    instr, line);
-        }
-      }
-      
-      memset(buffer, '\0', sizeof(buffer));
-    }
-    
-    fclose(object);
+  for (list = vm->program, line = 1; list; list = list->next, line++) {
+    instruction = (VMInstruction *)list->data;
+
+    if (instruction->opcode == OP_LABEL)
+      g_hash_table_insert(label_table, instruction->label_name,
+                          GINT_TO_POINTER(line));
   }
-  
+
   for (list = vm->program; list; list = list->next) {
     instruction = (VMInstruction *)list->data;
     
@@ -205,10 +296,12 @@ vm_object_load(VM *vm, const char *object_file)
       case OP_CALL:
       case OP_JMP:
       case OP_JMPF:
+      case OP_JMPV:
         {
           gchar *label = instruction->sparam1;
           gint label_line = GPOINTER_TO_INT(g_hash_table_lookup(label_table, label));
           
+          g_free(instruction->sparam2);
           instruction->sparam2 = g_strdup_printf("<span color=\"#ccc\"><i>Rótulo <b>%s</b></i></span>",
                                                  instruction->sparam1);
           instruction->param1 = label_line;
@@ -223,10 +316,70 @@ vm_object_load(VM *vm, const char *object_file)
     }
   }
   
+  /* the entries of a jump table are the JMPs that follow JMPT */
+  for (list = vm->program, line = 1; list; list = list->next, line++) {
+    GList *entry = list->next;
+    gint k;
+
+    instruction = (VMInstruction *)list->data;
+    if (instruction->opcode != OP_JMPT)
+      continue;
+
+    instruction->jump_table = g_new(gint, instruction->param2 + 1);
+    for (k = 0; k < (gint)instruction->param2; k++) {
+      VMInstruction *jump = entry ? (VMInstruction *)entry->data : NULL;
+
+      instruction->jump_table[k] = jump && jump->opcode == OP_JMP ?
+                                   jump->param1 : line + instruction->param2 + 1;
+      entry = entry ? entry->next : NULL;
+    }
+    instruction->jump_table[k] = line + instruction->param2 + 1;
+  }
+
   g_hash_table_destroy(label_table);
   vm_reset(vm);
 }
 
+void
+vm_object_load(VM *vm, const char *object_file)
+{
+  gchar buffer[256];
+  FILE *object;
+  gint line = 0;
+  
+  vm_object_unload(vm);
+  
+  if ((object = fopen(object_file, "r"))) {
+    while (fgets(buffer, 256, object)) {
+      gchar label[256] = "", instr[256] = "", param1[256] = "", param2[256] = "";
+      
+      if (buffer[0] == ';')
+          continue;
+
+      line++;
+      
+      /* a label or constant wider than its column pushes the fields
+         after it to the right, so they are read as words; the line
+         has a label if it doesn't start blank */
+      if (g_ascii_isspace(buffer[0])) {
+        sscanf(buffer, "%255s %255s %255s", instr, param1, param2);
+      } else {
+        sscanf(buffer, "%255s %255s %255s %255s", label, instr, param1, param2);
+      }
+      
+      if (!vm_program_append(vm, label, instr, param1, param2)) {
+        g_warning("Ignorando instrução \"%s\" (desconhecida) na linha %d.\n\n"
+                  "O programa pode não funcionar corretamente.\n",
+                  instr, line);
+      }
+    }
+    
+    fclose(object);
+  }
+  
+  vm_program_link(vm);
+}
+
 void
 vm_object_unload(VM *vm)
 {
@@ -239,11 +392,12 @@ vm_object_unload(VM *vm)
     g_free(instruction->sparam1);
     g_free(instruction->sparam2);
     g_free(instruction->label_name);
+    g_free(instruction->jump_table);
     g_free(instruction);
   }
   
   g_list_free(vm->program);
-  vm->program = NULL;
+  vm->program = vm->program_last = NULL;
 }
 
 void
@@ -256,6 +410,9 @@ vm_step(VM *vm)
   
   if ((instruction = (VMInstruction *)vm->instruction_pointer->data)) {
     vm->instruction_pointer = vm->instruction_pointer->next;
+
+    if (vm->profiling)
+      instruction->hits++;
     
     instructions[instruction->opcode].callback(vm, instruction);
   }
@@ -409,9 +566,16 @@ static void vm_cmaq(VM *vm, VMInstruction *i)
   vm->stack_top--;
 }
 
+static void vm_arrive(VM *vm)
+{
+  if (vm->profiling && vm->instruction_pointer)
+    ((VMInstruction *)vm->instruction_pointer->data)->arrivals++;
+}
+
 static void vm_jmp(VM *vm, VMInstruction *i)
 {
   vm->instruction_pointer = g_list_nth(vm->program, i->param1 - 1);
+  vm_arrive(vm);
 }
 
 static void vm_jmpf(VM *vm, VMInstruction *i)
@@ -423,6 +587,15 @@ static void vm_jmpf(VM *vm, VMInstruction *i)
   vm->stack_top--;
 }
 
+static void vm_jmpv(VM *vm, VMInstruction *i)
+{
+  if (vm->memory[vm->stack_top] != 0) {
+    vm_jmp(vm, i);
+  }
+  
+  vm->stack_top--;
+}
+
 static void vm_alloc(VM *vm, VMInstruction *i)
 {
   int k;
@@ -446,6 +619,7 @@ static void vm_dalloc(VM *vm, VMInstruction *i)
 static void vm_start(VM *vm, VMInstruction *i)
 {
   vm->stack_top = -1;
+  vm->frame_pointer = -1;
 }
 
 static void vm_hlt(VM *vm, VMInstruction *i)
@@ -455,27 +629,69 @@ static void vm_hlt(VM *vm, VMInstruction *i)
 
 static void vm_call(VM *vm, VMInstruction *i)
 {
+  VMInstruction *callee, *caller;
+  GHashTable *callers;
+
   vm->stack_top++;
   vm->memory[vm->stack_top] = g_list_position(vm->program,
                                               vm->instruction_pointer) + 1;
   vm_jmp(vm, i);
+
+  if (!vm->profiling || !vm->instruction_pointer)
+    return;
+
+  callee = (VMInstruction *)vm->instruction_pointer->data;
+  caller = vm->active_procedures ? (VMInstruction *)vm->active_procedures->data : NULL;
+
+  if (!(callers = g_hash_table_lookup(vm->calls, callee))) {
+    callers = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_hash_table_insert(vm->calls, callee, callers);
+  }
+
+  g_hash_table_insert(callers, caller,
+                      GUINT_TO_POINTER(GPOINTER_TO_UINT(g_hash_table_lookup(callers, caller)) + 1));
+  vm->active_procedures = g_slist_prepend(vm->active_procedures, callee);
 }
 
-static void vm_return(VM *vm, VMInstruction *i)
+static void vm_jump_back(VM *vm)
 {
   vm->instruction_pointer = g_list_nth(vm->program, vm->memory[vm->stack_top] - 1);
   vm->stack_top--;
+
+  if (vm->active_procedures)
+    vm->active_procedures = g_slist_delete_link(vm->active_procedures,
+                                                vm->active_procedures);
+}
+
+/* RETURN n also drops the n arguments pushed by the caller */
+static void vm_return(VM *vm, VMInstruction *i)
+{
+  vm_jump_back(vm);
+  vm->stack_top -= i->param1;
 }
 
+/* RETURNF a n: restores the return value cell and drops n arguments */
 static void vm_returnf(VM *vm, VMInstruction *i)
 {
+  VMInstruction cell = { .param1 = i->param1, .param2 = 1 };
   gint return_value;
   
   return_value = vm->memory[i->param1];
   
-  i->param2 = 1;
-  vm_dalloc(vm, i);
-  vm_return(vm, i);
+  vm_dalloc(vm, &cell);
+  vm_jump_back(vm);
+  vm->stack_top -= i->param2;
+
+  vm->memory[++vm->stack_top] = return_value;
+}
+
+/* like RETURNF, for functions whose frame isn't saved on the stack */
+static void vm_returnv(VM *vm, VMInstruction *i)
+{
+  gint return_value;
+  
+  return_value = vm->memory[i->param1];
+  vm_jump_back(vm);
 
   vm->memory[++vm->stack_top] = return_value;
 }
@@ -503,3 +719,74 @@ static void vm_str(VM *vm, VMInstruction *i)
   vm->stack_top--;
 }
 
+
+/*
+ * Frame-relative addressing: arguments are below the frame pointer and
+ * locals above it, so offsets may be negative.
+ */
+static void vm_ldl(VM *vm, VMInstruction *i)
+{
+  vm->memory[++vm->stack_top] = vm->memory[vm->frame_pointer + (gint)i->param1];
+}
+
+static void vm_stl(VM *vm, VMInstruction *i)
+{
+  vm->memory[vm->frame_pointer + (gint)i->param1] = vm->memory[vm->stack_top];
+  vm->stack_top--;
+}
+
+/* saves the frame pointer and reserves room for n locals */
+static void vm_enter(VM *vm, VMInstruction *i)
+{
+  vm->memory[++vm->stack_top] = vm->frame_pointer;
+  vm->frame_pointer = vm->stack_top;
+  vm->stack_top += i->param1;
+}
+
+static void vm_leave(VM *vm, VMInstruction *i)
+{
+  vm->stack_top = vm->frame_pointer;
+  vm->frame_pointer = vm->memory[vm->stack_top--];
+}
+
+static void vm_dup(VM *vm, VMInstruction *i)
+{
+  vm->memory[vm->stack_top + 1] = vm->memory[vm->stack_top];
+  vm->stack_top++;
+}
+
+static void vm_swap(VM *vm, VMInstruction *i)
+{
+  gint top = vm->memory[vm->stack_top];
+
+  vm->memory[vm->stack_top] = vm->memory[vm->stack_top - 1];
+  vm->memory[vm->stack_top - 1] = top;
+}
+
+static void vm_jmpt(VM *vm, VMInstruction *i)
+{
+  gint entry = vm->memory[vm->stack_top--] - (gint)i->param1;
+
+  if (entry < 0 || entry >= (gint)i->param2)
+    entry = i->param2;
+
+  vm->instruction_pointer = g_list_nth(vm->program, i->jump_table[entry] - 1);
+  vm_arrive(vm);
+}
+
+static void vm_sel(VM *vm, VMInstruction *i)
+{
+  if (vm->memory[vm->stack_top] == 0) {
+    vm->memory[vm->stack_top - 2] = vm->memory[vm->stack_top - 1];
+  }
+
+  vm->stack_top -= 2;
+}
+
+/* DIVI for divisors the compiler knows aren't zero */
+static void vm_divu(VM *vm, VMInstruction *i)
+{
+  vm->memory[vm->stack_top - 1] = vm->memory[vm->stack_top - 1] /
+                                  vm->memory[vm->stack_top];
+  vm->stack_top--;
+}
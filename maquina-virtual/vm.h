@@ -37,6 +37,7 @@ typedef enum {
   OP_CMAQ,
   OP_JMP,
   OP_JMPF,
+  OP_JMPV,
   OP_ALLOC,
   OP_DALLOC,
   OP_START,
@@ -44,9 +45,19 @@ typedef enum {
   OP_CALL,
   OP_RETURN,
   OP_RETURNF,
+  OP_RETURNV,
   OP_RD,
   OP_PRN,
   OP_STR,
+  OP_LDL,
+  OP_STL,
+  OP_ENTER,
+  OP_LEAVE,
+  OP_DUP,
+  OP_SWAP,
+  OP_JMPT,
+  OP_SEL,
+  OP_DIVU,
   N_OP
 } VMOpcode;
 
@@ -58,13 +69,19 @@ struct _Instruction {
 
 struct _VM {
   int			stack_top;
+  int			frame_pointer;
   gint			memory[65536];
-  GList			*program, *instruction_pointer;
+  GList			*program, *program_last, *instruction_pointer;
   gboolean		running;
   
   VMReadFunction	read_function;
   VMWriteFunction	write_function;
   gpointer		write_function_data, read_function_data;
+
+  /* for the execution profile, see vm_profile_save() */
+  gboolean		profiling;		/* counts what it executes, if set */
+  GSList		*active_procedures;	/* their entry labels, innermost first */
+  GHashTable		*calls;			/* callee -> caller -> number of calls */
 };
 
 struct _VMInstruction {
@@ -72,6 +89,9 @@ struct _VMInstruction {
   guint		 param1, param2;
   gchar		*sparam1, *sparam2;
   gchar		*label_name;
+  gint		*jump_table;	/* JMPT: lines of the entries, then past them */
+  guint		 hits;		/* times executed since the last reset */
+  guint		 arrivals;	/* ...of them by a jump, for labels */
   gpointer	 data;
 };
 
@@ -84,7 +104,13 @@ void	 vm_destroy(VM *vm);
 void	 vm_object_load(VM *vm, const char *object_file);
 void	 vm_object_unload(VM *vm);
 
+gboolean vm_program_append(VM *vm, const gchar *label, const gchar *instruction,
+                           const gchar *param1, const gchar *param2);
+void	 vm_program_link(VM *vm);
+
 void	 vm_step(VM *vm);
 void	 vm_reset(VM *vm);
 
+gboolean vm_profile_save(VM *vm, const char *profile_file);
+
 #endif	/* __VM_H__ */
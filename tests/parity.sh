@@ -0,0 +1,169 @@
+#!/bin/bash
+#
+# parity.sh
+#
+# Checks that the programs write what they should, whatever they are
+# compiled for and with: every program in ``programs'' is compiled to an
+# object and run with mvd --terminal, run with csd --run and, built with
+# the system toolchain, for each other target; what each writes must be
+# what expected/ has for it. Also shows how long each one took to execute.
+#
+# Usage: parity.sh [csd options...]
+#
+# Each line of ``programs'' is a program, followed by what it reads, one
+# value per leia(); what it writes then is in expected/, in a file named
+# after both (fat.lpd 6 is expected/fat-6.out). ``recursion'' lists the
+# ones that need tail calls to be eliminated. CSD, MVD and CC may point to
+# other builds and compilers.
+#
+
+CSD=${CSD:-../compilador/csd}
+MVD=${MVD:-../maquina-virtual/mvd}
+CC=${CC:-cc}
+
+cd $(dirname $0)
+
+TEMP=$(mktemp -d)
+trap "rm -rf $TEMP" EXIT
+
+PASSED=0
+FAILED=0
+
+# what the program wrote, minus the empty lines (the VM writes one after
+# "Divisão por zero")
+output() {
+	grep -v '^$' $1
+}
+
+# runs the program $2 with the input $3, saving what it wrote to $1.out,
+# and prints how many milliseconds it took (process start-up included); it
+# fails if the program was killed, or took too long
+execute() {
+	local start end status
+
+	start=$(date +%s%N)
+	printf "%s\n" $3 | timeout 60 $2 > $1.out 2>/dev/null
+	status=$?
+	end=$(date +%s%N)
+
+	[ $status -lt 124 ] || return 1
+	awk "BEGIN { printf \"%.2f\", ($end - $start) / 1e6 }"
+}
+
+# compares what target $1 wrote with what the program should have
+compare() {
+	if output $TEMP/$1.out | cmp -s - $EXPECTED; then
+		PASSED=$((PASSED + 1))
+		return
+	fi
+
+	FAILED=$((FAILED + 1))
+	echo "  $1 differs from $EXPECTED:"
+	diff $EXPECTED <(output $TEMP/$1.out) | sed 's/^/    /'
+}
+
+# the object, as mvd loads it
+build_mvd() {
+	$CSD "$@" $PROGRAM > $TEMP/mvd.obj
+}
+
+# the program, as the code generator puts it in the VM; it is compiled when
+# it is run
+build_run() {
+	:
+}
+
+build_c() {
+	$CSD "$@" --target=c $PROGRAM > $TEMP/c.c &&
+		$CC -O2 -w -o $TEMP/c $TEMP/c.c
+}
+
+build_x86_64() {
+	$CSD "$@" --target=x86_64 $PROGRAM > $TEMP/x86_64.s &&
+		as -o $TEMP/x86_64.o $TEMP/x86_64.s &&
+		ld -o $TEMP/x86_64 $TEMP/x86_64.o
+}
+
+build_llvm() {
+	$CSD "$@" --target=llvm $PROGRAM > $TEMP/llvm.ll &&
+		llc -O2 -relocation-model=pic -o $TEMP/llvm.s $TEMP/llvm.ll &&
+		$CC -o $TEMP/llvm $TEMP/llvm.s
+}
+
+# how target $1 is run, once built with the options after it
+command() {
+	local target=$1
+	shift
+
+	case $target in
+	mvd)	echo "$MVD --terminal $TEMP/mvd.obj" ;;
+	run)	echo "$CSD $* --run $PROGRAM" ;;
+	*)	echo "$TEMP/$target" ;;
+	esac
+}
+
+TARGETS="mvd run c"
+
+# the assembly is for x86-64 Linux, and needs nothing but as and ld
+if [ "$(uname -sm)" = "Linux x86_64" ]; then
+	TARGETS="$TARGETS x86_64"
+fi
+
+# the IR is left out if there's no LLVM to build it with
+if command -v llc > /dev/null; then
+	TARGETS="$TARGETS llvm"
+else
+	echo "llc not found, skipping the llvm target"
+fi
+
+echo "csd $* (times in ms)"
+printf "%-16s %-10s" "programa" "entrada"
+printf " %8s" $TARGETS
+echo
+
+# checks the programs in the list $1, compiled with the options after it
+check() {
+	local list=$1 times time target
+	shift
+
+	while read PROGRAM INPUT; do
+		times=""
+		EXPECTED=expected/$(echo ${PROGRAM%.lpd} $INPUT | tr ' ' -).out
+
+		if [ ! -f $EXPECTED ]; then
+			FAILED=$((FAILED + 1))
+			echo "  $EXPECTED is missing"
+			continue
+		fi
+
+		for target in $TARGETS; do
+			if ! build_$target "$@"; then
+				FAILED=$((FAILED + 1))
+				times="$times -"
+				echo "  $target: can't build $PROGRAM"
+			elif ! time=$(execute $TEMP/$target \
+					"$(command $target "$@")" "$INPUT"); then
+				FAILED=$((FAILED + 1))
+				times="$times -"
+				echo "  $target: $PROGRAM was killed"
+			else
+				times="$times $time"
+				compare $target
+			fi
+		done
+
+		printf "%-16s %-10s" $PROGRAM "${INPUT:--}"
+		printf " %8s" $times
+		echo
+	done < $list
+}
+
+check programs "$@"
+
+# these recurse deeper than the VM's memory allows, unless the calls are
+# made jumps (see eliminate_tail_calls())
+check recursion "$@" -ftail-calls
+
+echo "$PASSED passed, $FAILED failed"
+
+[ $FAILED -eq 0 ]
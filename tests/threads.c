@@ -0,0 +1,255 @@
+/*
+ * threads.c
+ *
+ * Checks that libcsd compiles on many threads at once: every program in
+ * the list given is compiled at -O0 to -O3 for each target, and autotuned
+ * for each of its inputs, first one job after another and then on THREADS
+ * threads at once, each starting at a different job. Every job must write
+ * the same, and fail or not, every time.
+ *
+ * Usage: threads programs
+ *
+ * The list is read as parity.sh reads it: a program per line, followed by
+ * what it reads.
+ */
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compiler_context.h"
+#include "autotune.h"
+
+#define THREADS		4
+#define LEVELS		4
+
+typedef struct _Job	Job;
+typedef struct _Run	Run;
+
+struct _Job {
+  gchar		*program;
+  gint		 level;
+  const gchar	*target;	/* NULL for the object */
+  gchar		*data_file;	/* what it reads, if it's autotuned */
+};
+
+struct _Run {
+  Job		*jobs;
+  gint		 n_jobs, first;
+  gchar		**outputs;	/* what each job wrote, then its diagnostics */
+  gboolean	*compiled;
+};
+
+static const gchar *targets[] = { NULL, "c", "x86_64", "llvm" };
+
+static void
+sink_write(gpointer data, const gchar *string)
+{
+  g_string_append((GString *)data, string);
+}
+
+static gint
+job_autotune(gpointer data)
+{
+  return autotune(params.autotune, (GString *)data);
+}
+
+static gchar *
+job_run(Job *job, gboolean *compiled)
+{
+  CompilerParams p;
+  CompilerContext *ctx;
+  GString *output, *report;
+  GSList *l;
+  FILE *input;
+
+  memset(&p, 0, sizeof(p));
+  p.input_file = job->program;
+  p.optimization_level = job->level;
+  p.output_format = (gchar *)job->target;
+  p.autotune = job->data_file;
+
+  output = g_string_new(NULL);
+
+  if (!(input = fopen(job->program, "r"))) {
+    *compiled = FALSE;
+    return g_string_free(output, FALSE);
+  }
+
+  ctx = compiler_context_new(&p, input, sink_write, output);
+
+  if (p.autotune) {
+    report = g_string_new(NULL);
+    *compiled = !compiler_context_run(ctx, job_autotune, report);
+    g_string_append(output, report->str);
+    g_string_free(report, TRUE);
+  } else {
+    *compiled = compiler_context_compile(ctx);
+  }
+
+  for (l = ctx->diagnostics; l; l = l->next) {
+    gchar *message = compiler_diagnostic_message((CompilerDiagnostic *)l->data);
+
+    g_string_append_printf(output, "%s\n", message);
+    g_free(message);
+  }
+
+  compiler_context_free(ctx);
+  fclose(input);
+
+  return g_string_free(output, FALSE);
+}
+
+static gpointer
+run_jobs(gpointer data)
+{
+  Run *run = (Run *)data;
+  gint i, job;
+
+  for (i = 0; i < run->n_jobs; i++) {
+    job = (run->first + i) % run->n_jobs;
+    run->outputs[job] = job_run(&run->jobs[job], &run->compiled[job]);
+  }
+
+  return NULL;
+}
+
+static void
+run_init(Run *run, Job *jobs, gint n_jobs, gint first)
+{
+  run->jobs = jobs;
+  run->n_jobs = n_jobs;
+  run->first = first;
+  run->outputs = g_new0(gchar *, n_jobs);
+  run->compiled = g_new0(gboolean, n_jobs);
+}
+
+static void
+run_free(Run *run)
+{
+  gint i;
+
+  for (i = 0; i < run->n_jobs; i++)
+    g_free(run->outputs[i]);
+
+  g_free(run->outputs);
+  g_free(run->compiled);
+}
+
+/* writes ``values'' to a file of their own, one per line, for leia() */
+static gchar *
+data_file_new(gchar **values)
+{
+  gchar *name;
+  FILE *file;
+  gint fd;
+
+  if ((fd = g_file_open_tmp("threadsXXXXXX", &name, NULL)) == -1)
+    return NULL;
+
+  file = fdopen(fd, "w");
+  for (; *values; values++) {
+    if (**values)
+      fprintf(file, "%s\n", *values);
+  }
+  fclose(file);
+
+  return name;
+}
+
+int
+main(int argc, char **argv)
+{
+  GArray *jobs;
+  GHashTable *programs;
+  Run reference, runs[THREADS];
+  pthread_t threads[THREADS];
+  gchar *contents, **lines, **words;
+  Job job;
+  gint i, t, level, failed = 0;
+
+  if (argc != 2 || !g_file_get_contents(argv[1], &contents, NULL, NULL)) {
+    fprintf(stderr, "usage: %s programs\n", argv[0]);
+    return 1;
+  }
+
+  jobs = g_array_new(FALSE, TRUE, sizeof(Job));
+  programs = g_hash_table_new(g_str_hash, g_str_equal);
+  lines = g_strsplit(contents, "\n", 0);
+
+  for (i = 0; lines[i]; i++) {
+    words = g_strsplit(lines[i], " ", 0);
+
+    if (!words[0] || !*words[0]) {
+      g_strfreev(words);
+      continue;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.program = words[0];
+
+    /* what it's compiled to doesn't depend on the input */
+    if (!g_hash_table_lookup(programs, job.program)) {
+      g_hash_table_insert(programs, job.program, job.program);
+
+      for (level = 0; level < LEVELS; level++) {
+        for (t = 0; t < G_N_ELEMENTS(targets); t++) {
+          job.level = level;
+          job.target = targets[t];
+          g_array_append_val(jobs, job);
+        }
+      }
+    }
+
+    job.level = 1;
+    job.target = NULL;
+    if (!(job.data_file = data_file_new(words + 1))) {
+      fprintf(stderr, "can't create temporary files\n");
+      return 1;
+    }
+    g_array_append_val(jobs, job);
+  }
+
+  run_init(&reference, (Job *)jobs->data, jobs->len, 0);
+  run_jobs(&reference);
+
+  for (t = 0; t < THREADS; t++) {
+    run_init(&runs[t], (Job *)jobs->data, jobs->len, t * jobs->len / THREADS);
+    pthread_create(&threads[t], NULL, run_jobs, &runs[t]);
+  }
+
+  for (t = 0; t < THREADS; t++) {
+    pthread_join(threads[t], NULL);
+
+    for (i = 0; i < jobs->len; i++) {
+      Job *j = &g_array_index(jobs, Job, i);
+
+      if (runs[t].compiled[i] == reference.compiled[i] &&
+          g_str_equal(runs[t].outputs[i], reference.outputs[i]))
+        continue;
+
+      failed++;
+      if (j->data_file)
+        printf("  thread %d: %s, autotuned, differs\n", t, j->program);
+      else
+        printf("  thread %d: %s -O%d --target=%s differs\n", t, j->program, j->level,
+               j->target ? j->target : "mvd");
+    }
+
+    run_free(&runs[t]);
+  }
+
+  printf("%d jobs on %d threads, %d differ\n", jobs->len, THREADS, failed);
+
+  for (i = 0; i < jobs->len; i++) {
+    Job *j = &g_array_index(jobs, Job, i);
+
+    if (j->data_file) {
+      unlink(j->data_file);
+      g_free(j->data_file);
+    }
+  }
+
+  return failed != 0;
+}